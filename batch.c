@@ -0,0 +1,113 @@
+// Compile: gcc -O2 -o batch batch.c chip8_batch.c chip8.c chip8_threaded.c chip8_jit.c stack.c
+// Usage: ./batch rom [environments] [steps] [frames per step] [score address ...]
+//
+// Steps a batch of environments on one rom with random actions and
+// reports steps per second. Each score address is read as a reward
+// term with weight 1, written as 0x1F0 for memory or v3 for a register.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "./chip8_batch.h"
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t next_random(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+int main(int argc, char **argv) {
+    struct chip8_batch_options options = CHIP8_BATCH_OPTIONS_DEFAULT;
+    struct chip8_reward_term terms[CHIP8_BATCH_MAX_REWARD_TERMS];
+    int count = 1024;
+    long steps = 1000;
+    long frames = 4;
+
+    if(argc < 2) {
+        printf("Usage: %s rom [environments] [steps] [frames per step] [score address ...]\n", argv[0]);
+        return -1;
+    }
+    if(argc > 2) {
+        count = atoi(argv[2]);
+    }
+    if(argc > 3) {
+        steps = atol(argv[3]);
+    }
+    if(argc > 4) {
+        frames = atol(argv[4]);
+    }
+    for(int i = 5; i < argc && options.reward_term_count < CHIP8_BATCH_MAX_REWARD_TERMS; i++) {
+        struct chip8_reward_term *term = &terms[options.reward_term_count++];
+        term->weight = 1;
+        if(argv[i][0] == 'v' || argv[i][0] == 'V') {
+            term->source = CHIP8_REWARD_REGISTER;
+            term->address = strtoul(argv[i] + 1, NULL, 16);
+        } else {
+            term->source = CHIP8_REWARD_MEMORY;
+            term->address = strtoul(argv[i], NULL, 0);
+        }
+    }
+    options.reward_terms = terms;
+
+    FILE *file = fopen(argv[1], "rb");
+    if(file == NULL) {
+        printf("Error open rom file\n");
+        return -1;
+    }
+    static unsigned char rom[MEMORY_SIZE - PROGRAM_START];
+    long size = fread(rom, 1, sizeof(rom), file);
+    fclose(file);
+
+    struct chip8_batch batch;
+    if(chip8_batch_init(&batch, count, rom, size, &options) < 0) {
+        printf("Could not start %d environments\n", count);
+        return -1;
+    }
+
+    float *rewards = malloc(sizeof(float) * count);
+    uint8_t *dones = malloc(count);
+    uint64_t *observations = malloc(sizeof(uint64_t) * CHIP8_OBSERVATION_WORDS * count);
+    uint16_t *actions = malloc(sizeof(uint16_t) * count);
+    chip8_batch_set_buffers(&batch, rewards, dones, observations);
+    chip8_batch_reset(&batch);
+
+    uint32_t random_state = 0x9E3779B9;
+    double total_reward = 0;
+    long total_dones = 0;
+    double elapsed = 0;
+    for(long step = 0; step < steps; step++) {
+        for(int env = 0; env < count; env++) {
+            // No key or one key.
+            uint32_t x = next_random(&random_state);
+            actions[env] = x & 0x10 ? 0 : 1 << (x & 0xF);
+        }
+
+        double start = now_seconds();
+        chip8_batch_step(&batch, actions, frames);
+        elapsed += now_seconds() - start;
+
+        for(int env = 0; env < count; env++) {
+            total_reward += rewards[env];
+            total_dones += dones[env];
+        }
+    }
+
+    printf("%d environments, %ld steps of %ld frames: %.0f steps/s, total reward %.0f, %ld done\n", count, steps,
+           frames, count * steps / elapsed, total_reward, total_dones);
+
+    chip8_batch_destroy(&batch);
+    free(rewards);
+    free(dones);
+    free(observations);
+    free(actions);
+    return 0;
+}
@@ -0,0 +1,241 @@
+// Compile: gcc -O2 -pthread -o bench bench.c chip8.c chip8_threaded.c chip8_jit.c chip8_render.c stack.c
+// Usage: ./bench [cycles] [rom ...]
+// Compares the dispatch engines on generated roms that each stress one
+// kind of instruction, then on real roms. Prints one CSV line per rom and
+// engine: instructions per second and nanoseconds per instruction when
+// run flat out, and frames per second at the normal instructions per
+// frame, without and with the display rendered to pixels every frame.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "./chip8.h"
+#include "./chip8_render.h"
+
+#define DEFAULT_CYCLES 50000000L
+
+// Instructions per frame, as in an uncapped batch run.
+#define CYCLES_PER_FRAME 1000
+
+// Frames run for the frames per second columns.
+#define BENCH_FRAMES 20000
+// As in main.
+#define RENDER_SCALE 5
+
+static const char *default_roms[] = { "./roms/pong1pl.ch8" };
+
+static const char *engine_names[] = {
+    [CHIP8_ENGINE_CALL] = "call",
+    [CHIP8_ENGINE_THREADED] = "threaded",
+    [CHIP8_ENGINE_JIT] = "jit",
+};
+
+/*
+    Generated roms. Each is an endless loop made almost entirely of one
+    kind of instruction, so its nanoseconds per instruction is the cost of
+    that kind. Every loop changes a register so idle detection leaves it be.
+*/
+
+// 8XYN arithmetic on V0 - V4.
+static const unsigned short alu_rom[] = {
+    0x6001, 0x6103,
+    0x8014, 0x8125, 0x8016, 0x8213, 0x8302, 0x8431, 0x801E, 0x8027, 0x8141, 0x8350, 0x7101,
+    0x1204,
+};
+
+// Font sprites drawn all over the display.
+static const unsigned short draw_rom[] = {
+    0xA050, 0x6000, 0x6100,
+    0xD015, 0xD105, 0xD01A, 0x7003, 0x7102, 0xF029,
+    0x1206,
+};
+
+// 16x16 sprites and scrolls in high resolution.
+static const unsigned short hires_rom[] = {
+    0x00FF, 0xA0A0, 0x6000, 0x6100,
+    0xD010, 0xD01A, 0x00C1, 0x00FB, 0x00FC, 0x7005, 0x7103, 0xF030,
+    0x1208,
+};
+
+// FX55 / FX65 of all 16 registers.
+static const unsigned short memory_rom[] = {
+    0xA300, 0xFF55, 0xA300, 0xFF65, 0x7E01,
+    0x1200,
+};
+
+// Calls CALL_DEPTH subroutines deep, each just calling the next and returning.
+#define CALL_DEPTH 15
+#define CALL_STRIDE 0x10
+
+#define SYNTHETIC_ROMS 5
+
+struct bench_rom {
+    const char *name;
+    unsigned char bytes[MEMORY_SIZE - PROGRAM_START];
+    long size;
+};
+
+static void put_program(struct bench_rom *rom, const unsigned short *program, int count) {
+    for(int i = 0; i < count; i++) {
+        rom->bytes[i * 2] = program[i] >> 8;
+        rom->bytes[i * 2 + 1] = program[i] & 0xFF;
+    }
+    rom->size = count * 2;
+}
+
+static void put_calls(struct bench_rom *rom) {
+    // 0x200: 7E01; 2210; 1200
+    const unsigned short main_loop[] = { 0x7E01, 0x2000 | (PROGRAM_START + CALL_STRIDE), 0x1200 };
+    put_program(rom, main_loop, 3);
+    for(int level = 1; level <= CALL_DEPTH; level++) {
+        unsigned char *sub = rom->bytes + level * CALL_STRIDE;
+        int next = PROGRAM_START + (level + 1) * CALL_STRIDE;
+        int i = 0;
+        if(level < CALL_DEPTH) {
+            sub[i++] = 0x20 | (next >> 8);
+            sub[i++] = next & 0xFF;
+        }
+        sub[i++] = 0x00;
+        sub[i++] = 0xEE;
+        rom->size = level * CALL_STRIDE + i;
+    }
+}
+
+#define PROGRAM(program) program, sizeof(program) / sizeof(program[0])
+
+static int make_synthetic_roms(struct bench_rom *roms) {
+    roms[0].name = "synthetic:alu";
+    put_program(&roms[0], PROGRAM(alu_rom));
+    roms[1].name = "synthetic:draw";
+    put_program(&roms[1], PROGRAM(draw_rom));
+    roms[2].name = "synthetic:calls";
+    put_calls(&roms[2]);
+    roms[3].name = "synthetic:memory";
+    put_program(&roms[3], PROGRAM(memory_rom));
+    roms[4].name = "synthetic:hires";
+    put_program(&roms[4], PROGRAM(hires_rom));
+    return SYNTHETIC_ROMS;
+}
+
+struct bench_result {
+    double instructions_per_second;
+    double frames_per_second;
+    double rendered_frames_per_second;
+};
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Starts a machine on the rom. Returns -1 if it does not fit.
+static int start_machine(struct chip8_machine *machine, const struct bench_rom *rom, enum chip8_engine engine) {
+    chip8_init(machine);
+    machine->engine = engine;
+    return chip8_load_rom_buffer(machine, rom->bytes, rom->size);
+}
+
+// Runs `frames` frames, rendering each one if pixels is not NULL. Returns frames per second.
+static double bench_frames(struct chip8_machine *machine, long frames, uint32_t *pixels) {
+    struct chip8_palette palette = CHIP8_PALETTE_DEFAULT;
+    int pitch = CHIP8_HIRES_WIDTH * RENDER_SCALE * sizeof(uint32_t);
+    long frame = 0;
+    double start = now_seconds();
+    for(; frame < frames && machine->status == CHIP8_OK; frame++) {
+        chip8_run_frame(machine, CHIP8_CYCLES_PER_FRAME);
+        if(pixels != NULL) {
+            chip8_render_rgba(&machine->display, &palette, RENDER_SCALE, pixels, pitch);
+        }
+    }
+    return frame / (now_seconds() - start);
+}
+
+// Benchmarks one rom on one engine.
+static int bench_rom(struct chip8_machine *machine, const struct bench_rom *rom, enum chip8_engine engine,
+                     long cycles, uint32_t *pixels, struct bench_result *result) {
+    if(start_machine(machine, rom, engine) < 0) {
+        return -1;
+    }
+    long executed = 0;
+    double start = now_seconds();
+    while(executed < cycles && machine->status == CHIP8_OK) {
+        executed += chip8_run_frame(machine, CYCLES_PER_FRAME);
+    }
+    double elapsed = now_seconds() - start;
+    if(machine->status != CHIP8_OK) {
+        fprintf(stderr, "%s halted on %s after %ld instructions\n", rom->name, chip8_status_name(machine->status),
+                executed);
+    }
+    chip8_destroy(machine);
+    result->instructions_per_second = executed / elapsed;
+
+    start_machine(machine, rom, engine);
+    result->frames_per_second = bench_frames(machine, BENCH_FRAMES, NULL);
+    chip8_destroy(machine);
+    start_machine(machine, rom, engine);
+    result->rendered_frames_per_second = bench_frames(machine, BENCH_FRAMES, pixels);
+    chip8_destroy(machine);
+    return 0;
+}
+
+// Returns -1 if the rom can't be read.
+static int read_rom(struct bench_rom *rom, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) {
+        fprintf(stderr, "Error open %s\n", path);
+        return -1;
+    }
+    rom->name = path;
+    rom->size = fread(rom->bytes, 1, sizeof(rom->bytes), file);
+    fclose(file);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    long cycles = DEFAULT_CYCLES;
+    const char **paths = default_roms;
+    int path_count = sizeof(default_roms) / sizeof(default_roms[0]);
+
+    if(argc > 1) {
+        cycles = atol(argv[1]);
+    }
+    if(argc > 2) {
+        paths = (const char **) argv + 2;
+        path_count = argc - 2;
+    }
+
+    struct chip8_machine *machine = malloc(sizeof(struct chip8_machine));
+    uint32_t *pixels = malloc(CHIP8_HIRES_WIDTH * RENDER_SCALE * CHIP8_HIRES_HEIGHT * RENDER_SCALE * sizeof(uint32_t));
+    struct bench_rom *roms = calloc(SYNTHETIC_ROMS + 1, sizeof(struct bench_rom));
+    int rom_count = make_synthetic_roms(roms);
+
+    printf("rom,engine,instr_per_s,ns_per_instr,speedup,frames_per_s,rendered_frames_per_s\n");
+    for(int i = 0; i < rom_count + path_count; i++) {
+        // Files are read into the slot after the generated roms.
+        const struct bench_rom *rom = &roms[i < rom_count ? i : rom_count];
+        if(i >= rom_count && read_rom(&roms[rom_count], paths[i - rom_count]) < 0) {
+            continue;
+        }
+        double baseline = 0;
+        for(int engine = CHIP8_ENGINE_CALL; engine <= CHIP8_ENGINE_JIT; engine++) {
+            struct bench_result result;
+            if(bench_rom(machine, rom, engine, cycles, pixels, &result) < 0) {
+                break;
+            }
+            if(engine == CHIP8_ENGINE_CALL) {
+                baseline = result.instructions_per_second;
+            }
+            printf("%s,%s,%.0f,%.3f,%.2f,%.0f,%.0f\n", rom->name, engine_names[engine], result.instructions_per_second,
+                   1e9 / result.instructions_per_second, result.instructions_per_second / baseline,
+                   result.frames_per_second, result.rendered_frames_per_second);
+            fflush(stdout);
+        }
+    }
+
+    free(roms);
+    free(pixels);
+    free(machine);
+    return 0;
+}
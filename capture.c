@@ -0,0 +1,114 @@
+// Compile: gcc -O2 -pthread -o capture capture.c chip8_capture.c chip8_render.c chip8_replay.c chip8.c chip8_threaded.c chip8_jit.c stack.c
+// Usage: ./capture [--drop] [--realtime] [--scale=N] rom output.y4m|output.avi|output.png [recording | frames]
+//
+// Records a session to video with no window, replaying a recording made
+// with ./main, or running a number of frames with no keys pressed. Every
+// frame is kept, the machine waits for the encoder when it is behind.
+// --drop drops frames instead, --realtime runs at 60 frames per second
+// rather than flat out, as a live session would.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "./chip8_capture.h"
+#include "./chip8_replay.h"
+
+#define DEFAULT_FRAMES 3600
+
+#define NS_PER_SECOND 1000000000ULL
+
+struct session {
+    struct chip8_capture capture;
+    bool realtime;
+    // When the next frame is due, if realtime.
+    uint64_t deadline;
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
+
+static void capture_frame(void *context, const struct chip8_machine *machine) {
+    struct session *session = context;
+    chip8_capture_frame(&session->capture, &machine->display);
+    if(session->realtime) {
+        session->deadline += NS_PER_SECOND / CHIP8_FRAME_RATE;
+        struct timespec ts = { session->deadline / NS_PER_SECOND, session->deadline % NS_PER_SECOND };
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+            // Interrupted by a signal, go back to sleep.
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    struct chip8_capture_options options = CHIP8_CAPTURE_OPTIONS_DEFAULT;
+    options.policy = CHIP8_CAPTURE_BLOCK;
+    struct session *session = calloc(1, sizeof(struct session));
+
+    // Options first, then positional arguments.
+    int arg = 1;
+    for(; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if(strcmp(argv[arg], "--drop") == 0) {
+            options.policy = CHIP8_CAPTURE_DROP;
+        } else if(strcmp(argv[arg], "--realtime") == 0) {
+            session->realtime = true;
+        } else if(strncmp(argv[arg], "--scale=", 8) == 0) {
+            options.scale = atoi(argv[arg] + 8);
+        } else {
+            printf("Unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    argc -= arg - 1;
+    argv += arg - 1;
+    if(argc < 3) {
+        printf("Usage: %s [--drop] [--realtime] [--scale=N] rom output.y4m|output.avi|output.png [recording | frames]\n",
+               argv[0]);
+        return -1;
+    }
+
+    struct chip8_machine *machine = malloc(sizeof(struct chip8_machine));
+    chip8_init(machine);
+    if(chip8_load_rom(machine, argv[1]) < 0) {
+        return -1;
+    }
+    if(chip8_capture_open(&session->capture, argv[2], &options) < 0) {
+        return -1;
+    }
+
+    struct chip8_replay replay;
+    uint64_t start = now_ns();
+    session->deadline = start;
+    long frames = 0;
+    if(argc > 3 && chip8_replay_open(&replay, argv[3]) == 0) {
+        struct chip8_replay_result result;
+        chip8_replay_run_frames(&replay, machine, &result, capture_frame, session);
+        chip8_replay_close(&replay);
+        if(result.diverged_at >= 0) {
+            printf("Diverged from the recording after frame %ld\n", result.diverged_at);
+        }
+        frames = result.frames;
+    } else {
+        long count = argc > 3 ? atol(argv[3]) : DEFAULT_FRAMES;
+        for(; frames < count && machine->status == CHIP8_OK; frames++) {
+            chip8_run_frame(machine, CHIP8_CYCLES_PER_FRAME);
+            capture_frame(session, machine);
+        }
+    }
+    double emulated = (now_ns() - start) / 1e9;
+
+    int status = chip8_capture_close(&session->capture);
+    double total = (now_ns() - start) / 1e9;
+    printf("%ld frames in %.3f s (%.0f frames/s), %llu captured, %llu dropped, all written in %.3f s\n", frames,
+           emulated, frames / emulated, (unsigned long long) session->capture.written,
+           (unsigned long long) session->capture.dropped, total);
+
+    chip8_destroy(machine);
+    free(machine);
+    free(session);
+    return status;
+}
@@ -0,0 +1,607 @@
+// Library: gcc -c chip8.c chip8_threaded.c chip8_jit.c chip8_audio.c chip8_capture.c chip8_render.c chip8_triple.c chip8_fleet.c chip8_lockstep.c chip8_batch.c chip8_state.c chip8_tree.c chip8_replay.c chip8_profile.c chip8_trace.c stack.c && ar rcs libchip8.a chip8.o chip8_threaded.o chip8_jit.o chip8_audio.o chip8_capture.o chip8_render.o chip8_triple.o chip8_fleet.o chip8_lockstep.o chip8_batch.o chip8_state.o chip8_tree.o chip8_replay.o chip8_profile.o chip8_trace.o stack.o
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "./chip8.h"
+#include "./chip8_ops.h"
+#include "./chip8_trace.h"
+#if CHIP8_PROFILE
+#include "./chip8_profile.h"
+#endif
+
+// Font as sprite data.
+// The font has 16 hexadecimal characters
+// Each character is 4x5 pixels
+static const unsigned char font[80] = { 0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+                                        0x20, 0x60, 0x20, 0x20, 0x70, // 1
+                                        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+                                        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+                                        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+                                        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+                                        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+                                        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+                                        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+                                        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+                                        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+                                        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+                                        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+                                        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+                                        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+                                        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+                                        };
+
+// SUPER-CHIP font for FX30, 8x10 pixels per character.
+static const unsigned char big_font[160] = {
+    0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+    0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+    0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+    0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+    0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+    0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+    0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+    0x18, 0x3C, 0x66, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFE, 0xC3, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xFE, 0xFC, // B
+    0x3C, 0x7E, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0x7E, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+void chip8_init(struct chip8_machine *machine) {
+    memset(machine, 0x00, sizeof(*machine));
+
+    machine->PC = PROGRAM_START;
+    machine->stack.len = STACK_SIZE;
+    machine->engine = CHIP8_DEFAULT_ENGINE;
+    machine->quirks = CHIP8_DEFAULT_QUIRKS;
+    machine->planes = 1;
+    // 4 samples on, 4 off: 500 Hz at the default pitch.
+    memset(machine->audio_pattern, 0xF0, sizeof(machine->audio_pattern));
+    machine->pitch = CHIP8_AUDIO_DEFAULT_PITCH;
+    machine->idle.enabled = true;
+    machine->idle.probe_interval = 1;
+    chip8_seed(machine, 0);
+
+    // Store the font in interpreters memory.
+    // From 0x50 by convention.
+    memcpy(machine->memory + FONT_START, font, sizeof(font));
+    memcpy(machine->memory + BIG_FONT_START, big_font, sizeof(big_font));
+}
+
+// Releases what the machine allocated while running.
+// The machine itself belongs to the caller.
+void chip8_destroy(struct chip8_machine *machine) {
+    chip8_jit_free(machine);
+}
+
+int chip8_load_rom_buffer(struct chip8_machine *machine, const unsigned char *rom, long size) {
+    if(size < 0 || size > MEMORY_SIZE - PROGRAM_START) {
+        printf("Rom does not fit in memory (%ld bytes)\n", size);
+        return -1;
+    }
+    memcpy(machine->memory + PROGRAM_START, rom, size);
+    chip8_invalidate_decode_cache(machine);
+    return 0;
+}
+
+int chip8_load_rom(struct chip8_machine *machine, const char *pathname) {
+    FILE *rom;
+    long fsize;
+    unsigned char buffer[MEMORY_SIZE - PROGRAM_START];
+
+    if((rom = fopen(pathname, "rb")) == NULL) {
+        printf("Error open rom file\n");
+        return -1;
+    }
+
+    // Find size of file
+    fseek(rom, 0L, SEEK_END);
+    fsize = ftell(rom);
+    rewind(rom);
+    printf("file size: %ld\n", fsize);
+
+    if(fsize > (long) sizeof(buffer)) {
+        printf("Rom does not fit in memory (%ld bytes)\n", fsize);
+        fclose(rom);
+        return -1;
+    }
+
+    // Read entire file
+    if(fread(buffer, 1, fsize, rom) != (size_t) fsize) {
+        printf("Error reading rom file\n");
+        fclose(rom);
+        return -1;
+    }
+    fclose(rom);
+
+    return chip8_load_rom_buffer(machine, buffer, fsize);
+}
+
+void chip8_seed(struct chip8_machine *machine, uint64_t seed) {
+    // The PCG reference seeding: step from 0, add the seed, step again.
+    machine->random_state = (CHIP8_PCG_INCREMENT + seed) * CHIP8_PCG_MULTIPLIER + CHIP8_PCG_INCREMENT;
+}
+
+void chip8_tick_timers(struct chip8_machine *machine) {
+    // Delay timer
+    // Count down timer if its larger than zero.
+    if(machine->delay_timer > 0) {
+        machine->delay_timer -= 1;
+    }
+
+    // Sound timer
+    // Should also play a beep
+    // Count down timer if its larger than zero.
+    if(machine->sound_timer > 0) {
+        machine->sound_timer -= 1;
+    }
+}
+
+void chip8_set_quirks(struct chip8_machine *machine, enum chip8_quirks quirks) {
+    if(machine->quirks != quirks) {
+        machine->quirks = quirks;
+        // Decoded instructions and translated blocks have the old quirks baked in.
+        chip8_invalidate_decode_cache(machine);
+    }
+}
+
+static const char *quirks_names[CHIP8_QUIRKS_COUNT] = {
+    [CHIP8_QUIRKS_VIP] = "vip",
+    [CHIP8_QUIRKS_SCHIP] = "schip",
+    [CHIP8_QUIRKS_XOCHIP] = "xochip",
+};
+
+const char *chip8_quirks_name(enum chip8_quirks quirks) {
+    return quirks_names[quirks];
+}
+
+int chip8_quirks_from_name(const char *name) {
+    for(int quirks = 0; quirks < CHIP8_QUIRKS_COUNT; quirks++) {
+        if(strcmp(name, quirks_names[quirks]) == 0) {
+            return quirks;
+        }
+    }
+    return -1;
+}
+
+// Call after changing memory from outside the core.
+void chip8_invalidate_decode_cache(struct chip8_machine *machine) {
+    for(int i = 0; i < MEMORY_SIZE / 2; i++) {
+        machine->decode_cache[i].handler = NULL;
+    }
+    chip8_jit_flush(machine);
+}
+
+// The handlers of one quirk profile, e.g. op_8xy6_vip.
+#define HANDLERS(quirks) {                \
+    [CHIP8_OP_INVALID] = op_invalid,      \
+    [CHIP8_OP_NOP] = op_nop,              \
+    [CHIP8_OP_00E0] = op_00e0,            \
+    [CHIP8_OP_00EE] = op_00ee,            \
+    [CHIP8_OP_00CN] = op_00cn,            \
+    [CHIP8_OP_00DN] = op_00dn,            \
+    [CHIP8_OP_00FB] = op_00fb,            \
+    [CHIP8_OP_00FC] = op_00fc,            \
+    [CHIP8_OP_00FD] = op_00fd,            \
+    [CHIP8_OP_00FE] = op_00fe,            \
+    [CHIP8_OP_00FF] = op_00ff,            \
+    [CHIP8_OP_1NNN] = op_1nnn,            \
+    [CHIP8_OP_2NNN] = op_2nnn,            \
+    [CHIP8_OP_3XNN] = op_3xnn,            \
+    [CHIP8_OP_4XNN] = op_4xnn,            \
+    [CHIP8_OP_5XY0] = op_5xy0,            \
+    [CHIP8_OP_5XY2] = op_5xy2,            \
+    [CHIP8_OP_5XY3] = op_5xy3,            \
+    [CHIP8_OP_6XNN] = op_6xnn,            \
+    [CHIP8_OP_7XNN] = op_7xnn,            \
+    [CHIP8_OP_8XY0] = op_8xy0,            \
+    [CHIP8_OP_8XY1] = op_8xy1_##quirks,   \
+    [CHIP8_OP_8XY2] = op_8xy2_##quirks,   \
+    [CHIP8_OP_8XY3] = op_8xy3_##quirks,   \
+    [CHIP8_OP_8XY4] = op_8xy4,            \
+    [CHIP8_OP_8XY5] = op_8xy5,            \
+    [CHIP8_OP_8XY6] = op_8xy6_##quirks,   \
+    [CHIP8_OP_8XY7] = op_8xy7,            \
+    [CHIP8_OP_8XYE] = op_8xye_##quirks,   \
+    [CHIP8_OP_9XY0] = op_9xy0,            \
+    [CHIP8_OP_ANNN] = op_annn,            \
+    [CHIP8_OP_BNNN] = op_bnnn,            \
+    [CHIP8_OP_CXNN] = op_cxnn,            \
+    [CHIP8_OP_DXYN] = op_dxyn,            \
+    [CHIP8_OP_EX9E] = op_ex9e,            \
+    [CHIP8_OP_EXA1] = op_exa1,            \
+    [CHIP8_OP_FN01] = op_fn01,            \
+    [CHIP8_OP_F002] = op_f002,            \
+    [CHIP8_OP_FX07] = op_fx07,            \
+    [CHIP8_OP_FX0A] = op_fx0a,            \
+    [CHIP8_OP_FX15] = op_fx15,            \
+    [CHIP8_OP_FX18] = op_fx18,            \
+    [CHIP8_OP_FX1E] = op_fx1e,            \
+    [CHIP8_OP_FX29] = op_fx29,            \
+    [CHIP8_OP_FX30] = op_fx30,            \
+    [CHIP8_OP_FX33] = op_fx33,            \
+    [CHIP8_OP_FX3A] = op_fx3a,            \
+    [CHIP8_OP_FX55] = op_fx55_##quirks,   \
+    [CHIP8_OP_FX65] = op_fx65_##quirks,   \
+    [CHIP8_OP_FX75] = op_fx75,            \
+    [CHIP8_OP_FX85] = op_fx85,            \
+    }
+
+static const chip8_handler handlers[CHIP8_QUIRKS_COUNT][CHIP8_OP_COUNT] = {
+    [CHIP8_QUIRKS_VIP] = HANDLERS(vip),
+    [CHIP8_QUIRKS_SCHIP] = HANDLERS(schip),
+    [CHIP8_QUIRKS_XOCHIP] = HANDLERS(xochip),
+};
+
+// Resolves the handler for an instruction and fills in the operands it uses.
+void chip8_decode(unsigned short instruction, enum chip8_quirks quirks, struct chip8_decoded *d) {
+    // Instruction is ABCD
+    unsigned char first = instruction >> 12;
+
+    // Second nibble
+    d->X = (instruction >> 8) & 0xF;
+    // Third nibble
+    d->Y = (instruction >> 4) & 0xF;
+    // Fourth nibble
+    d->N = instruction & 0xF;
+    // Second byte (third and fourth nibble)
+    d->NN = instruction & 0x00FF;
+    // Second, third and fourth nibble
+    d->NNN = instruction & 0x0FFF;
+
+    switch(first) {
+        case 0x0:
+            // 0NNN	Call - Calls machine code routine (RCA 1802 for COSMAC VIP) at address NNN. Not necessary for most ROMs.
+            switch(instruction & 0xFFF0) {
+                case 0x00C0: d->op = CHIP8_OP_00CN; break;
+                case 0x00D0: d->op = CHIP8_OP_00DN; break;
+                default:
+                    switch(instruction) {
+                        case 0x00E0: d->op = CHIP8_OP_00E0; break;
+                        case 0x00EE: d->op = CHIP8_OP_00EE; break;
+                        case 0x00FB: d->op = CHIP8_OP_00FB; break;
+                        case 0x00FC: d->op = CHIP8_OP_00FC; break;
+                        case 0x00FD: d->op = CHIP8_OP_00FD; break;
+                        case 0x00FE: d->op = CHIP8_OP_00FE; break;
+                        case 0x00FF: d->op = CHIP8_OP_00FF; break;
+                        default:     d->op = CHIP8_OP_INVALID; break;
+                    }
+                    break;
+            }
+            break;
+        case 0x1: d->op = CHIP8_OP_1NNN; break;
+        case 0x2: d->op = CHIP8_OP_2NNN; break;
+        case 0x3: d->op = CHIP8_OP_3XNN; break;
+        case 0x4: d->op = CHIP8_OP_4XNN; break;
+        case 0x5:
+            // Other chips ignore the last nibble.
+            if(quirks == CHIP8_QUIRKS_XOCHIP && d->N == 0x2) {
+                d->op = CHIP8_OP_5XY2;
+            } else if(quirks == CHIP8_QUIRKS_XOCHIP && d->N == 0x3) {
+                d->op = CHIP8_OP_5XY3;
+            } else {
+                d->op = CHIP8_OP_5XY0;
+            }
+            break;
+        case 0x6: d->op = CHIP8_OP_6XNN; break;
+        case 0x7: d->op = CHIP8_OP_7XNN; break;
+        case 0x8:
+            switch(d->N) {
+                case 0x0: d->op = CHIP8_OP_8XY0; break;
+                case 0x1: d->op = CHIP8_OP_8XY1; break;
+                case 0x2: d->op = CHIP8_OP_8XY2; break;
+                case 0x3: d->op = CHIP8_OP_8XY3; break;
+                case 0x4: d->op = CHIP8_OP_8XY4; break;
+                case 0x5: d->op = CHIP8_OP_8XY5; break;
+                case 0x6: d->op = CHIP8_OP_8XY6; break;
+                case 0x7: d->op = CHIP8_OP_8XY7; break;
+                case 0xE: d->op = CHIP8_OP_8XYE; break;
+                default:  d->op = CHIP8_OP_NOP; break;
+            }
+            break;
+        case 0x9: d->op = CHIP8_OP_9XY0; break;
+        case 0xA: d->op = CHIP8_OP_ANNN; break;
+        case 0xB: d->op = CHIP8_OP_BNNN; break;
+        case 0xC: d->op = CHIP8_OP_CXNN; break;
+        case 0xD: d->op = CHIP8_OP_DXYN; break;
+        case 0xE:
+            switch(d->NN) {
+                case 0x9E: d->op = CHIP8_OP_EX9E; break;
+                case 0xA1: d->op = CHIP8_OP_EXA1; break;
+                default:   d->op = CHIP8_OP_NOP; break;
+            }
+            break;
+        case 0xF:
+            switch(d->NN) {
+                // F000 NNNN, XO-CHIP's long load of I, is not supported: its operand would run as code.
+                case 0x00: d->op = quirks == CHIP8_QUIRKS_XOCHIP && d->X == 0 ? CHIP8_OP_INVALID : CHIP8_OP_NOP; break;
+                case 0x01: d->op = CHIP8_OP_FN01; break;
+                case 0x02: d->op = d->X == 0 ? CHIP8_OP_F002 : CHIP8_OP_NOP; break;
+                case 0x07: d->op = CHIP8_OP_FX07; break;
+                case 0x0A: d->op = CHIP8_OP_FX0A; break;
+                case 0x15: d->op = CHIP8_OP_FX15; break;
+                case 0x18: d->op = CHIP8_OP_FX18; break;
+                case 0x1E: d->op = CHIP8_OP_FX1E; break;
+                case 0x29: d->op = CHIP8_OP_FX29; break;
+                case 0x30: d->op = CHIP8_OP_FX30; break;
+                case 0x33: d->op = CHIP8_OP_FX33; break;
+                case 0x3A: d->op = CHIP8_OP_FX3A; break;
+                case 0x55: d->op = CHIP8_OP_FX55; break;
+                case 0x65: d->op = CHIP8_OP_FX65; break;
+                case 0x75: d->op = CHIP8_OP_FX75; break;
+                case 0x85: d->op = CHIP8_OP_FX85; break;
+                default:   d->op = CHIP8_OP_NOP; break;
+            }
+            break;
+    }
+
+    d->handler = handlers[quirks][d->op];
+}
+
+enum chip8_status chip8_step(struct chip8_machine *machine) {
+    if(machine->status != CHIP8_OK) {
+        return machine->status;
+    }
+
+    struct chip8_decoded uncached;
+    unsigned short PC = machine->PC;
+    const struct chip8_decoded *d = fetch_decoded(machine, &uncached);
+#if CHIP8_PROFILE
+    if(machine->profile != NULL) {
+        chip8_profile_instruction(machine->profile, PC, d->op);
+        d->handler(machine, d);
+        chip8_profile_executed(machine->profile, machine, d);
+        return machine->status;
+    }
+#endif
+    if(machine->trace != NULL) {
+        chip8_trace_step(machine->trace, machine, PC, d);
+        return machine->status;
+    }
+    d->handler(machine, d);
+
+    return machine->status;
+}
+
+// Runs up to `cycles` instructions on the machine's engine.
+// Returns how many were executed, which is less than `cycles` if the machine halted.
+long chip8_run_cycles(struct chip8_machine *machine, long cycles) {
+    // Only the call engine counts instructions for a profile. The call and
+    // threaded engines record a trace, JIT and AOT machines run threaded
+    // while one is attached.
+    enum chip8_engine engine = machine->engine;
+    if(CHIP8_PROFILE && machine->profile != NULL) {
+        engine = CHIP8_ENGINE_CALL;
+    } else if(machine->trace != NULL && engine != CHIP8_ENGINE_CALL) {
+        engine = CHIP8_ENGINE_THREADED;
+    }
+
+    if(engine == CHIP8_ENGINE_THREADED) {
+        return chip8_run_threaded(machine, cycles);
+    }
+    if(engine == CHIP8_ENGINE_JIT) {
+        return chip8_run_jit(machine, cycles);
+    }
+    if(engine == CHIP8_ENGINE_AOT && machine->aot != NULL) {
+        return machine->aot(machine, cycles);
+    }
+
+    long executed = 0;
+    while(executed < cycles && machine->status == CHIP8_OK) {
+        chip8_step(machine);
+        executed++;
+    }
+    return executed;
+}
+
+/*
+    Idle loop detection.
+    Timers only tick and keys only change between frames, so a loop that
+    comes back to the same PC with the same state will keep doing so until
+    the end of the frame. Polling the delay timer (FX07; 3X00; 1NNN) and
+    waiting for a key (FX0A) are the usual cases. Once one is found, the
+    rest of the frame's whole loop iterations are skipped and charged in
+    bulk, and the remainder is run as normal, so PC ends up exactly where
+    it would have.
+*/
+
+// Instructions run on the machine's engine between probes.
+#define IDLE_SLICE 64
+// Instructions stepped while looking for a loop.
+#define IDLE_PROBE_LIMIT 64
+#define IDLE_MAX_PROBE_INTERVAL 256
+// Loops tracked at once, to get past an inner loop.
+#define IDLE_LOOPS 4
+
+// Everything an instruction can change, except PC and what is counted in effects.
+struct idle_state {
+    unsigned char registers[16];
+    unsigned short I;
+    unsigned char delay_timer;
+    unsigned char sound_timer;
+    unsigned int effects;
+    int stack_elements;
+    int stack[STACK_SIZE];
+    unsigned char planes;
+    unsigned char flags[16];
+    struct chip8_display display;
+};
+
+struct idle_loop {
+    unsigned short PC;
+    long seen_at;
+    struct idle_state state;
+};
+
+static void capture_idle_state(struct chip8_machine *machine, struct idle_state *state) {
+    memset(state, 0, sizeof(*state));
+    memcpy(state->registers, machine->registers, sizeof(state->registers));
+    state->I = machine->I;
+    state->delay_timer = machine->delay_timer;
+    state->sound_timer = machine->sound_timer;
+    state->effects = machine->effects;
+    state->stack_elements = machine->stack.elements;
+    memcpy(state->stack, machine->stack.stack, sizeof(int) * machine->stack.elements);
+    state->planes = machine->planes;
+    memcpy(state->flags, machine->flags, sizeof(state->flags));
+    memcpy(&state->display, &machine->display, sizeof(state->display));
+}
+
+/*
+    Steps the machine looking for a loop that doesn't change any state.
+    Loops are closed by jumps back to the same or an earlier address.
+    Returns the instructions executed or skipped, at most `remaining`.
+*/
+static long probe_idle(struct chip8_machine *machine, long remaining, bool *found) {
+    struct idle_loop loops[IDLE_LOOPS];
+    int loop_count = 0;
+    int next_slot = 0;
+    struct idle_state state;
+    long executed = 0;
+
+    *found = false;
+    while(executed < remaining && executed < IDLE_PROBE_LIMIT && machine->status == CHIP8_OK) {
+        unsigned short before = machine->PC;
+        chip8_step(machine);
+        executed++;
+
+        if(machine->PC > before) {
+            continue;
+        }
+
+        capture_idle_state(machine, &state);
+        for(int i = 0; i < loop_count; i++) {
+            if(loops[i].PC == machine->PC && memcmp(&loops[i].state, &state, sizeof(state)) == 0) {
+                long period = executed - loops[i].seen_at;
+                long skipped = (remaining - executed) / period * period;
+                machine->idle.skipped += skipped;
+                *found = true;
+                return executed + skipped;
+            }
+        }
+
+        struct idle_loop *loop = NULL;
+        for(int i = 0; i < loop_count; i++) {
+            if(loops[i].PC == machine->PC) {
+                loop = &loops[i];
+            }
+        }
+        if(loop == NULL) {
+            if(loop_count < IDLE_LOOPS) {
+                loop_count++;
+            }
+            loop = &loops[next_slot];
+            next_slot = (next_slot + 1) % IDLE_LOOPS;
+        }
+        loop->PC = machine->PC;
+        loop->seen_at = executed;
+        memcpy(&loop->state, &state, sizeof(state));
+    }
+    return executed;
+}
+
+// Runs one 60 Hz frame: up to `cycles_per_frame` instructions, then one timer tick.
+// Returns how many instructions were executed, counting skipped idle ones.
+long chip8_run_frame(struct chip8_machine *machine, long cycles_per_frame) {
+    long executed = 0;
+
+    if(!machine->idle.enabled) {
+        executed = chip8_run_cycles(machine, cycles_per_frame);
+        chip8_tick_timers(machine);
+        return executed;
+    }
+
+    while(executed < cycles_per_frame && machine->status == CHIP8_OK) {
+        long slice = cycles_per_frame - executed;
+        if(slice > IDLE_SLICE) {
+            slice = IDLE_SLICE;
+        }
+        executed += chip8_run_cycles(machine, slice);
+
+        if(executed >= cycles_per_frame || machine->status != CHIP8_OK) {
+            break;
+        }
+        if(--machine->idle.countdown > 0) {
+            continue;
+        }
+
+        bool found;
+        executed += probe_idle(machine, cycles_per_frame - executed, &found);
+        if(found) {
+            machine->idle.probe_interval = 1;
+        } else if(machine->idle.probe_interval < IDLE_MAX_PROBE_INTERVAL) {
+            machine->idle.probe_interval *= 2;
+        }
+        machine->idle.countdown = machine->idle.probe_interval;
+    }
+
+    chip8_tick_timers(machine);
+    return executed;
+}
+
+void chip8_set_keypad(struct chip8_machine *machine, uint16_t keys) {
+    for(int key = 0; key < 16; key++) {
+        machine->keypad[key] = (keys >> key) & 1;
+    }
+}
+
+// Only the pixels of the current resolution, which are all there can be.
+uint64_t chip8_display_hash(const struct chip8_machine *machine) {
+    const struct chip8_display *display = &machine->display;
+    int words = display->hires ? CHIP8_ROW_WORDS : 1;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(int plane = 0; plane < CHIP8_PLANES; plane++) {
+        for(int y = 0; y < chip8_display_height(display); y++) {
+            for(int word = 0; word < words; word++) {
+                for(int shift = 56; shift >= 0; shift -= 8) {
+                    hash ^= (display->rows[plane][y][word] >> shift) & 0xFF;
+                    hash *= 0x100000001b3ULL;
+                }
+            }
+        }
+    }
+    hash ^= display->hires;
+    hash *= 0x100000001b3ULL;
+    return hash;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t chip8_state_hash(const struct chip8_machine *machine) {
+    uint64_t hash = chip8_display_hash(machine);
+    hash = hash_bytes(hash, machine->memory, sizeof(machine->memory));
+    hash = hash_bytes(hash, machine->registers, sizeof(machine->registers));
+    hash = hash_bytes(hash, &machine->PC, sizeof(machine->PC));
+    hash = hash_bytes(hash, &machine->I, sizeof(machine->I));
+    hash = hash_bytes(hash, &machine->delay_timer, sizeof(machine->delay_timer));
+    hash = hash_bytes(hash, &machine->sound_timer, sizeof(machine->sound_timer));
+    hash = hash_bytes(hash, &machine->stack.elements, sizeof(machine->stack.elements));
+    hash = hash_bytes(hash, machine->stack.stack, sizeof(int) * machine->stack.elements);
+    hash = hash_bytes(hash, &machine->planes, sizeof(machine->planes));
+    hash = hash_bytes(hash, machine->flags, sizeof(machine->flags));
+    hash = hash_bytes(hash, &machine->random_state, sizeof(machine->random_state));
+    return hash;
+}
+
+const char *chip8_status_name(enum chip8_status status) {
+    static const char *names[] = {
+        [CHIP8_OK] = "running",
+        [CHIP8_INVALID_OPCODE] = "invalid opcode",
+        [CHIP8_STACK_OVERFLOW] = "stack overflow",
+        [CHIP8_STACK_UNDERFLOW] = "stack underflow",
+        [CHIP8_EXITED] = "exited",
+    };
+    return names[status];
+}
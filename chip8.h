@@ -0,0 +1,367 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "./stack.h"
+
+/*
+    Headless chip-8 core.
+    Holds all state for one machine, so any number of machines can run
+    in the same process. Nothing in here touches SDL.
+*/
+
+// A low resolution display row is one uint64_t, so the width is fixed at 64.
+#define DISPLAY_WIDTH 64
+#define DISPLAY_HEIGHT 32
+// SUPER-CHIP high resolution, switched to with 00FF.
+#define CHIP8_HIRES_WIDTH 128
+#define CHIP8_HIRES_HEIGHT 64
+#define CHIP8_ROW_WORDS (CHIP8_HIRES_WIDTH / 64)
+// XO-CHIP bitplanes, picked for drawing with FN01.
+#define CHIP8_PLANES 2
+
+// XO-CHIP audio: a pattern of 128 1-bit samples, loaded with F002 and
+// played in a loop at CHIP8_AUDIO_PITCH_RATE * 2^((pitch - 64) / 48)
+// samples per second while the sound timer runs. Pitch is set with FX3A.
+#define CHIP8_AUDIO_PATTERN_SIZE 16
+#define CHIP8_AUDIO_PITCH_RATE 4000
+#define CHIP8_AUDIO_DEFAULT_PITCH 64
+
+#define MEMORY_SIZE 4096
+#define PROGRAM_START 0x200
+#define FONT_START 0x50
+// The SUPER-CHIP 8x10 font for FX30, right after the 4x5 one.
+#define BIG_FONT_START 0xA0
+
+// Memory is tracked for changes in pages of this size, see chip8_machine.dirty.
+#define CHIP8_PAGE_SIZE 256
+#define CHIP8_PAGES (MEMORY_SIZE / CHIP8_PAGE_SIZE)
+// The bit in chip8_machine.dirty for the display.
+#define CHIP8_DIRTY_DISPLAY (1u << CHIP8_PAGES)
+
+// The timers count down at this rate. chip8_run_frame runs one of these frames.
+#define CHIP8_FRAME_RATE 60
+// 600 instructions per second.
+#define CHIP8_CYCLES_PER_FRAME 10
+
+// Returned by chip8_step / chip8_run_cycles.
+// Anything other than CHIP8_OK means the machine has halted.
+enum chip8_status {
+    CHIP8_OK = 0,
+    CHIP8_INVALID_OPCODE,
+    // 2NNN with all STACK_SIZE levels in use.
+    CHIP8_STACK_OVERFLOW,
+    // 00EE outside any subroutine.
+    CHIP8_STACK_UNDERFLOW,
+    // 00FD, the rom asked to exit.
+    CHIP8_EXITED,
+};
+
+// Every instruction the decoder can resolve to.
+// Dispatch engines index their handler or label tables with these.
+enum chip8_op {
+    CHIP8_OP_INVALID = 0,
+    CHIP8_OP_NOP,
+    CHIP8_OP_00E0,
+    CHIP8_OP_00EE,
+    CHIP8_OP_00CN,
+    CHIP8_OP_00DN,
+    CHIP8_OP_00FB,
+    CHIP8_OP_00FC,
+    CHIP8_OP_00FD,
+    CHIP8_OP_00FE,
+    CHIP8_OP_00FF,
+    CHIP8_OP_1NNN,
+    CHIP8_OP_2NNN,
+    CHIP8_OP_3XNN,
+    CHIP8_OP_4XNN,
+    CHIP8_OP_5XY0,
+    CHIP8_OP_5XY2,
+    CHIP8_OP_5XY3,
+    CHIP8_OP_6XNN,
+    CHIP8_OP_7XNN,
+    CHIP8_OP_8XY0,
+    CHIP8_OP_8XY1,
+    CHIP8_OP_8XY2,
+    CHIP8_OP_8XY3,
+    CHIP8_OP_8XY4,
+    CHIP8_OP_8XY5,
+    CHIP8_OP_8XY6,
+    CHIP8_OP_8XY7,
+    CHIP8_OP_8XYE,
+    CHIP8_OP_9XY0,
+    CHIP8_OP_ANNN,
+    CHIP8_OP_BNNN,
+    CHIP8_OP_CXNN,
+    CHIP8_OP_DXYN,
+    CHIP8_OP_EX9E,
+    CHIP8_OP_EXA1,
+    CHIP8_OP_FN01,
+    CHIP8_OP_F002,
+    CHIP8_OP_FX07,
+    CHIP8_OP_FX0A,
+    CHIP8_OP_FX15,
+    CHIP8_OP_FX18,
+    CHIP8_OP_FX1E,
+    CHIP8_OP_FX29,
+    CHIP8_OP_FX30,
+    CHIP8_OP_FX33,
+    CHIP8_OP_FX3A,
+    CHIP8_OP_FX55,
+    CHIP8_OP_FX65,
+    CHIP8_OP_FX75,
+    CHIP8_OP_FX85,
+    CHIP8_OP_COUNT
+};
+
+// How chip8_run_cycles dispatches instructions.
+enum chip8_engine {
+    // Calls the cached handler of each instruction. Works everywhere.
+    CHIP8_ENGINE_CALL = 0,
+    // Jumps between labels with computed gotos (GCC/Clang).
+    // Falls back to CHIP8_ENGINE_CALL on other compilers.
+    CHIP8_ENGINE_THREADED,
+    // Translates basic blocks to x86-64 machine code.
+    // Falls back to CHIP8_ENGINE_CALL on other hosts.
+    CHIP8_ENGINE_JIT,
+    // Runs the rom translated ahead of time by translate.c, set in machine->aot.
+    CHIP8_ENGINE_AOT,
+};
+
+// Build with -DCHIP8_DEFAULT_ENGINE=CHIP8_ENGINE_THREADED to change the default.
+#ifndef CHIP8_DEFAULT_ENGINE
+#define CHIP8_DEFAULT_ENGINE CHIP8_ENGINE_CALL
+#endif
+
+/*
+    Behaviour that differs between interpreters, picked per machine with
+    chip8_set_quirks. Every engine has a variant of the affected ops for
+    each profile, resolved when the instruction is decoded or translated,
+    so a machine never checks its quirks while running.
+*/
+enum chip8_quirks {
+    // COSMAC VIP: 8XY1 - 8XY3 reset VF, 8XY6 / 8XYE shift VY into VX,
+    // FX55 / FX65 leave I past the last register.
+    CHIP8_QUIRKS_VIP = 0,
+    // SUPER-CHIP: shifts work on VX in place, VF and I are left alone.
+    CHIP8_QUIRKS_SCHIP,
+    // XO-CHIP: shifts VY into VX and FX55 / FX65 move I, VF is left alone.
+    // Memory stays 4 KB, and F000 NNNN halts as an invalid instruction.
+    CHIP8_QUIRKS_XOCHIP,
+    CHIP8_QUIRKS_COUNT
+};
+
+// Ops with a variant per quirk profile.
+#define CHIP8_QUIRK_OPS                                                                                        \
+    (1ULL << CHIP8_OP_8XY1 | 1ULL << CHIP8_OP_8XY2 | 1ULL << CHIP8_OP_8XY3 | 1ULL << CHIP8_OP_8XY6 |           \
+     1ULL << CHIP8_OP_8XYE | 1ULL << CHIP8_OP_FX55 | 1ULL << CHIP8_OP_FX65)
+
+// 8XY1 - 8XY3 reset VF.
+static inline bool chip8_quirk_vf_reset(enum chip8_quirks quirks) {
+    return quirks == CHIP8_QUIRKS_VIP;
+}
+
+// 8XY6 / 8XYE shift VY into VX, rather than VX in place.
+static inline bool chip8_quirk_shift_vy(enum chip8_quirks quirks) {
+    return quirks != CHIP8_QUIRKS_SCHIP;
+}
+
+// FX55 / FX65 leave I past the last register.
+static inline bool chip8_quirk_increment_i(enum chip8_quirks quirks) {
+    return quirks != CHIP8_QUIRKS_SCHIP;
+}
+
+// Build with -DCHIP8_DEFAULT_QUIRKS=CHIP8_QUIRKS_VIP to change what chip8_init picks.
+#ifndef CHIP8_DEFAULT_QUIRKS
+#define CHIP8_DEFAULT_QUIRKS CHIP8_QUIRKS_SCHIP
+#endif
+
+// Build with -DCHIP8_PROFILE=1 to count instructions in machine->profile.
+// Without it the core never looks at the profile.
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
+
+struct chip8_machine;
+struct chip8_decoded;
+struct chip8_jit;
+struct chip8_profile;
+struct chip8_trace;
+
+typedef void (*chip8_handler)(struct chip8_machine *machine, const struct chip8_decoded *decoded);
+
+// Entry point of a rom translated to C. Same contract as chip8_run_cycles.
+typedef long (*chip8_aot_function)(struct chip8_machine *machine, long cycles);
+
+/*
+    One pre-decoded instruction.
+    The handler is resolved once, and only the operands it needs are
+    filled in. Which fields that are used is dependent on the handler.
+*/
+
+struct chip8_decoded {
+    chip8_handler handler;
+    unsigned char op;
+    unsigned char X;
+    unsigned char Y;
+    unsigned char N;
+    unsigned char NN;
+    unsigned short NNN;
+};
+
+// Bytes from I an instruction writes to memory, 0 if it writes none.
+static inline int chip8_memory_written(const struct chip8_decoded *d) {
+    switch(d->op) {
+        case CHIP8_OP_5XY2: return (d->X > d->Y ? d->X - d->Y : d->Y - d->X) + 1;
+        case CHIP8_OP_FX33: return 3;
+        case CHIP8_OP_FX55: return d->X + 1;
+        default:            return 0;
+    }
+}
+
+// Idle loop detection used by chip8_run_frame.
+struct chip8_idle {
+    bool enabled;
+    // Slices to run before probing for an idle loop again.
+    // Doubles each time a probe finds nothing.
+    int probe_interval;
+    int countdown;
+    // Instructions skipped over so far.
+    long skipped;
+};
+
+/*
+    The display, one bit per pixel and plane.
+    A row is CHIP8_ROW_WORDS words, the leftmost pixel the top bit of the
+    first word, so scrolling and drawing shift whole words. In low
+    resolution only the first word of the first DISPLAY_HEIGHT rows is used.
+    Pixels outside the current resolution are always 0.
+*/
+struct chip8_display {
+    uint64_t rows[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][CHIP8_ROW_WORDS];
+    bool hires;
+};
+
+static inline int chip8_display_width(const struct chip8_display *display) {
+    return display->hires ? CHIP8_HIRES_WIDTH : DISPLAY_WIDTH;
+}
+
+static inline int chip8_display_height(const struct chip8_display *display) {
+    return display->hires ? CHIP8_HIRES_HEIGHT : DISPLAY_HEIGHT;
+}
+
+struct chip8_machine {
+    unsigned char memory[MEMORY_SIZE];
+    // V0 - VF
+    unsigned char registers[16];
+    // Program counter
+    // points at currenct incstruction in memory
+    unsigned short PC;
+    // Index register
+    // Points at location in memory
+    unsigned short I;
+
+    unsigned char delay_timer;
+    unsigned char sound_timer;
+
+    struct chip8_display display;
+    // Bit p set draws, clears and scrolls plane p. Set with FN01, 1 at start.
+    unsigned char planes;
+    // SUPER-CHIP persistent flags, saved and loaded with FX75 / FX85.
+    unsigned char flags[16];
+
+    // What the sound timer plays. Starts as a square wave, a plain beep.
+    unsigned char audio_pattern[CHIP8_AUDIO_PATTERN_SIZE];
+    unsigned char pitch;
+
+    // Will be used to store 12bit addresses
+    struct Stack stack;
+
+    // Indexed by key value 0x0 - 0xF.
+    // Set to 1 while the key is held down, 0 otherwise.
+    unsigned char keypad[16];
+
+    // Set when the display has changed. Cleared by the front end.
+    bool draw_flag;
+
+    // Why the machine stopped. CHIP8_OK while running.
+    enum chip8_status status;
+
+    // Bumped by changes to state that idle loop detection doesn't compare:
+    // writes that change memory, and random numbers.
+    unsigned int effects;
+    struct chip8_idle idle;
+
+    // PCG32 state for CXNN. Set with chip8_seed.
+    uint64_t random_state;
+
+    // Bit p is set by writes that change memory page p, CHIP8_DIRTY_DISPLAY
+    // by drawing. Never cleared by the core, only by whoever reads it.
+    uint32_t dirty;
+
+    enum chip8_engine engine;
+    // Set with chip8_set_quirks.
+    enum chip8_quirks quirks;
+
+    // Translated blocks, created on first use by CHIP8_ENGINE_JIT.
+    // Released by chip8_destroy.
+    struct chip8_jit *jit;
+
+    // Translated rom run by CHIP8_ENGINE_AOT.
+    chip8_aot_function aot;
+
+    // Set to profile the machine, see chip8_profile.h.
+    // Owned by the caller. The machine then runs on the call engine.
+    struct chip8_profile *profile;
+
+    // Set to record the last instructions run, see chip8_trace.h.
+    // Owned by the caller. The call and threaded engines record it, a JIT
+    // or AOT machine runs on the threaded engine while it is set.
+    struct chip8_trace *trace;
+
+    // One entry per even address in memory.
+    // An entry with no handler has not been decoded yet, or has been
+    // invalidated by a write to its address.
+    struct chip8_decoded decode_cache[MEMORY_SIZE / 2];
+};
+
+// True if the pixel at (x, y) of the current resolution is lit in plane 0.
+static inline bool chip8_pixel(const struct chip8_machine *machine, int x, int y) {
+    return (machine->display.rows[0][y][x / 64] >> (63 - x % 64)) & 1;
+}
+
+void chip8_init(struct chip8_machine *machine);
+void chip8_destroy(struct chip8_machine *machine);
+int chip8_load_rom(struct chip8_machine *machine, const char *pathname);
+int chip8_load_rom_buffer(struct chip8_machine *machine, const unsigned char *rom, long size);
+
+void chip8_decode(unsigned short instruction, enum chip8_quirks quirks, struct chip8_decoded *decoded);
+void chip8_invalidate_decode_cache(struct chip8_machine *machine);
+enum chip8_status chip8_step(struct chip8_machine *machine);
+long chip8_run_cycles(struct chip8_machine *machine, long cycles);
+long chip8_run_threaded(struct chip8_machine *machine, long cycles);
+long chip8_run_jit(struct chip8_machine *machine, long cycles);
+void chip8_jit_invalidate(struct chip8_machine *machine, unsigned short address);
+void chip8_jit_flush(struct chip8_machine *machine);
+void chip8_jit_free(struct chip8_machine *machine);
+void chip8_tick_timers(struct chip8_machine *machine);
+// Machines with the same seed draw the same random numbers. chip8_init seeds with 0.
+void chip8_seed(struct chip8_machine *machine, uint64_t seed);
+long chip8_run_frame(struct chip8_machine *machine, long cycles_per_frame);
+
+// Sets the whole keypad at once, bit k for key k.
+void chip8_set_keypad(struct chip8_machine *machine, uint16_t keys);
+// FNV-1a hash of the display, every plane and the resolution, for comparing runs.
+uint64_t chip8_display_hash(const struct chip8_machine *machine);
+// FNV-1a hash of everything that decides how the machine runs on:
+// memory, registers, PC, I, timers, stack, display, planes, flags and random state.
+uint64_t chip8_state_hash(const struct chip8_machine *machine);
+// Switches the machine to another quirk profile. Can be called at any time.
+void chip8_set_quirks(struct chip8_machine *machine, enum chip8_quirks quirks);
+// "vip", "schip" or "xochip".
+const char *chip8_quirks_name(enum chip8_quirks quirks);
+// Returns -1 for an unknown name.
+int chip8_quirks_from_name(const char *name);
+// e.g. "stack overflow".
+const char *chip8_status_name(enum chip8_status status);
@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+    Support code for roms translated to C by translate.c.
+    Only included from generated files.
+*/
+
+#include <string.h>
+
+#include "./chip8.h"
+#include "./chip8_ops.h"
+
+// A run of memory that the translation was made from.
+struct aot_range {
+    unsigned short start;
+    unsigned short length;
+};
+
+// True while the translated instructions are still what is in memory.
+static inline bool aot_code_intact(struct chip8_machine *machine, const unsigned char *rom,
+                                   const struct aot_range *ranges, int range_count) {
+    for(int i = 0; i < range_count; i++) {
+        const unsigned char *expected = rom + ranges[i].start - PROGRAM_START;
+        if(memcmp(machine->memory + ranges[i].start, expected, ranges[i].length) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// True if writing `count` bytes from `address` touches a translated instruction.
+static inline bool aot_writes_code(unsigned short address, int count,
+                                   const struct aot_range *ranges, int range_count) {
+    for(int i = 0; i < range_count; i++) {
+        for(int offset = 0; offset < count; offset++) {
+            unsigned short written = (address + offset) & (MEMORY_SIZE - 1);
+            if(written >= ranges[i].start && written < ranges[i].start + ranges[i].length) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Runs the rest of the cycles on the interpreter.
+static inline long aot_interpret(struct chip8_machine *machine, long executed, long cycles) {
+    while(executed < cycles && machine->status == CHIP8_OK) {
+        chip8_step(machine);
+        executed++;
+    }
+    return executed;
+}
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "./chip8_audio.h"
+
+// Bits in the pattern, and the fixed point of phase and steps.
+#define PATTERN_BITS (CHIP8_AUDIO_PATTERN_SIZE * 8)
+#define PHASE_ONE (1ULL << 32)
+
+// Largest ring allowed, about 6 seconds at 44100 Hz.
+#define MAX_DEPTH (1 << 18)
+
+// 2^(1/48): one step of FX3A pitch.
+#define PITCH_STEP 1.0145453349375237
+
+int chip8_audio_init(struct chip8_audio *audio, const struct chip8_audio_options *options) {
+    if(options->sample_rate < CHIP8_FRAME_RATE || options->depth < 1 || options->depth > MAX_DEPTH) {
+        printf("Audio needs a sample rate of at least %d and a depth of 1 - %d samples\n", CHIP8_FRAME_RATE, MAX_DEPTH);
+        return -1;
+    }
+    memset(audio, 0, sizeof(*audio));
+    audio->options = *options;
+    audio->capacity = 1;
+    while(audio->capacity < (uint32_t) options->depth) {
+        audio->capacity <<= 1;
+    }
+    audio->samples = calloc(audio->capacity, sizeof(int16_t));
+    if(audio->samples == NULL) {
+        printf("Error allocating %u audio samples\n", audio->capacity);
+        return -1;
+    }
+
+    // Pitch 64 plays CHIP8_AUDIO_PITCH_RATE pattern bits per second,
+    // every step up or down is a factor of 2^(1/48).
+    double rate = CHIP8_AUDIO_PITCH_RATE;
+    for(int pitch = CHIP8_AUDIO_DEFAULT_PITCH; pitch < 256; pitch++) {
+        audio->steps[pitch] = rate / options->sample_rate * PHASE_ONE;
+        rate *= PITCH_STEP;
+    }
+    rate = CHIP8_AUDIO_PITCH_RATE;
+    for(int pitch = CHIP8_AUDIO_DEFAULT_PITCH - 1; pitch >= 0; pitch--) {
+        rate /= PITCH_STEP;
+        audio->steps[pitch] = rate / options->sample_rate * PHASE_ONE;
+    }
+    return 0;
+}
+
+void chip8_audio_destroy(struct chip8_audio *audio) {
+    free(audio->samples);
+    audio->samples = NULL;
+}
+
+static int16_t next_sample(struct chip8_audio *audio, const struct chip8_machine *machine, uint64_t step) {
+    int bit = (audio->phase >> 32) % PATTERN_BITS;
+    audio->phase = (audio->phase + step) % (PATTERN_BITS * PHASE_ONE);
+    bool on = (machine->audio_pattern[bit / 8] >> (7 - bit % 8)) & 1;
+    return on ? audio->options.volume : -audio->options.volume;
+}
+
+void chip8_audio_frame(struct chip8_audio *audio, const struct chip8_machine *machine) {
+    int total = audio->options.sample_rate + audio->frame_remainder;
+    int count = total / CHIP8_FRAME_RATE;
+    audio->frame_remainder = total % CHIP8_FRAME_RATE;
+
+    uint64_t written = audio->written;
+    uint64_t queued = written - __atomic_load_n(&audio->read, __ATOMIC_ACQUIRE);
+    int room = audio->options.depth - (int) queued;
+    int fit = count <= room ? count : room;
+    if(fit < count) {
+        __atomic_store_n(&audio->overruns, audio->overruns + 1, __ATOMIC_RELAXED);
+    }
+
+    uint32_t mask = audio->capacity - 1;
+    if(machine->sound_timer > 0) {
+        uint64_t step = audio->steps[machine->pitch];
+        for(int i = 0; i < count; i++) {
+            int16_t sample = next_sample(audio, machine, step);
+            if(i < fit) {
+                audio->samples[(written + i) & mask] = sample;
+            }
+        }
+    } else {
+        for(int i = 0; i < fit; i++) {
+            audio->samples[(written + i) & mask] = 0;
+        }
+    }
+    __atomic_store_n(&audio->written, written + fit, __ATOMIC_RELEASE);
+}
+
+void chip8_audio_read(struct chip8_audio *audio, int16_t *out, int count) {
+    uint64_t read = audio->read;
+    uint64_t queued = __atomic_load_n(&audio->written, __ATOMIC_ACQUIRE) - read;
+    int available = queued < (uint64_t) count ? (int) queued : count;
+
+    uint32_t mask = audio->capacity - 1;
+    for(int i = 0; i < available; i++) {
+        out[i] = audio->samples[(read + i) & mask];
+    }
+    __atomic_store_n(&audio->read, read + available, __ATOMIC_RELEASE);
+
+    if(available < count) {
+        memset(out + available, 0, (count - available) * sizeof(int16_t));
+        __atomic_store_n(&audio->underruns, audio->underruns + 1, __ATOMIC_RELAXED);
+    }
+}
+
+long chip8_audio_queued(const struct chip8_audio *audio) {
+    uint64_t read = __atomic_load_n(&audio->read, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&audio->written, __ATOMIC_ACQUIRE) - read;
+}
+
+uint64_t chip8_audio_underruns(const struct chip8_audio *audio) {
+    return __atomic_load_n(&audio->underruns, __ATOMIC_RELAXED);
+}
+
+uint64_t chip8_audio_overruns(const struct chip8_audio *audio) {
+    return __atomic_load_n(&audio->overruns, __ATOMIC_RELAXED);
+}
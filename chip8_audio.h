@@ -0,0 +1,81 @@
+#pragma once
+
+/*
+    Sound.
+    The emulation thread turns the sound timer, pattern and pitch into
+    signed 16 bit mono samples once a frame, and hands them to the audio
+    thread through a single producer, single consumer ring. Neither side
+    ever waits on the other: a frame that does not fit is cut short and
+    counted as an overrun, a read that finds too few samples is padded
+    with silence and counted as an underrun.
+
+    The producer owns `written`, the consumer owns `read`. Each publishes
+    its side with a release store, and loads the other's with acquire.
+    They sit on cache lines of their own so the two threads do not share
+    one for every sample.
+*/
+
+#include <stdint.h>
+
+#include "./chip8.h"
+
+#define CHIP8_AUDIO_SAMPLE_RATE 44100
+// Samples the audio device asks for at a time.
+#define CHIP8_AUDIO_DEVICE_SAMPLES 256
+
+// Keeps the two ends of the ring from sharing a cache line.
+#define CHIP8_AUDIO_CACHE_LINE 64
+
+struct chip8_audio_options {
+    int sample_rate;
+    // Samples queued at most. A frame arrives in one go and is read a
+    // device buffer at a time, so the default holds both, and on average
+    // a sample waits under a frame before it is read.
+    int depth;
+    // A 1 bit in the pattern plays +volume, a 0 bit -volume.
+    int16_t volume;
+};
+
+#define CHIP8_AUDIO_OPTIONS_DEFAULT                                                                             \
+    { CHIP8_AUDIO_SAMPLE_RATE, CHIP8_AUDIO_SAMPLE_RATE / CHIP8_FRAME_RATE + CHIP8_AUDIO_DEVICE_SAMPLES, 4000 }
+
+struct chip8_audio {
+    struct chip8_audio_options options;
+    int16_t *samples;
+    // A power of two, at least depth.
+    uint32_t capacity;
+
+    // Producer side.
+    __attribute__((aligned(CHIP8_AUDIO_CACHE_LINE))) uint64_t written;
+    // Frames that did not fit in the ring.
+    uint64_t overruns;
+    // Position in the 128 sample pattern, in 1/2^32 samples.
+    uint64_t phase;
+    // Left over from sample_rate / CHIP8_FRAME_RATE, in 1/CHIP8_FRAME_RATE samples.
+    int frame_remainder;
+    // Pattern samples per output sample at each pitch, in 1/2^32.
+    uint64_t steps[256];
+
+    // Consumer side.
+    __attribute__((aligned(CHIP8_AUDIO_CACHE_LINE))) uint64_t read;
+    // Reads padded with silence.
+    uint64_t underruns;
+};
+
+// Returns -1 if the options are out of range or the ring can't be allocated.
+int chip8_audio_init(struct chip8_audio *audio, const struct chip8_audio_options *options);
+void chip8_audio_destroy(struct chip8_audio *audio);
+
+// Producer. Call after each chip8_run_frame: queues a frame of what the
+// machine plays, silence when its sound timer is 0. Never blocks.
+void chip8_audio_frame(struct chip8_audio *audio, const struct chip8_machine *machine);
+
+// Consumer, e.g. the audio device callback. Fills `out` with `count`
+// samples, padding with silence if fewer are queued. Never blocks.
+void chip8_audio_read(struct chip8_audio *audio, int16_t *out, int count);
+
+// Samples queued. Safe from either thread.
+long chip8_audio_queued(const struct chip8_audio *audio);
+// Counters, safe to read from any thread.
+uint64_t chip8_audio_underruns(const struct chip8_audio *audio);
+uint64_t chip8_audio_overruns(const struct chip8_audio *audio);
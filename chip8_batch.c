@@ -0,0 +1,195 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./chip8_batch.h"
+#include "./chip8_ops.h"
+
+static float reward_value(const struct chip8_machine *machine, const struct chip8_reward_term *term) {
+    if(term->source == CHIP8_REWARD_REGISTER) {
+        return machine->registers[term->address & 0xF];
+    }
+    return machine->memory[term->address & (MEMORY_SIZE - 1)];
+}
+
+static void write_observation(struct chip8_batch *batch, int env) {
+    const struct chip8_machine *machine = &batch->machines[env];
+    const struct chip8_display *display = &machine->display;
+
+    if(batch->options.observation_format == CHIP8_OBSERVATION_BYTES) {
+        uint8_t *out = (uint8_t *) batch->observations + (size_t) env * CHIP8_HIRES_WIDTH * CHIP8_HIRES_HEIGHT;
+        // Display pixels per observation pixel, in each direction.
+        int shift = display->hires ? 0 : 1;
+        for(int y = 0; y < CHIP8_HIRES_HEIGHT; y++) {
+            const uint64_t *plane0 = display->rows[0][y >> shift];
+            const uint64_t *plane1 = display->rows[1][y >> shift];
+            for(int x = 0; x < CHIP8_HIRES_WIDTH; x++) {
+                int pixel = x >> shift;
+                int bit = 63 - pixel % 64;
+                out[y * CHIP8_HIRES_WIDTH + x] = ((plane0[pixel / 64] >> bit) & 1) | ((plane1[pixel / 64] >> bit) & 1) << 1;
+            }
+        }
+        return;
+    }
+
+    uint64_t *out = (uint64_t *) batch->observations + (size_t) env * CHIP8_OBSERVATION_WORDS;
+    memcpy(out, display->rows, sizeof(display->rows));
+}
+
+// Keeps the env's decode cache and JIT. Memory is put back through
+// write_memory first, so only instructions the episode wrote over are
+// decoded and translated again.
+static void reset_env(struct chip8_batch *batch, int env) {
+    struct chip8_machine *machine = &batch->machines[env];
+    const struct chip8_machine *initial = batch->initial;
+    uint64_t random_state = machine->random_state;
+    // Attached per machine, so they outlive an episode.
+    struct chip8_jit *jit = machine->jit;
+    chip8_aot_function aot = machine->aot;
+    struct chip8_profile *profile = machine->profile;
+    struct chip8_trace *trace = machine->trace;
+
+    // Compared a word at a time, most episodes write to little of memory.
+    for(int address = 0; address < MEMORY_SIZE; address += 8) {
+        uint64_t have, want;
+        memcpy(&have, machine->memory + address, sizeof(have));
+        memcpy(&want, initial->memory + address, sizeof(want));
+        if(have == want) {
+            continue;
+        }
+        for(int i = address; i < address + 8; i++) {
+            write_memory(machine, i, initial->memory[i]);
+        }
+    }
+
+    // The decode cache is the last member.
+    memcpy(machine, initial, offsetof(struct chip8_machine, decode_cache));
+    machine->random_state = random_state;
+    machine->jit = jit;
+    machine->aot = aot;
+    machine->profile = profile;
+    machine->trace = trace;
+}
+
+int chip8_batch_init(struct chip8_batch *batch, int count, const unsigned char *rom, long size,
+                     const struct chip8_batch_options *options) {
+    memset(batch, 0, sizeof(*batch));
+    if(count < 1 || options->reward_term_count < 0 || options->reward_term_count > CHIP8_BATCH_MAX_REWARD_TERMS) {
+        return -1;
+    }
+
+    batch->options = *options;
+    if(options->reward_term_count > 0) {
+        memcpy(batch->reward_terms, options->reward_terms, sizeof(struct chip8_reward_term) * options->reward_term_count);
+    }
+    batch->options.reward_terms = batch->reward_terms;
+
+    batch->initial = malloc(sizeof(struct chip8_machine));
+    batch->machines = malloc(sizeof(struct chip8_machine) * count);
+    if(batch->initial == NULL || batch->machines == NULL) {
+        free(batch->initial);
+        free(batch->machines);
+        batch->initial = NULL;
+        batch->machines = NULL;
+        return -1;
+    }
+
+    chip8_init(batch->initial);
+    batch->initial->engine = options->engine;
+    chip8_set_quirks(batch->initial, options->quirks);
+    if(chip8_load_rom_buffer(batch->initial, rom, size) < 0) {
+        free(batch->initial);
+        free(batch->machines);
+        batch->initial = NULL;
+        batch->machines = NULL;
+        return -1;
+    }
+
+    batch->count = count;
+    for(int env = 0; env < count; env++) {
+        memcpy(&batch->machines[env], batch->initial, sizeof(struct chip8_machine));
+        chip8_seed(&batch->machines[env], options->seed + env);
+    }
+    return 0;
+}
+
+void chip8_batch_destroy(struct chip8_batch *batch) {
+    for(int env = 0; env < batch->count; env++) {
+        chip8_destroy(&batch->machines[env]);
+    }
+    free(batch->machines);
+    free(batch->initial);
+    batch->machines = NULL;
+    batch->initial = NULL;
+    batch->count = 0;
+}
+
+void chip8_batch_set_buffers(struct chip8_batch *batch, float *rewards, uint8_t *dones, void *observations) {
+    batch->rewards = rewards;
+    batch->dones = dones;
+    batch->observations = observations;
+}
+
+void chip8_batch_reset(struct chip8_batch *batch) {
+    for(int env = 0; env < batch->count; env++) {
+        reset_env(batch, env);
+        if(batch->rewards != NULL) {
+            batch->rewards[env] = 0;
+        }
+        if(batch->dones != NULL) {
+            batch->dones[env] = 0;
+        }
+        if(batch->observations != NULL) {
+            write_observation(batch, env);
+        }
+    }
+}
+
+void chip8_batch_step_range(struct chip8_batch *batch, const uint16_t *actions, long frames, int first, int last) {
+    const struct chip8_reward_term *terms = batch->reward_terms;
+    int term_count = batch->options.reward_term_count;
+    float before[CHIP8_BATCH_MAX_REWARD_TERMS];
+
+    if(first < 0) {
+        first = 0;
+    }
+    if(last > batch->count) {
+        last = batch->count;
+    }
+
+    for(int env = first; env < last; env++) {
+        struct chip8_machine *machine = &batch->machines[env];
+
+        // Halted on its last step. Without auto_reset it stays halted and keeps reporting done.
+        if(machine->status != CHIP8_OK && batch->options.auto_reset) {
+            reset_env(batch, env);
+        }
+
+        for(int i = 0; i < term_count; i++) {
+            before[i] = reward_value(machine, &terms[i]);
+        }
+
+        chip8_set_keypad(machine, actions[env]);
+        for(long frame = 0; frame < frames && machine->status == CHIP8_OK; frame++) {
+            chip8_run_frame(machine, batch->options.cycles_per_frame);
+        }
+
+        if(batch->rewards != NULL) {
+            float reward = 0;
+            for(int i = 0; i < term_count; i++) {
+                reward += terms[i].weight * (reward_value(machine, &terms[i]) - before[i]);
+            }
+            batch->rewards[env] = reward;
+        }
+        if(batch->dones != NULL) {
+            batch->dones[env] = machine->status != CHIP8_OK;
+        }
+        if(batch->observations != NULL) {
+            write_observation(batch, env);
+        }
+    }
+}
+
+void chip8_batch_step(struct chip8_batch *batch, const uint16_t *actions, long frames) {
+    chip8_batch_step_range(batch, actions, frames, 0, batch->count);
+}
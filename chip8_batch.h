@@ -0,0 +1,95 @@
+#pragma once
+
+/*
+    Steps many machines on one rom as a batch of environments, for
+    training agents. Each step presses one keypad action per environment,
+    runs whole frames, and writes the rewards, done flags and displays
+    straight into buffers the caller owns. Nothing is allocated after
+    chip8_batch_init.
+*/
+
+#include <stdint.h>
+
+#include "./chip8.h"
+
+// Reward terms read per environment.
+#define CHIP8_BATCH_MAX_REWARD_TERMS 8
+
+enum chip8_reward_source {
+    // A byte of memory, e.g. where the game keeps its score.
+    CHIP8_REWARD_MEMORY = 0,
+    // One of V0 - VF.
+    CHIP8_REWARD_REGISTER,
+};
+
+// The reward of a step is the sum of weight * (value after - value before) over the terms.
+struct chip8_reward_term {
+    enum chip8_reward_source source;
+    // Memory address, or register number.
+    unsigned short address;
+    float weight;
+};
+
+#define CHIP8_OBSERVATION_WORDS (CHIP8_PLANES * CHIP8_HIRES_HEIGHT * CHIP8_ROW_WORDS)
+
+// How a display is written to the observation buffer.
+enum chip8_observation_format {
+    // CHIP8_OBSERVATION_WORDS uint64_t per environment, the layout of chip8_display.rows.
+    CHIP8_OBSERVATION_BITS = 0,
+    // CHIP8_HIRES_WIDTH * CHIP8_HIRES_HEIGHT uint8_t per environment, the pixel's
+    // bit in plane 0 plus 2 for its bit in plane 1. Low resolution pixels are 2x2.
+    CHIP8_OBSERVATION_BYTES,
+};
+
+struct chip8_batch_options {
+    long cycles_per_frame;
+    enum chip8_engine engine;
+    enum chip8_observation_format observation_format;
+    // Starts an environment over at the next step after it reports done.
+    bool auto_reset;
+    const struct chip8_reward_term *reward_terms;
+    int reward_term_count;
+    // Environment i is seeded with seed + i. Resets carry on with the
+    // environment's random numbers instead of repeating them.
+    uint64_t seed;
+    enum chip8_quirks quirks;
+};
+
+#define CHIP8_BATCH_OPTIONS_DEFAULT                                                                             \
+    { CHIP8_CYCLES_PER_FRAME, CHIP8_DEFAULT_ENGINE, CHIP8_OBSERVATION_BITS, true, NULL, 0, 0, CHIP8_DEFAULT_QUIRKS }
+
+struct chip8_batch {
+    int count;
+    struct chip8_batch_options options;
+    struct chip8_reward_term reward_terms[CHIP8_BATCH_MAX_REWARD_TERMS];
+
+    struct chip8_machine *machines;
+    // A machine with the rom loaded that has never run. Resets copy it.
+    struct chip8_machine *initial;
+
+    // Caller owned, one element (or observation) per environment. Any can be NULL.
+    float *rewards;
+    uint8_t *dones;
+    void *observations;
+};
+
+// Starts `count` environments on the rom. Returns -1 on failure.
+int chip8_batch_init(struct chip8_batch *batch, int count, const unsigned char *rom, long size,
+                     const struct chip8_batch_options *options);
+void chip8_batch_destroy(struct chip8_batch *batch);
+
+// Sets where chip8_batch_step writes. Observations are in the batch's observation format.
+void chip8_batch_set_buffers(struct chip8_batch *batch, float *rewards, uint8_t *dones, void *observations);
+
+// Starts every environment over and writes their first observations.
+void chip8_batch_reset(struct chip8_batch *batch);
+
+/*
+    Holds actions[i] (bit k for key k) on environment i for `frames`
+    frames, then writes its reward, done flag and observation.
+    An environment is done when its machine halts.
+*/
+void chip8_batch_step(struct chip8_batch *batch, const uint16_t *actions, long frames);
+
+// Steps environments first to last - 1 only, so callers can split a batch across their own threads.
+void chip8_batch_step_range(struct chip8_batch *batch, const uint16_t *actions, long frames, int first, int last);
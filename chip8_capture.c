@@ -0,0 +1,504 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "./chip8_capture.h"
+
+#define MAX_SCALE 16
+
+// 4 GB, as far as the 32 bit sizes of a RIFF file go.
+#define AVI_LIMIT 0xFFFFFFFFULL
+// Bytes before the first frame: RIFF, the hdrl list and the movi list header.
+#define AVI_HEADER_SIZE 224
+#define AVI_INDEX_ENTRY 16
+
+// Stored deflate blocks hold at most this many bytes.
+#define DEFLATE_BLOCK 65535
+
+int chip8_capture_format_from_path(const char *path) {
+    const char *dot = strrchr(path, '.');
+    if(dot == NULL) {
+        return -1;
+    }
+    if(strcmp(dot, ".y4m") == 0) {
+        return CHIP8_CAPTURE_Y4M;
+    }
+    if(strcmp(dot, ".avi") == 0) {
+        return CHIP8_CAPTURE_AVI;
+    }
+    if(strcmp(dot, ".png") == 0) {
+        return CHIP8_CAPTURE_PNG;
+    }
+    return -1;
+}
+
+static unsigned char *put_le(unsigned char *out, uint32_t value, int bytes) {
+    for(int i = 0; i < bytes; i++) {
+        *out++ = value >> (i * 8);
+    }
+    return out;
+}
+
+static unsigned char *put_be(unsigned char *out, uint32_t value) {
+    for(int i = 3; i >= 0; i--) {
+        *out++ = value >> (i * 8);
+    }
+    return out;
+}
+
+static unsigned char *put_fourcc(unsigned char *out, const char *fourcc) {
+    memcpy(out, fourcc, 4);
+    return out + 4;
+}
+
+/*
+    Y4M: a text header, then per frame "FRAME\n" and the Y, U and V planes
+    at full resolution, BT.601 studio range.
+*/
+
+static int write_y4m_header(struct chip8_capture *capture) {
+    return fprintf(capture->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", capture->width, capture->height,
+                   CHIP8_FRAME_RATE) < 0 ? -1 : 0;
+}
+
+static int write_y4m_frame(struct chip8_capture *capture) {
+    int size = capture->width * capture->height;
+    unsigned char *y = capture->bytes;
+    unsigned char *u = y + size;
+    unsigned char *v = u + size;
+    for(int i = 0; i < size; i++) {
+        int r = capture->pixels[i] & 0xFF;
+        int g = (capture->pixels[i] >> 8) & 0xFF;
+        int b = (capture->pixels[i] >> 16) & 0xFF;
+        y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+    if(fputs("FRAME\n", capture->file) < 0 || fwrite(capture->bytes, 1, size * 3, capture->file) != (size_t) size * 3) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    AVI: RIFF 'AVI ' holding the hdrl list (main header, one video stream
+    of uncompressed 24 bit frames), the movi list of '00db' frame chunks,
+    and the idx1 index. Frame counts and sizes are not known until the
+    end, so the header is written again on close.
+*/
+
+static uint32_t avi_frame_size(const struct chip8_capture *capture) {
+    return capture->width * capture->height * 3;
+}
+
+static int write_avi_header(struct chip8_capture *capture, uint32_t frames, uint32_t movi_size) {
+    unsigned char header[AVI_HEADER_SIZE];
+    unsigned char *out = header;
+    uint32_t frame_size = avi_frame_size(capture);
+    uint32_t riff_size = AVI_HEADER_SIZE - 8 + movi_size + 8 + frames * AVI_INDEX_ENTRY;
+
+    out = put_fourcc(out, "RIFF");
+    out = put_le(out, riff_size, 4);
+    out = put_fourcc(out, "AVI ");
+
+    out = put_fourcc(out, "LIST");
+    out = put_le(out, 192, 4);
+    out = put_fourcc(out, "hdrl");
+    out = put_fourcc(out, "avih");
+    out = put_le(out, 56, 4);
+    out = put_le(out, 1000000 / CHIP8_FRAME_RATE, 4);
+    out = put_le(out, frame_size * CHIP8_FRAME_RATE, 4);
+    out = put_le(out, 0, 4);
+    // AVIF_HASINDEX
+    out = put_le(out, 0x10, 4);
+    out = put_le(out, frames, 4);
+    out = put_le(out, 0, 4);
+    out = put_le(out, 1, 4);
+    out = put_le(out, frame_size, 4);
+    out = put_le(out, capture->width, 4);
+    out = put_le(out, capture->height, 4);
+    memset(out, 0, 16);
+    out += 16;
+
+    out = put_fourcc(out, "LIST");
+    out = put_le(out, 116, 4);
+    out = put_fourcc(out, "strl");
+    out = put_fourcc(out, "strh");
+    out = put_le(out, 56, 4);
+    out = put_fourcc(out, "vids");
+    out = put_fourcc(out, "DIB ");
+    out = put_le(out, 0, 4);
+    out = put_le(out, 0, 4);
+    out = put_le(out, 0, 4);
+    // Scale and rate: frames per second is rate / scale.
+    out = put_le(out, 1, 4);
+    out = put_le(out, CHIP8_FRAME_RATE, 4);
+    out = put_le(out, 0, 4);
+    out = put_le(out, frames, 4);
+    out = put_le(out, frame_size, 4);
+    out = put_le(out, 0xFFFFFFFF, 4);
+    out = put_le(out, 0, 4);
+    out = put_le(out, 0, 2);
+    out = put_le(out, 0, 2);
+    out = put_le(out, capture->width, 2);
+    out = put_le(out, capture->height, 2);
+
+    // BITMAPINFOHEADER, a positive height is bottom-up.
+    out = put_fourcc(out, "strf");
+    out = put_le(out, 40, 4);
+    out = put_le(out, 40, 4);
+    out = put_le(out, capture->width, 4);
+    out = put_le(out, capture->height, 4);
+    out = put_le(out, 1, 2);
+    out = put_le(out, 24, 2);
+    out = put_le(out, 0, 4);
+    out = put_le(out, frame_size, 4);
+    memset(out, 0, 16);
+    out += 16;
+
+    out = put_fourcc(out, "LIST");
+    out = put_le(out, 4 + movi_size, 4);
+    out = put_fourcc(out, "movi");
+
+    if(fseek(capture->file, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), capture->file) != sizeof(header)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int write_avi_frame(struct chip8_capture *capture) {
+    uint32_t frame_size = avi_frame_size(capture);
+    uint64_t movi_size = capture->movi_size + 8 + frame_size;
+    if(AVI_HEADER_SIZE + movi_size + 8 + (capture->written + 1) * AVI_INDEX_ENTRY > AVI_LIMIT) {
+        printf("Capture %s reached the 4 GB AVI limit\n", capture->path);
+        return -1;
+    }
+    if(capture->written == capture->offsets_capacity) {
+        uint64_t capacity = capture->offsets_capacity ? capture->offsets_capacity * 2 : 1024;
+        uint32_t *offsets = realloc(capture->offsets, capacity * sizeof(uint32_t));
+        if(offsets == NULL) {
+            return -1;
+        }
+        capture->offsets = offsets;
+        capture->offsets_capacity = capacity;
+    }
+    // Offsets in the index count from the 'movi' fourcc.
+    capture->offsets[capture->written] = 4 + capture->movi_size;
+
+    unsigned char chunk[8];
+    put_le(put_fourcc(chunk, "00db"), frame_size, 4);
+    // Bottom row first, blue green red.
+    unsigned char *out = capture->bytes;
+    for(int y = capture->height - 1; y >= 0; y--) {
+        const uint32_t *row = capture->pixels + y * capture->width;
+        for(int x = 0; x < capture->width; x++) {
+            *out++ = (row[x] >> 16) & 0xFF;
+            *out++ = (row[x] >> 8) & 0xFF;
+            *out++ = row[x] & 0xFF;
+        }
+    }
+    if(fwrite(chunk, 1, 8, capture->file) != 8 || fwrite(capture->bytes, 1, frame_size, capture->file) != frame_size) {
+        return -1;
+    }
+    capture->movi_size = movi_size;
+    return 0;
+}
+
+static int finish_avi(struct chip8_capture *capture) {
+    uint32_t frame_size = avi_frame_size(capture);
+    unsigned char entry[AVI_INDEX_ENTRY];
+    unsigned char chunk[8];
+    put_le(put_fourcc(chunk, "idx1"), capture->written * AVI_INDEX_ENTRY, 4);
+    if(fwrite(chunk, 1, 8, capture->file) != 8) {
+        return -1;
+    }
+    for(uint64_t i = 0; i < capture->written; i++) {
+        unsigned char *out = put_fourcc(entry, "00db");
+        // AVIIF_KEYFRAME
+        out = put_le(out, 0x10, 4);
+        out = put_le(out, capture->offsets[i], 4);
+        put_le(out, frame_size, 4);
+        if(fwrite(entry, 1, sizeof(entry), capture->file) != sizeof(entry)) {
+            return -1;
+        }
+    }
+    return write_avi_header(capture, capture->written, capture->movi_size);
+}
+
+/*
+    PNG: 8 bit RGB, the image data in stored (uncompressed) deflate
+    blocks, so no zlib is needed. Each row starts with filter type 0.
+*/
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void make_crc_table() {
+    for(uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for(int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc32(const unsigned char *bytes, size_t size) {
+    uint32_t c = 0xFFFFFFFF;
+    for(size_t i = 0; i < size; i++) {
+        c = crc_table[(c ^ bytes[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFF;
+}
+
+static size_t png_raw_size(const struct chip8_capture *capture) {
+    return (size_t) capture->height * (1 + capture->width * 3);
+}
+
+// Bytes of the IDAT data: zlib header, stored blocks, adler32.
+static size_t png_idat_size(const struct chip8_capture *capture) {
+    size_t raw = png_raw_size(capture);
+    return 2 + raw + 5 * ((raw + DEFLATE_BLOCK - 1) / DEFLATE_BLOCK) + 4;
+}
+
+// Writes a chunk of `size` bytes of data, with its type and data at `chunk`.
+static int write_png_chunk(FILE *file, unsigned char *chunk, size_t size) {
+    unsigned char length[4], crc[4];
+    put_be(length, size);
+    put_be(crc, crc32(chunk, 4 + size));
+    if(fwrite(length, 1, 4, file) != 4 || fwrite(chunk, 1, 4 + size, file) != 4 + size || fwrite(crc, 1, 4, file) != 4) {
+        return -1;
+    }
+    return 0;
+}
+
+static int write_png_frame(struct chip8_capture *capture) {
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+    // The raw rows go at the end of the buffer, the IDAT chunk is built
+    // in front of them. It is never ahead of the rows it reads.
+    size_t raw_size = png_raw_size(capture);
+    size_t idat_size = png_idat_size(capture);
+    unsigned char *chunk = capture->bytes;
+    unsigned char *raw = capture->bytes + 4 + idat_size - raw_size;
+    unsigned char *out = raw;
+    for(int y = 0; y < capture->height; y++) {
+        const uint32_t *row = capture->pixels + y * capture->width;
+        *out++ = 0;
+        for(int x = 0; x < capture->width; x++) {
+            *out++ = row[x] & 0xFF;
+            *out++ = (row[x] >> 8) & 0xFF;
+            *out++ = (row[x] >> 16) & 0xFF;
+        }
+    }
+    uint32_t a = 1, b = 0;
+    for(size_t i = 0; i < raw_size; i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+
+    out = put_fourcc(chunk, "IDAT");
+    // Deflate, 32K window, no dictionary, check bits for 0x7801.
+    *out++ = 0x78;
+    *out++ = 0x01;
+    for(size_t done = 0; done < raw_size; done += DEFLATE_BLOCK) {
+        size_t block = raw_size - done < DEFLATE_BLOCK ? raw_size - done : DEFLATE_BLOCK;
+        *out++ = done + block == raw_size;
+        out = put_le(out, block, 2);
+        out = put_le(out, ~block & 0xFFFF, 2);
+        memmove(out, raw + done, block);
+        out += block;
+    }
+    out = put_be(out, b << 16 | a);
+
+    char path[4096 + 16];
+    int stem = strlen(capture->path) - strlen(".png");
+    snprintf(path, sizeof(path), "%.*s-%06llu.png", stem, capture->path, (unsigned long long) capture->written);
+    FILE *file = fopen(path, "wb");
+    if(file == NULL) {
+        printf("Error open %s\n", path);
+        return -1;
+    }
+    unsigned char ihdr[4 + 13];
+    out = put_fourcc(ihdr, "IHDR");
+    out = put_be(out, capture->width);
+    out = put_be(out, capture->height);
+    // 8 bit RGB, deflate, adaptive filtering, not interlaced.
+    memcpy(out, (const unsigned char[]) { 8, 2, 0, 0, 0 }, 5);
+    unsigned char iend[4];
+    put_fourcc(iend, "IEND");
+
+    int status = 0;
+    if(fwrite(signature, 1, 8, file) != 8 || write_png_chunk(file, ihdr, 13) < 0 ||
+       write_png_chunk(file, chunk, idat_size) < 0 || write_png_chunk(file, iend, 0) < 0) {
+        status = -1;
+    }
+    if(fclose(file) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+static int encode_frame(struct chip8_capture *capture, const struct chip8_display *display) {
+    chip8_render_rgba(display, &capture->options.palette, capture->options.scale, capture->pixels,
+                      capture->width * sizeof(uint32_t));
+    int status = 0;
+    switch(capture->format) {
+        case CHIP8_CAPTURE_Y4M: status = write_y4m_frame(capture); break;
+        case CHIP8_CAPTURE_AVI: status = write_avi_frame(capture); break;
+        case CHIP8_CAPTURE_PNG: status = write_png_frame(capture); break;
+    }
+    if(status == 0) {
+        capture->written++;
+    }
+    return status;
+}
+
+static void *encode_frames(void *arg) {
+    struct chip8_capture *capture = arg;
+
+    pthread_mutex_lock(&capture->lock);
+    for(;;) {
+        while(capture->length == 0 && !capture->closing) {
+            pthread_cond_wait(&capture->not_empty, &capture->lock);
+        }
+        if(capture->length == 0) {
+            break;
+        }
+        capture->display = capture->queue[capture->head];
+        capture->head = (capture->head + 1) % capture->options.depth;
+        capture->length--;
+        pthread_cond_signal(&capture->not_full);
+        bool failed = capture->failed;
+        pthread_mutex_unlock(&capture->lock);
+
+        // Encode outside the lock, the machine can queue meanwhile.
+        int status = failed ? 0 : encode_frame(capture, &capture->display);
+
+        pthread_mutex_lock(&capture->lock);
+        if(status < 0 && !capture->failed) {
+            printf("Error writing capture %s\n", capture->path);
+            capture->failed = true;
+            // Wake a machine waiting for room, frames are dropped from now on.
+            pthread_cond_broadcast(&capture->not_full);
+        }
+    }
+    pthread_mutex_unlock(&capture->lock);
+    return NULL;
+}
+
+int chip8_capture_open(struct chip8_capture *capture, const char *path, const struct chip8_capture_options *options) {
+    memset(capture, 0, sizeof(*capture));
+    int format = chip8_capture_format_from_path(path);
+    if(format < 0) {
+        printf("Unknown capture format %s, use .y4m, .avi or .png\n", path);
+        return -1;
+    }
+    if(options->scale < 1 || options->scale > MAX_SCALE || options->depth < 1 || strlen(path) >= sizeof(capture->path)) {
+        printf("Capture needs a scale of 1 - %d and a depth of at least 1\n", MAX_SCALE);
+        return -1;
+    }
+    capture->options = *options;
+    capture->format = format;
+    strcpy(capture->path, path);
+    capture->width = CHIP8_HIRES_WIDTH * options->scale;
+    capture->height = CHIP8_HIRES_HEIGHT * options->scale;
+    pthread_once(&crc_once, make_crc_table);
+
+    if(format != CHIP8_CAPTURE_PNG) {
+        capture->file = fopen(path, "wb");
+        if(capture->file == NULL) {
+            printf("Error open %s\n", path);
+            return -1;
+        }
+    }
+    int status = 0;
+    if(format == CHIP8_CAPTURE_Y4M) {
+        status = write_y4m_header(capture);
+    } else if(format == CHIP8_CAPTURE_AVI) {
+        status = write_avi_header(capture, 0, 0);
+    }
+
+    size_t bytes = (size_t) capture->width * capture->height * 3;
+    if(format == CHIP8_CAPTURE_PNG) {
+        bytes = 4 + png_idat_size(capture);
+    }
+    capture->queue = malloc(options->depth * sizeof(struct chip8_display));
+    capture->pixels = malloc((size_t) capture->width * capture->height * sizeof(uint32_t));
+    capture->bytes = malloc(bytes);
+    if(status < 0 || capture->queue == NULL || capture->pixels == NULL || capture->bytes == NULL) {
+        printf("Error starting capture %s\n", path);
+        goto fail;
+    }
+
+    pthread_mutex_init(&capture->lock, NULL);
+    pthread_cond_init(&capture->not_empty, NULL);
+    pthread_cond_init(&capture->not_full, NULL);
+    if(pthread_create(&capture->thread, NULL, encode_frames, capture) != 0) {
+        printf("Error starting capture thread\n");
+        pthread_mutex_destroy(&capture->lock);
+        pthread_cond_destroy(&capture->not_empty);
+        pthread_cond_destroy(&capture->not_full);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    if(capture->file != NULL) {
+        fclose(capture->file);
+    }
+    free(capture->queue);
+    free(capture->pixels);
+    free(capture->bytes);
+    return -1;
+}
+
+bool chip8_capture_frame(struct chip8_capture *capture, const struct chip8_display *display) {
+    pthread_mutex_lock(&capture->lock);
+    if(capture->options.policy == CHIP8_CAPTURE_BLOCK) {
+        while(capture->length == capture->options.depth && !capture->failed) {
+            pthread_cond_wait(&capture->not_full, &capture->lock);
+        }
+    }
+    if(capture->length == capture->options.depth || capture->failed) {
+        capture->dropped++;
+        pthread_mutex_unlock(&capture->lock);
+        return false;
+    }
+    capture->queue[(capture->head + capture->length) % capture->options.depth] = *display;
+    capture->length++;
+    capture->frames++;
+    pthread_cond_signal(&capture->not_empty);
+    pthread_mutex_unlock(&capture->lock);
+    return true;
+}
+
+int chip8_capture_close(struct chip8_capture *capture) {
+    pthread_mutex_lock(&capture->lock);
+    capture->closing = true;
+    pthread_cond_signal(&capture->not_empty);
+    pthread_mutex_unlock(&capture->lock);
+    pthread_join(capture->thread, NULL);
+
+    int status = capture->failed ? -1 : 0;
+    if(capture->format == CHIP8_CAPTURE_AVI && status == 0 && finish_avi(capture) < 0) {
+        status = -1;
+    }
+    if(capture->file != NULL && fclose(capture->file) != 0) {
+        status = -1;
+    }
+    capture->file = NULL;
+
+    pthread_mutex_destroy(&capture->lock);
+    pthread_cond_destroy(&capture->not_empty);
+    pthread_cond_destroy(&capture->not_full);
+    free(capture->queue);
+    free(capture->pixels);
+    free(capture->bytes);
+    free(capture->offsets);
+    capture->queue = NULL;
+    capture->pixels = NULL;
+    capture->bytes = NULL;
+    capture->offsets = NULL;
+    return status;
+}
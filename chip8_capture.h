@@ -0,0 +1,97 @@
+#pragma once
+
+/*
+    Frame capture.
+    Streams a machine's display to a video file, with no window. The
+    machine's thread only copies the display into a bounded queue once a
+    frame; a thread per capture renders and encodes it behind that. When
+    the queue is full the frame is dropped, or with CHIP8_CAPTURE_BLOCK
+    the machine waits for room, so every frame is kept.
+
+    Formats, all uncompressed so nothing beyond libc is needed:
+    .y4m   YUV4MPEG2, 4:4:4, 60 fps, for ffmpeg and most players.
+    .avi   RIFF AVI of 24 bit bottom-up RGB frames, under 4 GB.
+    .png   a PNG per frame, the path with the frame number before
+           .png, e.g. out.png -> out-000000.png, out-000001.png.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "./chip8.h"
+#include "./chip8_render.h"
+
+enum chip8_capture_format {
+    CHIP8_CAPTURE_Y4M = 0,
+    CHIP8_CAPTURE_AVI,
+    CHIP8_CAPTURE_PNG,
+};
+
+// What to do with a frame when the encoder is behind.
+enum chip8_capture_policy {
+    CHIP8_CAPTURE_DROP = 0,
+    CHIP8_CAPTURE_BLOCK,
+};
+
+struct chip8_capture_options {
+    enum chip8_capture_policy policy;
+    // Output pixels per high resolution pixel, as in chip8_render_rgba.
+    int scale;
+    // Frames queued for the encoder at most.
+    int depth;
+    struct chip8_palette palette;
+};
+
+#define CHIP8_CAPTURE_OPTIONS_DEFAULT { CHIP8_CAPTURE_DROP, 2, 16, CHIP8_PALETTE_DEFAULT }
+
+struct chip8_capture {
+    struct chip8_capture_options options;
+    enum chip8_capture_format format;
+    char path[4096];
+    FILE *file;
+    int width;
+    int height;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    // Ring of depth displays waiting for the encoder.
+    struct chip8_display *queue;
+    int head;
+    int length;
+    bool closing;
+
+    // Under lock.
+    uint64_t frames;
+    uint64_t dropped;
+    // Set by the encoder when a write fails. Later frames are dropped.
+    bool failed;
+
+    // Encoder only.
+    // The frame being encoded, taken off the queue.
+    struct chip8_display display;
+    uint32_t *pixels;
+    // The frame as written: planes, rows or a PNG chunk.
+    unsigned char *bytes;
+    uint64_t written;
+    // AVI: bytes of frame chunks so far, and each frame's offset for the index.
+    uint64_t movi_size;
+    uint32_t *offsets;
+    uint64_t offsets_capacity;
+};
+
+// The format for a path by its extension. Returns -1 if there is none.
+int chip8_capture_format_from_path(const char *path);
+
+// Opens path and starts the encoder. Returns -1 if either fails.
+int chip8_capture_open(struct chip8_capture *capture, const char *path, const struct chip8_capture_options *options);
+
+// Queues a frame. Call once per frame, from the thread running the
+// machine. Returns false if the frame was dropped.
+bool chip8_capture_frame(struct chip8_capture *capture, const struct chip8_display *display);
+
+// Encodes what is queued, finishes the file and stops the encoder.
+// Returns -1 if anything could not be written.
+int chip8_capture_close(struct chip8_capture *capture);
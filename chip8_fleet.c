@@ -0,0 +1,267 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "./chip8_fleet.h"
+
+/*
+    Each worker owns a queue of job indices. It takes from the back of its
+    own queue and puts a machine back there after each slice, so it keeps
+    running the same machine while it is hot in cache. An idle worker
+    steals from the front of another queue, where the oldest jobs are.
+    A worker that finds every queue empty exits rather than waiting: the
+    jobs left are all running, and each only goes back on the queue of
+    the worker running it.
+    Machines are only allocated while a job is running, so memory follows
+    the number of workers, not the number of jobs.
+*/
+
+struct fleet_queue {
+    pthread_mutex_t lock;
+    // Ring of job indices. Only its worker pushes, and only a job it just took,
+    // so the queue never holds more than its initial share (at least one).
+    long *jobs;
+    long capacity;
+    long head;
+    long length;
+};
+
+struct fleet_session {
+    struct chip8_machine *machine;
+    long frame;
+    int next_input;
+};
+
+struct fleet {
+    const struct chip8_fleet_job *jobs;
+    struct chip8_fleet_result *results;
+    struct fleet_session *sessions;
+    long count;
+    struct chip8_fleet_options options;
+
+    int worker_count;
+    struct fleet_queue *queues;
+};
+
+struct fleet_worker {
+    struct fleet *fleet;
+    int index;
+};
+
+static void queue_push(struct fleet_queue *queue, long job) {
+    pthread_mutex_lock(&queue->lock);
+    queue->jobs[(queue->head + queue->length) % queue->capacity] = job;
+    queue->length++;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Takes from the back. Returns -1 if the queue is empty.
+static long queue_pop(struct fleet_queue *queue) {
+    long job = -1;
+    pthread_mutex_lock(&queue->lock);
+    if(queue->length > 0) {
+        queue->length--;
+        job = queue->jobs[(queue->head + queue->length) % queue->capacity];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+// Takes from the front. Returns -1 if the queue is empty.
+static long queue_steal(struct fleet_queue *queue) {
+    long job = -1;
+    pthread_mutex_lock(&queue->lock);
+    if(queue->length > 0) {
+        job = queue->jobs[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->length--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+static long take_job(struct fleet *fleet, int worker) {
+    long job = queue_pop(&fleet->queues[worker]);
+    for(int i = 1; job < 0 && i < fleet->worker_count; i++) {
+        job = queue_steal(&fleet->queues[(worker + i) % fleet->worker_count]);
+    }
+    return job;
+}
+
+// How a machine's status is reported.
+static const enum chip8_fleet_halt machine_halts[] = {
+    [CHIP8_INVALID_OPCODE] = CHIP8_HALT_INVALID_OPCODE,
+    [CHIP8_STACK_OVERFLOW] = CHIP8_HALT_STACK_OVERFLOW,
+    [CHIP8_STACK_UNDERFLOW] = CHIP8_HALT_STACK_UNDERFLOW,
+    [CHIP8_EXITED] = CHIP8_HALT_EXITED,
+};
+
+static void finish_session(struct fleet *fleet, long job, enum chip8_fleet_halt halt) {
+    struct fleet_session *session = &fleet->sessions[job];
+    struct chip8_fleet_result *result = &fleet->results[job];
+
+    result->halt = halt;
+    result->frames = session->frame;
+    if(session->machine != NULL) {
+        result->idle_cycles = session->machine->idle.skipped;
+        result->display_hash = chip8_display_hash(session->machine);
+        chip8_destroy(session->machine);
+        free(session->machine);
+        session->machine = NULL;
+    }
+}
+
+// Runs one slice of a job. Returns true if the job has more frames to run.
+static bool run_slice(struct fleet *fleet, long job) {
+    const struct chip8_fleet_job *spec = &fleet->jobs[job];
+    struct fleet_session *session = &fleet->sessions[job];
+    struct chip8_fleet_result *result = &fleet->results[job];
+
+    if(session->machine == NULL) {
+        session->machine = malloc(sizeof(struct chip8_machine));
+        if(session->machine == NULL) {
+            finish_session(fleet, job, CHIP8_HALT_NO_MEMORY);
+            return false;
+        }
+        chip8_init(session->machine);
+        session->machine->engine = fleet->options.engine;
+        chip8_seed(session->machine, spec->seed);
+        chip8_set_quirks(session->machine, spec->quirks);
+        if(chip8_load_rom_buffer(session->machine, spec->rom, spec->rom_size) < 0) {
+            finish_session(fleet, job, CHIP8_HALT_BAD_ROM);
+            return false;
+        }
+    }
+
+    struct chip8_machine *machine = session->machine;
+    long end = session->frame + fleet->options.slice_frames;
+    if(end > spec->frames) {
+        end = spec->frames;
+    }
+
+    for(; session->frame < end; session->frame++) {
+        while(session->next_input < spec->input_count && spec->inputs[session->next_input].frame <= session->frame) {
+            chip8_set_keypad(machine, spec->inputs[session->next_input].keys);
+            session->next_input++;
+        }
+        result->cycles += chip8_run_frame(machine, fleet->options.cycles_per_frame);
+        if(machine->status != CHIP8_OK) {
+            session->frame++;
+            finish_session(fleet, job, machine_halts[machine->status]);
+            return false;
+        }
+    }
+
+    if(session->frame >= spec->frames) {
+        finish_session(fleet, job, CHIP8_HALT_DONE);
+        return false;
+    }
+    return true;
+}
+
+static void *worker_main(void *argument) {
+    struct fleet_worker *worker = argument;
+    struct fleet *fleet = worker->fleet;
+
+    for(;;) {
+        long job = take_job(fleet, worker->index);
+        if(job < 0) {
+            // The rest is running on other workers.
+            break;
+        }
+        if(run_slice(fleet, job)) {
+            queue_push(&fleet->queues[worker->index], job);
+        }
+    }
+    return NULL;
+}
+
+int chip8_fleet_run(const struct chip8_fleet_job *jobs, struct chip8_fleet_result *results, long count,
+                    const struct chip8_fleet_options *options) {
+    struct fleet fleet;
+    int status = 0;
+
+    memset(results, 0, sizeof(struct chip8_fleet_result) * count);
+    if(count <= 0) {
+        return 0;
+    }
+
+    fleet.jobs = jobs;
+    fleet.results = results;
+    fleet.count = count;
+    fleet.options = *options;
+    if(fleet.options.slice_frames < 1) {
+        fleet.options.slice_frames = 1;
+    }
+
+    fleet.worker_count = options->threads;
+    if(fleet.worker_count <= 0) {
+        fleet.worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if(fleet.worker_count <= 0) {
+        fleet.worker_count = 1;
+    }
+    if(fleet.worker_count > count) {
+        fleet.worker_count = count;
+    }
+
+    fleet.sessions = calloc(count, sizeof(struct fleet_session));
+    fleet.queues = calloc(fleet.worker_count, sizeof(struct fleet_queue));
+    struct fleet_worker *workers = calloc(fleet.worker_count, sizeof(struct fleet_worker));
+    pthread_t *threads = calloc(fleet.worker_count, sizeof(pthread_t));
+    if(fleet.sessions == NULL || fleet.queues == NULL || workers == NULL || threads == NULL) {
+        free(fleet.sessions);
+        free(fleet.queues);
+        free(workers);
+        free(threads);
+        return -1;
+    }
+
+    // Deal the jobs out in contiguous runs, so neighbouring jobs share a worker.
+    for(int i = 0; i < fleet.worker_count; i++) {
+        struct fleet_queue *queue = &fleet.queues[i];
+        pthread_mutex_init(&queue->lock, NULL);
+        long first = count * i / fleet.worker_count;
+        long last = count * (i + 1) / fleet.worker_count;
+        queue->capacity = last - first;
+        queue->jobs = malloc(sizeof(long) * queue->capacity);
+        // Pushed in reverse so the worker pops them in order.
+        for(long job = last - 1; job >= first && queue->jobs != NULL; job--) {
+            queue->jobs[queue->length++] = job;
+        }
+    }
+
+    int started = 0;
+    for(int i = 0; i < fleet.worker_count; i++) {
+        if(fleet.queues[i].jobs == NULL) {
+            status = -1;
+        }
+    }
+    // Workers steal from every queue, so any that start finish all the jobs.
+    for(int i = 0; status == 0 && i < fleet.worker_count; i++) {
+        workers[i].fleet = &fleet;
+        workers[i].index = i;
+        if(pthread_create(&threads[i], NULL, worker_main, &workers[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    if(started == 0) {
+        status = -1;
+    }
+    for(int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for(int i = 0; i < fleet.worker_count; i++) {
+        pthread_mutex_destroy(&fleet.queues[i].lock);
+        free(fleet.queues[i].jobs);
+    }
+    free(fleet.sessions);
+    free(fleet.queues);
+    free(workers);
+    free(threads);
+    return status;
+}
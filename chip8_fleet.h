@@ -0,0 +1,69 @@
+#pragma once
+
+/*
+    Runs many independent machines across all cores.
+    Each job is one session: a rom, a seed and a script of keypad changes,
+    run for a number of frames. Workers advance machines a few frames at a
+    time and steal pending ones from each other when they run dry.
+*/
+
+#include <stdint.h>
+
+#include "./chip8.h"
+
+// Sets the keypad at the start of a frame. Keys stay as set until the next event.
+struct chip8_input_event {
+    long frame;
+    // Bit k for key k.
+    uint16_t keys;
+};
+
+struct chip8_fleet_job {
+    // Not copied. Jobs can share one rom.
+    const unsigned char *rom;
+    long rom_size;
+    // Seeds CXNN, so a job gives the same result every run.
+    uint64_t seed;
+    enum chip8_quirks quirks;
+    // Sorted by frame.
+    const struct chip8_input_event *inputs;
+    int input_count;
+    long frames;
+};
+
+enum chip8_fleet_halt {
+    // Ran all its frames.
+    CHIP8_HALT_DONE = 0,
+    CHIP8_HALT_INVALID_OPCODE,
+    CHIP8_HALT_STACK_OVERFLOW,
+    CHIP8_HALT_STACK_UNDERFLOW,
+    // Ran 00FD.
+    CHIP8_HALT_EXITED,
+    CHIP8_HALT_BAD_ROM,
+    CHIP8_HALT_NO_MEMORY,
+};
+
+struct chip8_fleet_result {
+    enum chip8_fleet_halt halt;
+    long frames;
+    // Instructions executed, including skipped idle ones.
+    long cycles;
+    long idle_cycles;
+    uint64_t display_hash;
+};
+
+struct chip8_fleet_options {
+    // 0 for one per core.
+    int threads;
+    long cycles_per_frame;
+    // Frames a machine runs before going back on its queue.
+    long slice_frames;
+    enum chip8_engine engine;
+};
+
+#define CHIP8_FLEET_OPTIONS_DEFAULT { 0, CHIP8_CYCLES_PER_FRAME, CHIP8_FRAME_RATE, CHIP8_DEFAULT_ENGINE }
+
+// Runs every job and fills results[i] for jobs[i].
+// Returns 0, or -1 if the workers could not be started.
+int chip8_fleet_run(const struct chip8_fleet_job *jobs, struct chip8_fleet_result *results, long count,
+                    const struct chip8_fleet_options *options);
@@ -0,0 +1,527 @@
+// Basic block recompiler for x86-64.
+// On other hosts the JIT engine runs the call engine instead.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "./chip8.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JIT_BUFFER_SIZE (256 * 1024)
+
+// Longest block in instructions.
+#define JIT_MAX_BLOCK 64
+// Blocks dropped this many times for writes to their code are not
+// translated again, the rom keeps rewriting them, so they are interpreted.
+#define JIT_MAX_REWRITES 8
+// Upper bound on the machine code for one instruction with its budget
+// check, prologue and epilogue.
+#define JIT_MAX_INSTRUCTION_BYTES 72
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK * JIT_MAX_INSTRUCTION_BYTES + 48)
+
+// A translated block runs at most `budget` instructions, at least one, and
+// returns how many it executed.
+typedef long (*jit_function)(struct chip8_machine *machine, long budget);
+
+struct jit_block {
+    jit_function code;
+    unsigned char length;
+};
+
+struct chip8_jit {
+    unsigned char *buffer;
+    long used;
+    // Indexed by PC / 2, like the decode cache.
+    struct jit_block blocks[MEMORY_SIZE / 2];
+    // Set for every byte of memory that is part of a translated block.
+    unsigned char code_map[MEMORY_SIZE];
+    // Times the block at PC / 2 was dropped by chip8_jit_invalidate, up to JIT_MAX_REWRITES.
+    unsigned char rewrites[MEMORY_SIZE / 2];
+};
+
+/*
+    Code emission.
+    The machine pointer lives in rbx for the whole block, and all chip-8
+    state is read and written through it. The budget lives in rbp, and
+    before each instruction after the first the block returns early if
+    the budget is spent.
+*/
+
+#define OFFSET_V(x) ((int) (offsetof(struct chip8_machine, registers) + (x)))
+#define OFFSET_PC ((int) offsetof(struct chip8_machine, PC))
+#define OFFSET_I ((int) offsetof(struct chip8_machine, I))
+#define OFFSET_DELAY ((int) offsetof(struct chip8_machine, delay_timer))
+#define OFFSET_SOUND ((int) offsetof(struct chip8_machine, sound_timer))
+
+// ModRM byte for [rbx + disp32] with the given reg field.
+#define RBX_DISP32(reg) (0x83 | ((reg) << 3))
+
+#define REG_AL 0
+#define REG_CL 1
+
+static void emit_byte(unsigned char **p, unsigned char b) {
+    *(*p)++ = b;
+}
+
+static void emit_u16(unsigned char **p, unsigned short v) {
+    memcpy(*p, &v, 2);
+    *p += 2;
+}
+
+static void emit_u32(unsigned char **p, unsigned int v) {
+    memcpy(*p, &v, 4);
+    *p += 4;
+}
+
+static void emit_u64(unsigned char **p, unsigned long long v) {
+    memcpy(*p, &v, 8);
+    *p += 8;
+}
+
+// <op> [rbx + offset], with `reg` as the ModRM reg field.
+static void emit_rbx_op(unsigned char **p, unsigned char op, int reg, int offset) {
+    emit_byte(p, op);
+    emit_byte(p, RBX_DISP32(reg));
+    emit_u32(p, offset);
+}
+
+// mov al, [rbx + offset]
+static void emit_load_al(unsigned char **p, int offset) {
+    emit_rbx_op(p, 0x8A, REG_AL, offset);
+}
+
+// mov [rbx + offset], al / cl
+static void emit_store(unsigned char **p, int reg, int offset) {
+    emit_rbx_op(p, 0x88, reg, offset);
+}
+
+// mov byte [rbx + offset], imm8
+static void emit_store_imm8(unsigned char **p, int offset, unsigned char value) {
+    emit_rbx_op(p, 0xC6, 0, offset);
+    emit_byte(p, value);
+}
+
+// mov word [rbx + offset], imm16
+static void emit_store_imm16(unsigned char **p, int offset, unsigned short value) {
+    emit_byte(p, 0x66);
+    emit_rbx_op(p, 0xC7, 0, offset);
+    emit_u16(p, value);
+}
+
+static void emit_set_pc(unsigned char **p, unsigned short PC) {
+    emit_store_imm16(p, OFFSET_PC, PC);
+}
+
+// push rbx; push rbp; sub rsp, 8; mov rbx, rdi; mov rbp, rsi
+// The stack stays 16 byte aligned for the handlers.
+static void emit_prologue(unsigned char **p) {
+    emit_byte(p, 0x53);
+    emit_byte(p, 0x55);
+    emit_byte(p, 0x48); emit_byte(p, 0x83); emit_byte(p, 0xEC); emit_byte(p, 0x08);
+    emit_byte(p, 0x48); emit_byte(p, 0x89); emit_byte(p, 0xFB);
+    emit_byte(p, 0x48); emit_byte(p, 0x89); emit_byte(p, 0xF5);
+}
+
+// mov eax, executed; add rsp, 8; pop rbp; pop rbx; ret
+static void emit_return(unsigned char **p, int executed) {
+    emit_byte(p, 0xB8); emit_u32(p, executed);
+    emit_byte(p, 0x48); emit_byte(p, 0x83); emit_byte(p, 0xC4); emit_byte(p, 0x08);
+    emit_byte(p, 0x5D);
+    emit_byte(p, 0x5B);
+    emit_byte(p, 0xC3);
+}
+
+// Returns with PC at the instruction if `executed` instructions spend the budget.
+static void emit_budget_check(unsigned char **p, int executed, unsigned short PC) {
+    // cmp rbp, executed; jg over the return
+    emit_byte(p, 0x48); emit_byte(p, 0x83); emit_byte(p, 0xFD); emit_byte(p, executed);
+    emit_byte(p, 0x7F); emit_byte(p, 0);
+    unsigned char *over = *p;
+    emit_set_pc(p, PC);
+    emit_return(p, executed);
+    over[-1] = *p - over;
+}
+
+// Calls the interpreter handler for an instruction.
+// PC must already hold the address after the instruction.
+static void emit_call_handler(unsigned char **p, const struct chip8_decoded *d) {
+    // mov rdi, rbx
+    emit_byte(p, 0x48); emit_byte(p, 0x89); emit_byte(p, 0xDF);
+    // mov rsi, d
+    emit_byte(p, 0x48); emit_byte(p, 0xBE); emit_u64(p, (unsigned long long) d);
+    // mov rax, handler
+    emit_byte(p, 0x48); emit_byte(p, 0xB8); emit_u64(p, (unsigned long long) d->handler);
+    // call rax
+    emit_byte(p, 0xFF); emit_byte(p, 0xD0);
+}
+
+// Skips the next instruction if the flags say so.
+// jcc is the short jump opcode that goes around the skip.
+static void emit_skip_unless(unsigned char **p, unsigned char jcc, unsigned short next) {
+    // The skip is one mov word [rbx + disp32], imm16: 9 bytes.
+    emit_byte(p, jcc);
+    emit_byte(p, 9);
+    emit_set_pc(p, next + 2);
+}
+
+// Stores al in VX and cl in VF, in that order, so VF wins when X is F.
+static void emit_store_result_and_flag(unsigned char **p, unsigned char X) {
+    emit_store(p, REG_AL, OFFSET_V(X));
+    emit_store(p, REG_CL, OFFSET_V(0xF));
+}
+
+static void emit_vf_reset(unsigned char **p, enum chip8_quirks quirks) {
+    if(chip8_quirk_vf_reset(quirks)) {
+        // Reset the flag register
+        emit_store_imm8(p, OFFSET_V(0xF), 0);
+    }
+}
+
+/*
+    Emits one instruction.
+    `next` is the address after the instruction.
+    Returns true if the instruction ends the block, in which case it has
+    left PC where the next block starts.
+*/
+static bool emit_instruction(unsigned char **p, const struct chip8_decoded *d, unsigned short next,
+                             enum chip8_quirks quirks) {
+    switch(d->op) {
+        case CHIP8_OP_NOP:
+            return false;
+        case CHIP8_OP_6XNN:
+            emit_store_imm8(p, OFFSET_V(d->X), d->NN);
+            return false;
+        case CHIP8_OP_7XNN:
+            // add byte [rbx + VX], imm8
+            emit_rbx_op(p, 0x80, 0, OFFSET_V(d->X));
+            emit_byte(p, d->NN);
+            return false;
+        case CHIP8_OP_8XY0:
+            emit_load_al(p, OFFSET_V(d->Y));
+            emit_store(p, REG_AL, OFFSET_V(d->X));
+            return false;
+        case CHIP8_OP_8XY1:
+            // or [rbx + VX], al
+            emit_load_al(p, OFFSET_V(d->Y));
+            emit_rbx_op(p, 0x08, REG_AL, OFFSET_V(d->X));
+            emit_vf_reset(p, quirks);
+            return false;
+        case CHIP8_OP_8XY2:
+            // and [rbx + VX], al
+            emit_load_al(p, OFFSET_V(d->Y));
+            emit_rbx_op(p, 0x20, REG_AL, OFFSET_V(d->X));
+            emit_vf_reset(p, quirks);
+            return false;
+        case CHIP8_OP_8XY3:
+            // xor [rbx + VX], al
+            emit_load_al(p, OFFSET_V(d->Y));
+            emit_rbx_op(p, 0x30, REG_AL, OFFSET_V(d->X));
+            emit_vf_reset(p, quirks);
+            return false;
+        case CHIP8_OP_8XY4:
+            // add al, [rbx + VY]; setc cl
+            emit_load_al(p, OFFSET_V(d->X));
+            emit_rbx_op(p, 0x02, REG_AL, OFFSET_V(d->Y));
+            emit_byte(p, 0x0F); emit_byte(p, 0x92); emit_byte(p, 0xC1);
+            emit_store_result_and_flag(p, d->X);
+            return false;
+        case CHIP8_OP_8XY5:
+            // sub al, [rbx + VY]; setnc cl
+            emit_load_al(p, OFFSET_V(d->X));
+            emit_rbx_op(p, 0x2A, REG_AL, OFFSET_V(d->Y));
+            emit_byte(p, 0x0F); emit_byte(p, 0x93); emit_byte(p, 0xC1);
+            emit_store_result_and_flag(p, d->X);
+            return false;
+        case CHIP8_OP_8XY7:
+            // sub al, [rbx + VX]; setnc cl
+            emit_load_al(p, OFFSET_V(d->Y));
+            emit_rbx_op(p, 0x2A, REG_AL, OFFSET_V(d->X));
+            emit_byte(p, 0x0F); emit_byte(p, 0x93); emit_byte(p, 0xC1);
+            emit_store_result_and_flag(p, d->X);
+            return false;
+        case CHIP8_OP_8XY6:
+            emit_load_al(p, OFFSET_V(chip8_quirk_shift_vy(quirks) ? d->Y : d->X));
+            // mov cl, al; shr al, 1; and cl, 1
+            emit_byte(p, 0x88); emit_byte(p, 0xC1);
+            emit_byte(p, 0xD0); emit_byte(p, 0xE8);
+            emit_byte(p, 0x80); emit_byte(p, 0xE1); emit_byte(p, 0x01);
+            emit_store_result_and_flag(p, d->X);
+            return false;
+        case CHIP8_OP_8XYE:
+            emit_load_al(p, OFFSET_V(chip8_quirk_shift_vy(quirks) ? d->Y : d->X));
+            // mov cl, al; shl al, 1; shr cl, 7
+            emit_byte(p, 0x88); emit_byte(p, 0xC1);
+            emit_byte(p, 0xD0); emit_byte(p, 0xE0);
+            emit_byte(p, 0xC0); emit_byte(p, 0xE9); emit_byte(p, 0x07);
+            emit_store_result_and_flag(p, d->X);
+            return false;
+        case CHIP8_OP_ANNN:
+            emit_store_imm16(p, OFFSET_I, d->NNN);
+            return false;
+        case CHIP8_OP_FX07:
+            emit_load_al(p, OFFSET_DELAY);
+            emit_store(p, REG_AL, OFFSET_V(d->X));
+            return false;
+        case CHIP8_OP_FX15:
+            emit_load_al(p, OFFSET_V(d->X));
+            emit_store(p, REG_AL, OFFSET_DELAY);
+            return false;
+        case CHIP8_OP_FX18:
+            emit_load_al(p, OFFSET_V(d->X));
+            emit_store(p, REG_AL, OFFSET_SOUND);
+            return false;
+        case CHIP8_OP_FX1E:
+            // movzx eax, byte [rbx + VX]; add word [rbx + I], ax
+            emit_byte(p, 0x0F); emit_rbx_op(p, 0xB6, REG_AL, OFFSET_V(d->X));
+            emit_byte(p, 0x66); emit_rbx_op(p, 0x01, REG_AL, OFFSET_I);
+            return false;
+        case CHIP8_OP_FX29:
+            // movzx eax, byte [rbx + VX]; lea eax, [rax + rax * 4 + FONT_START]; mov [rbx + I], ax
+            emit_byte(p, 0x0F); emit_rbx_op(p, 0xB6, REG_AL, OFFSET_V(d->X));
+            emit_byte(p, 0x8D); emit_byte(p, 0x44); emit_byte(p, 0x80); emit_byte(p, FONT_START);
+            emit_byte(p, 0x66); emit_rbx_op(p, 0x89, REG_AL, OFFSET_I);
+            return false;
+
+        case CHIP8_OP_1NNN:
+            emit_set_pc(p, d->NNN);
+            return true;
+        case CHIP8_OP_3XNN:
+            // cmp byte [rbx + VX], imm8
+            emit_set_pc(p, next);
+            emit_rbx_op(p, 0x80, 7, OFFSET_V(d->X));
+            emit_byte(p, d->NN);
+            emit_skip_unless(p, 0x75, next);
+            return true;
+        case CHIP8_OP_4XNN:
+            emit_set_pc(p, next);
+            emit_rbx_op(p, 0x80, 7, OFFSET_V(d->X));
+            emit_byte(p, d->NN);
+            emit_skip_unless(p, 0x74, next);
+            return true;
+        case CHIP8_OP_5XY0:
+            // cmp al, [rbx + VY]
+            emit_set_pc(p, next);
+            emit_load_al(p, OFFSET_V(d->X));
+            emit_rbx_op(p, 0x3A, REG_AL, OFFSET_V(d->Y));
+            emit_skip_unless(p, 0x75, next);
+            return true;
+        case CHIP8_OP_9XY0:
+            emit_set_pc(p, next);
+            emit_load_al(p, OFFSET_V(d->X));
+            emit_rbx_op(p, 0x3A, REG_AL, OFFSET_V(d->Y));
+            emit_skip_unless(p, 0x74, next);
+            return true;
+
+        // Everything below runs the interpreter handler.
+        case CHIP8_OP_00E0:
+        case CHIP8_OP_00CN:
+        case CHIP8_OP_00DN:
+        case CHIP8_OP_00FB:
+        case CHIP8_OP_00FC:
+        case CHIP8_OP_00FE:
+        case CHIP8_OP_00FF:
+        case CHIP8_OP_CXNN:
+        case CHIP8_OP_5XY3:
+        case CHIP8_OP_FN01:
+        case CHIP8_OP_F002:
+        case CHIP8_OP_FX30:
+        case CHIP8_OP_FX3A:
+        case CHIP8_OP_FX65:
+        case CHIP8_OP_FX75:
+        case CHIP8_OP_FX85:
+            emit_set_pc(p, next);
+            emit_call_handler(p, d);
+            return false;
+        default:
+            // Flow control, key waits, drawing, writes to memory, exits and
+            // invalid instructions end the block after the handler.
+            emit_set_pc(p, next);
+            emit_call_handler(p, d);
+            return true;
+    }
+}
+
+static struct chip8_jit *jit_create() {
+    struct chip8_jit *jit = calloc(1, sizeof(struct chip8_jit));
+    if(jit == NULL) {
+        return NULL;
+    }
+
+    // Never writable and executable at once: jit_compile makes the buffer
+    // writable while it emits a block, then executable again.
+    jit->buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(jit->buffer == MAP_FAILED) {
+        printf("Could not map memory for the jit\n");
+        free(jit);
+        return NULL;
+    }
+    return jit;
+}
+
+// Translates the block starting at the even address PC.
+// Returns NULL if the buffer cannot be made writable or executable.
+static struct jit_block *jit_compile(struct chip8_machine *machine, unsigned short PC) {
+    struct chip8_jit *jit = machine->jit;
+
+    if(JIT_BUFFER_SIZE - jit->used < JIT_MAX_BLOCK_BYTES) {
+        chip8_jit_flush(machine);
+    }
+    // Only the pages the block can reach change protection.
+    long page = sysconf(_SC_PAGESIZE);
+    long first = jit->used & ~(page - 1);
+    long last = (jit->used + JIT_MAX_BLOCK_BYTES + page - 1) & ~(page - 1);
+    unsigned char *pages = jit->buffer + first;
+    size_t pages_size = (last < JIT_BUFFER_SIZE ? last : JIT_BUFFER_SIZE) - first;
+    if(mprotect(pages, pages_size, PROT_READ | PROT_WRITE) != 0) {
+        printf("Could not make the jit buffer writable\n");
+        return NULL;
+    }
+
+    unsigned char *start = jit->buffer + jit->used;
+    unsigned char *p = start;
+    unsigned short address = PC;
+    int length = 0;
+    bool ended = false;
+
+    emit_prologue(&p);
+
+    while(!ended && length < JIT_MAX_BLOCK && address < MEMORY_SIZE) {
+        // The handlers called from the block read their operands from here.
+        struct chip8_decoded *d = &machine->decode_cache[address >> 1];
+        if(d->handler == NULL) {
+            chip8_decode((machine->memory[address] << 8) | machine->memory[address + 1], machine->quirks, d);
+        }
+
+        if(length > 0) {
+            emit_budget_check(&p, length, address);
+        }
+        ended = emit_instruction(&p, d, address + 2, machine->quirks);
+        jit->code_map[address] = 1;
+        jit->code_map[address + 1] = 1;
+        address += 2;
+        length++;
+    }
+
+    if(!ended) {
+        emit_set_pc(&p, address);
+    }
+
+    emit_return(&p, length);
+
+    jit->used += p - start;
+    if(mprotect(pages, pages_size, PROT_READ | PROT_EXEC) != 0) {
+        printf("Could not make the jit buffer executable\n");
+        return NULL;
+    }
+
+    struct jit_block *block = &jit->blocks[PC >> 1];
+    block->code = (jit_function) start;
+    block->length = length;
+    return block;
+}
+
+// Runs up to `cycles` instructions, a whole block at a time.
+// Blocks stop early when the cycles left run out, so the count is exact.
+long chip8_run_jit(struct chip8_machine *machine, long cycles) {
+    long executed = 0;
+
+    if(machine->jit == NULL && (machine->jit = jit_create()) == NULL) {
+        machine->engine = CHIP8_ENGINE_CALL;
+        return chip8_run_cycles(machine, cycles);
+    }
+
+    while(executed < cycles && machine->status == CHIP8_OK) {
+        unsigned short PC = machine->PC & (MEMORY_SIZE - 1);
+        if(PC & 1) {
+            chip8_step(machine);
+            executed++;
+            continue;
+        }
+
+        struct jit_block *block = &machine->jit->blocks[PC >> 1];
+        if(block->code == NULL && machine->jit->rewrites[PC >> 1] == JIT_MAX_REWRITES) {
+            chip8_step(machine);
+            executed++;
+            continue;
+        }
+        if(block->code == NULL && (block = jit_compile(machine, PC)) == NULL) {
+            machine->engine = CHIP8_ENGINE_CALL;
+            return executed + chip8_run_cycles(machine, cycles - executed);
+        }
+
+        machine->PC = PC;
+        executed += block->code(machine, cycles - executed);
+    }
+    return executed;
+}
+
+// Throws away every translated block. The code of a block that is running
+// stays in place until the next block is compiled.
+void chip8_jit_flush(struct chip8_machine *machine) {
+    struct chip8_jit *jit = machine->jit;
+    if(jit == NULL) {
+        return;
+    }
+    jit->used = 0;
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->code_map, 0, sizeof(jit->code_map));
+    memset(jit->rewrites, 0, sizeof(jit->rewrites));
+}
+
+// Drops the blocks that cover a written address.
+// Their code stays in the buffer until the next flush.
+void chip8_jit_invalidate(struct chip8_machine *machine, unsigned short address) {
+    struct chip8_jit *jit = machine->jit;
+    address &= MEMORY_SIZE - 1;
+    if(!jit->code_map[address]) {
+        return;
+    }
+
+    // Only blocks starting up to JIT_MAX_BLOCK instructions back can reach the address.
+    int first = address - 2 * (JIT_MAX_BLOCK - 1);
+    if(first < 0) {
+        first = 0;
+    }
+    for(int start = first & ~1; start <= address; start += 2) {
+        struct jit_block *block = &jit->blocks[start >> 1];
+        if(block->code != NULL && start + 2 * block->length > address) {
+            block->code = NULL;
+            if(jit->rewrites[start >> 1] < JIT_MAX_REWRITES) {
+                jit->rewrites[start >> 1]++;
+            }
+        }
+    }
+}
+
+void chip8_jit_free(struct chip8_machine *machine) {
+    if(machine->jit == NULL) {
+        return;
+    }
+    munmap(machine->jit->buffer, JIT_BUFFER_SIZE);
+    free(machine->jit);
+    machine->jit = NULL;
+}
+
+#else
+
+long chip8_run_jit(struct chip8_machine *machine, long cycles) {
+    machine->engine = CHIP8_ENGINE_CALL;
+    return chip8_run_cycles(machine, cycles);
+}
+
+void chip8_jit_invalidate(struct chip8_machine *machine, unsigned short address) {
+}
+
+void chip8_jit_flush(struct chip8_machine *machine) {
+}
+
+void chip8_jit_free(struct chip8_machine *machine) {
+}
+
+#endif
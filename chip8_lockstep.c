@@ -0,0 +1,586 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./chip8_lockstep.h"
+#include "./chip8_ops.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define LANES CHIP8_LOCKSTEP_MAX_LANES
+
+// Copies a lane's registers between the lane arrays and its machine.
+static void gather_lane(struct chip8_lockstep *lockstep, int lane) {
+    struct chip8_machine *machine = &lockstep->machines[lane];
+    for(int x = 0; x < 16; x++) {
+        lockstep->V[x][lane] = machine->registers[x];
+    }
+    lockstep->PC[lane] = machine->PC;
+    lockstep->I[lane] = machine->I;
+    lockstep->delay_timer[lane] = machine->delay_timer;
+    lockstep->sound_timer[lane] = machine->sound_timer;
+}
+
+static void scatter_lane(struct chip8_lockstep *lockstep, int lane) {
+    struct chip8_machine *machine = &lockstep->machines[lane];
+    for(int x = 0; x < 16; x++) {
+        machine->registers[x] = lockstep->V[x][lane];
+    }
+    machine->PC = lockstep->PC[lane];
+    machine->I = lockstep->I[lane];
+    machine->delay_timer = lockstep->delay_timer[lane];
+    machine->sound_timer = lockstep->sound_timer[lane];
+}
+
+#if defined(__GNUC__)
+
+// Runs an instruction on one lane's machine, with the interpreter's semantics.
+// PC has already been moved past it.
+static void run_scalar(struct chip8_lockstep *lockstep, int lane, const struct chip8_decoded *d) {
+    scatter_lane(lockstep, lane);
+    d->handler(&lockstep->machines[lane], d);
+    gather_lane(lockstep, lane);
+}
+
+/*
+    The lane arrays as GCC vectors, one element per lane. The same code is
+    compiled once per instruction set below, and GCC splits the vectors
+    into as many registers as the target needs.
+*/
+
+typedef uint8_t u8v __attribute__((vector_size(LANES)));
+typedef int8_t s8v __attribute__((vector_size(LANES)));
+typedef uint16_t u16v __attribute__((vector_size(LANES * 2)));
+typedef int16_t s16v __attribute__((vector_size(LANES * 2)));
+
+// Always inlined, so vectors are never passed by value between differently compiled functions.
+#define VECTOR static inline __attribute__((always_inline))
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+// The lane arrays are not necessarily aligned.
+VECTOR u8v load8(const uint8_t *lanes) {
+    u8v v;
+    memcpy(&v, lanes, sizeof(v));
+    return v;
+}
+
+VECTOR void store8(uint8_t *lanes, u8v v) {
+    memcpy(lanes, &v, sizeof(v));
+}
+
+VECTOR u16v load16(const uint16_t *lanes) {
+    u16v v;
+    memcpy(&v, lanes, sizeof(v));
+    return v;
+}
+
+VECTOR void store16(uint16_t *lanes, u16v v) {
+    memcpy(lanes, &v, sizeof(v));
+}
+
+// Writes `value` to the lanes in `mask`, keeps the others.
+VECTOR void blend8(uint8_t *lanes, u8v value, u8v mask) {
+    store8(lanes, (value & mask) | (load8(lanes) & ~mask));
+}
+
+VECTOR void blend16(uint16_t *lanes, u16v value, u16v mask) {
+    store16(lanes, (value & mask) | (load16(lanes) & ~mask));
+}
+
+VECTOR u16v widen(u8v v) {
+    return __builtin_convertvector(v, u16v);
+}
+
+// Bit i of a byte spread to byte i of a word, built at compile time so
+// lockstep instances on several threads share it without setup.
+#define SPREAD_BIT(byte, bit) (((byte) >> (bit)) & 1 ? 0xFFULL << ((bit) * 8) : 0)
+#define SPREAD(byte)                                                                                           \
+    (SPREAD_BIT(byte, 0) | SPREAD_BIT(byte, 1) | SPREAD_BIT(byte, 2) | SPREAD_BIT(byte, 3) |                   \
+     SPREAD_BIT(byte, 4) | SPREAD_BIT(byte, 5) | SPREAD_BIT(byte, 6) | SPREAD_BIT(byte, 7))
+#define SPREAD4(byte) SPREAD(byte), SPREAD((byte) + 1), SPREAD((byte) + 2), SPREAD((byte) + 3)
+#define SPREAD16(byte) SPREAD4(byte), SPREAD4((byte) + 4), SPREAD4((byte) + 8), SPREAD4((byte) + 12)
+#define SPREAD64(byte) SPREAD16(byte), SPREAD16((byte) + 16), SPREAD16((byte) + 32), SPREAD16((byte) + 48)
+
+static const uint64_t spread[256] = { SPREAD64(0), SPREAD64(64), SPREAD64(128), SPREAD64(192) };
+
+// 0xFF for every lane whose bit is set.
+VECTOR u8v lane_mask8(uint32_t lanes) {
+    uint64_t words[4] = { spread[lanes & 0xFF], spread[(lanes >> 8) & 0xFF],
+                          spread[(lanes >> 16) & 0xFF], spread[lanes >> 24] };
+    u8v mask;
+    memcpy(&mask, words, sizeof(mask));
+    return mask;
+}
+
+VECTOR u16v lane_mask16(u8v mask) {
+    return (u16v) __builtin_convertvector((s8v) mask, s16v);
+}
+
+// One bit per lane whose byte in the mask is set.
+VECTOR uint32_t lane_bits(u8v mask) {
+#if defined(__SSE2__)
+    __m128i low, high;
+    memcpy(&low, &mask, sizeof(low));
+    memcpy(&high, (unsigned char *) &mask + sizeof(low), sizeof(high));
+    return (uint32_t) _mm_movemask_epi8(low) | (uint32_t) _mm_movemask_epi8(high) << 16;
+#else
+    uint32_t bits = 0;
+    for(int lane = 0; lane < LANES; lane++) {
+        bits |= (uint32_t) (mask[lane] >> 7) << lane;
+    }
+    return bits;
+#endif
+}
+
+typedef uint16_t u16x16 __attribute__((vector_size(32)));
+typedef uint16_t u16x8 __attribute__((vector_size(16)));
+typedef uint16_t u16x4 __attribute__((vector_size(8)));
+
+// Takes the smaller of each pair of elements from the two halves of a vector.
+#define MIN_HALVES(half_type, v) ({                                   \
+    half_type low_, high_;                                            \
+    memcpy(&low_, &(v), sizeof(low_));                                \
+    memcpy(&high_, (unsigned char *) &(v) + sizeof(low_), sizeof(high_)); \
+    high_ ^ ((low_ ^ high_) & (half_type) (low_ < high_));            \
+})
+
+// The smallest element.
+VECTOR unsigned short reduce_min16(u16v v) {
+    u16x16 v16 = MIN_HALVES(u16x16, v);
+    u16x8 v8 = MIN_HALVES(u16x8, v16);
+    u16x4 v4 = MIN_HALVES(u16x4, v8);
+    unsigned short smallest = v4[0];
+    for(int i = 1; i < 4; i++) {
+        if(v4[i] < smallest) {
+            smallest = v4[i];
+        }
+    }
+    return smallest;
+}
+
+/*
+    Picks the instruction to issue next and returns the bit mask of the
+    lanes that run it. The lane furthest behind in memory leads, so lanes
+    that took a forward branch wait for the others to catch up.
+    known_PC is the PC of every active lane when that is known, or -1.
+*/
+VECTOR uint32_t pick_lanes(struct chip8_lockstep *lockstep, uint32_t active, int known_PC, unsigned short *PC,
+                           struct chip8_decoded *uncached, const struct chip8_decoded **decoded) {
+    unsigned short address;
+    uint32_t lanes;
+
+    if(known_PC >= 0) {
+        address = known_PC & (MEMORY_SIZE - 1);
+        lanes = active;
+    } else {
+        u8v active_mask = lane_mask8(active);
+        u16v lane_PC = load16(lockstep->PC) & (MEMORY_SIZE - 1);
+        address = reduce_min16(lane_PC | ~lane_mask16(active_mask));
+        lanes = lane_bits((u8v) __builtin_convertvector((s16v) (lane_PC == address), s8v) & active_mask);
+    }
+
+    struct chip8_machine *machine = &lockstep->machines[__builtin_ctz(lanes)];
+    unsigned char high = read_memory(machine, address);
+    unsigned char low = read_memory(machine, address + 1);
+
+    // Lanes can have written different code at the same address.
+    if(lockstep->written[address] || lockstep->written[(address + 1) & (MEMORY_SIZE - 1)]) {
+        for(uint32_t bits = lanes; bits != 0; bits &= bits - 1) {
+            int lane = __builtin_ctz(bits);
+            struct chip8_machine *other = &lockstep->machines[lane];
+            if(read_memory(other, address) != high || read_memory(other, address + 1) != low) {
+                lanes &= ~(1u << lane);
+            }
+        }
+    }
+
+    if(address & 1) {
+        chip8_decode((high << 8) | low, lockstep->quirks, uncached);
+        *decoded = uncached;
+    } else {
+        struct chip8_decoded *d = &machine->decode_cache[address >> 1];
+        if(d->handler == NULL) {
+            chip8_decode((high << 8) | low, lockstep->quirks, d);
+        }
+        *decoded = d;
+    }
+    *PC = address;
+    return lanes;
+}
+
+// Returned by run_vector for instructions without a vector form.
+#define NOT_VECTOR -2
+
+/*
+    Runs the instruction on every lane in the mask, if it has a vector form.
+    PC has already been moved past it. Returns where all those lanes
+    continue if they stay together, -1 if they split up, or NOT_VECTOR.
+*/
+VECTOR int run_vector(struct chip8_lockstep *lockstep, const struct chip8_decoded *d,
+                      unsigned short PC, uint32_t lanes, u8v m8, u16v m16, enum chip8_quirks quirks) {
+    uint8_t *VX = lockstep->V[d->X];
+    uint8_t *VF = lockstep->V[0xF];
+    u8v vx = load8(VX);
+    u8v vy = load8(lockstep->V[d->Y]);
+    u8v skip;
+
+    switch(d->op) {
+        case CHIP8_OP_NOP:
+            return PC + 2;
+        case CHIP8_OP_1NNN:
+            blend16(lockstep->PC, (u16v) {} + d->NNN, m16);
+            return d->NNN;
+        case CHIP8_OP_3XNN:
+            skip = (u8v) (vx == d->NN);
+            break;
+        case CHIP8_OP_4XNN:
+            skip = (u8v) (vx != d->NN);
+            break;
+        case CHIP8_OP_5XY0:
+            skip = (u8v) (vx == vy);
+            break;
+        case CHIP8_OP_9XY0:
+            skip = (u8v) (vx != vy);
+            break;
+        case CHIP8_OP_6XNN:
+            blend8(VX, (u8v) {} + d->NN, m8);
+            return PC + 2;
+        case CHIP8_OP_7XNN:
+            blend8(VX, vx + d->NN, m8);
+            return PC + 2;
+        case CHIP8_OP_8XY0:
+            blend8(VX, vy, m8);
+            return PC + 2;
+        case CHIP8_OP_8XY1:
+        case CHIP8_OP_8XY2:
+        case CHIP8_OP_8XY3:
+            blend8(VX, d->op == CHIP8_OP_8XY1 ? vx | vy : d->op == CHIP8_OP_8XY2 ? vx & vy : vx ^ vy, m8);
+            if(chip8_quirk_vf_reset(quirks)) {
+                blend8(VF, (u8v) {}, m8);
+            }
+            return PC + 2;
+        // VX is written before VF, so VF wins when X is F.
+        case CHIP8_OP_8XY4:
+            blend8(VX, vx + vy, m8);
+            blend8(VF, (u8v) (vx + vy < vx) & 1, m8);
+            return PC + 2;
+        case CHIP8_OP_8XY5:
+            blend8(VX, vx - vy, m8);
+            blend8(VF, (u8v) (vx >= vy) & 1, m8);
+            return PC + 2;
+        case CHIP8_OP_8XY6:
+            if(chip8_quirk_shift_vy(quirks)) {
+                vx = vy;
+            }
+            blend8(VX, vx >> 1, m8);
+            blend8(VF, vx & 1, m8);
+            return PC + 2;
+        case CHIP8_OP_8XY7:
+            blend8(VX, vy - vx, m8);
+            blend8(VF, (u8v) (vy >= vx) & 1, m8);
+            return PC + 2;
+        case CHIP8_OP_8XYE:
+            if(chip8_quirk_shift_vy(quirks)) {
+                vx = vy;
+            }
+            blend8(VX, vx << 1, m8);
+            blend8(VF, vx >> 7, m8);
+            return PC + 2;
+        case CHIP8_OP_ANNN:
+            blend16(lockstep->I, (u16v) {} + d->NNN, m16);
+            return PC + 2;
+        case CHIP8_OP_FX07:
+            blend8(VX, load8(lockstep->delay_timer), m8);
+            return PC + 2;
+        case CHIP8_OP_FX15:
+            blend8(lockstep->delay_timer, vx, m8);
+            return PC + 2;
+        case CHIP8_OP_FX18:
+            blend8(lockstep->sound_timer, vx, m8);
+            return PC + 2;
+        case CHIP8_OP_FX1E:
+            store16(lockstep->I, load16(lockstep->I) + (widen(vx) & m16));
+            return PC + 2;
+        case CHIP8_OP_FX29:
+            blend16(lockstep->I, FONT_START + 5 * widen(vx), m16);
+            return PC + 2;
+        default:
+            return NOT_VECTOR;
+    }
+
+    // Skips
+    skip &= m8;
+    blend16(lockstep->PC, (u16v) {} + (unsigned short) (PC + 4), lane_mask16(skip));
+    uint32_t skipped = lane_bits(skip);
+    if(skipped == 0) {
+        return PC + 2;
+    }
+    return skipped == lanes ? PC + 4 : -1;
+}
+
+// Where lanes continue after running an instruction without a vector form, or -1 if they can split up.
+static int scalar_next_PC(const struct chip8_decoded *d, unsigned short PC) {
+    switch(d->op) {
+        case CHIP8_OP_2NNN:
+            return d->NNN;
+        case CHIP8_OP_00E0:
+        case CHIP8_OP_00CN:
+        case CHIP8_OP_00DN:
+        case CHIP8_OP_00FB:
+        case CHIP8_OP_00FC:
+        case CHIP8_OP_00FE:
+        case CHIP8_OP_00FF:
+        case CHIP8_OP_CXNN:
+        case CHIP8_OP_DXYN:
+        case CHIP8_OP_5XY2:
+        case CHIP8_OP_5XY3:
+        case CHIP8_OP_FN01:
+        case CHIP8_OP_F002:
+        case CHIP8_OP_FX30:
+        case CHIP8_OP_FX33:
+        case CHIP8_OP_FX3A:
+        case CHIP8_OP_FX55:
+        case CHIP8_OP_FX65:
+        case CHIP8_OP_FX75:
+        case CHIP8_OP_FX85:
+            return PC + 2;
+        default:
+            // Stacks, V0 and keys can differ between lanes.
+            return -1;
+    }
+}
+
+// The issue count at which the next of the active lanes has run all its cycles.
+static long next_finish(uint32_t active, const long *waited, long cycles) {
+    long finish = -1;
+    for(uint32_t bits = active; bits != 0; bits &= bits - 1) {
+        long lane_finish = cycles + waited[__builtin_ctz(bits)];
+        if(finish < 0 || lane_finish < finish) {
+            finish = lane_finish;
+        }
+    }
+    return finish;
+}
+
+// Runs `cycles` instructions on every running lane.
+VECTOR void run_cycles_kernel(struct chip8_lockstep *lockstep, long cycles) {
+    struct chip8_decoded uncached;
+    uint32_t active = 0;
+    // Instructions issued while each lane was waiting at another PC.
+    // A lane has executed (issued - waited[lane]) instructions.
+    long waited[LANES] = { 0 };
+    long issued = 0;
+    int known_PC = -1;
+    // Masks for the lanes that ran last, reused while the lanes stay together.
+    uint32_t mask_lanes = 0;
+    u8v m8 = {};
+    u16v m16 = {};
+    enum chip8_quirks quirks = lockstep->quirks;
+
+    for(int lane = 0; lane < lockstep->lanes && cycles > 0; lane++) {
+        if(lockstep->machines[lane].status == CHIP8_OK) {
+            active |= 1u << lane;
+        }
+    }
+    long finish = next_finish(active, waited, cycles);
+
+    while(active != 0) {
+        const struct chip8_decoded *d;
+        unsigned short PC;
+        uint32_t lanes = pick_lanes(lockstep, active, known_PC, &PC, &uncached, &d);
+        if(lanes != mask_lanes) {
+            m8 = lane_mask8(lanes);
+            m16 = lane_mask16(m8);
+            mask_lanes = lanes;
+        }
+
+        blend16(lockstep->PC, (u16v) {} + (unsigned short) (PC + 2), m16);
+        int next_PC = run_vector(lockstep, d, PC, lanes, m8, m16, quirks);
+        if(next_PC == NOT_VECTOR) {
+            for(uint32_t bits = lanes; bits != 0; bits &= bits - 1) {
+                int lane = __builtin_ctz(bits);
+                unsigned short I = lockstep->I[lane];
+                run_scalar(lockstep, lane, d);
+                for(int i = 0; i < chip8_memory_written(d); i++) {
+                    lockstep->written[(I + i) & (MEMORY_SIZE - 1)] = true;
+                }
+                if(lockstep->machines[lane].status != CHIP8_OK) {
+                    active &= ~(1u << lane);
+                }
+            }
+            next_PC = scalar_next_PC(d, PC);
+        }
+
+        issued++;
+        lockstep->issued++;
+        lockstep->executed += __builtin_popcount(lanes);
+
+        uint32_t waiting = active & ~lanes;
+        if(waiting != 0) {
+            for(uint32_t bits = waiting; bits != 0; bits &= bits - 1) {
+                waited[__builtin_ctz(bits)]++;
+            }
+            finish = next_finish(active, waited, cycles);
+        }
+        if(issued == finish) {
+            for(uint32_t bits = active; bits != 0; bits &= bits - 1) {
+                int lane = __builtin_ctz(bits);
+                if(issued - waited[lane] == cycles) {
+                    active &= ~(1u << lane);
+                }
+            }
+            finish = next_finish(active, waited, cycles);
+        }
+        known_PC = waiting == 0 ? next_PC : -1;
+    }
+}
+
+static void run_cycles_generic(struct chip8_lockstep *lockstep, long cycles) {
+    run_cycles_kernel(lockstep, cycles);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2")))
+static void run_cycles_avx2(struct chip8_lockstep *lockstep, long cycles) {
+    run_cycles_kernel(lockstep, cycles);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static void run_cycles_avx512(struct chip8_lockstep *lockstep, long cycles) {
+    run_cycles_kernel(lockstep, cycles);
+}
+
+#define LOCKSTEP_X86 1
+#endif
+
+#else
+
+// Without vector extensions every lane runs on its own machine.
+static void run_cycles_generic(struct chip8_lockstep *lockstep, long cycles) {
+    for(int lane = 0; lane < lockstep->lanes; lane++) {
+        scatter_lane(lockstep, lane);
+        long executed = chip8_run_cycles(&lockstep->machines[lane], cycles);
+        lockstep->executed += executed;
+        lockstep->issued += executed;
+        gather_lane(lockstep, lane);
+    }
+}
+
+#endif
+
+static void (*run_cycles)(struct chip8_lockstep *lockstep, long cycles) = NULL;
+static pthread_once_t default_kernel_once = PTHREAD_ONCE_INIT;
+
+static void set_default_kernel() {
+    chip8_lockstep_set_kernel(CHIP8_LOCKSTEP_AUTO);
+}
+
+bool chip8_lockstep_set_kernel(enum chip8_lockstep_kernel kernel) {
+    // Pick the default first, so a later first frame does not replace this choice.
+    if(kernel != CHIP8_LOCKSTEP_AUTO) {
+        pthread_once(&default_kernel_once, set_default_kernel);
+    }
+
+    switch(kernel) {
+        case CHIP8_LOCKSTEP_AUTO:
+#if defined(LOCKSTEP_X86)
+            if(__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")) {
+                run_cycles = run_cycles_avx512;
+                return true;
+            }
+            if(__builtin_cpu_supports("avx2")) {
+                run_cycles = run_cycles_avx2;
+                return true;
+            }
+#endif
+            run_cycles = run_cycles_generic;
+            return true;
+        case CHIP8_LOCKSTEP_GENERIC:
+            run_cycles = run_cycles_generic;
+            return true;
+        case CHIP8_LOCKSTEP_AVX2:
+#if defined(LOCKSTEP_X86)
+            if(__builtin_cpu_supports("avx2")) {
+                run_cycles = run_cycles_avx2;
+                return true;
+            }
+#endif
+            return false;
+        case CHIP8_LOCKSTEP_AVX512:
+#if defined(LOCKSTEP_X86)
+            if(__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")) {
+                run_cycles = run_cycles_avx512;
+                return true;
+            }
+#endif
+            return false;
+    }
+    return false;
+}
+
+int chip8_lockstep_init(struct chip8_lockstep *lockstep, int lanes, const unsigned char *rom, long size) {
+    memset(lockstep, 0, sizeof(*lockstep));
+    if(lanes < 1 || lanes > LANES) {
+        return -1;
+    }
+
+    lockstep->machines = malloc(sizeof(struct chip8_machine) * lanes);
+    if(lockstep->machines == NULL) {
+        return -1;
+    }
+    lockstep->lanes = lanes;
+    lockstep->quirks = CHIP8_DEFAULT_QUIRKS;
+
+    for(int lane = 0; lane < lanes; lane++) {
+        struct chip8_machine *machine = &lockstep->machines[lane];
+        chip8_init(machine);
+        machine->engine = CHIP8_ENGINE_CALL;
+        chip8_seed(machine, lane);
+        if(chip8_load_rom_buffer(machine, rom, size) < 0) {
+            chip8_lockstep_destroy(lockstep);
+            return -1;
+        }
+        gather_lane(lockstep, lane);
+    }
+    return 0;
+}
+
+void chip8_lockstep_set_quirks(struct chip8_lockstep *lockstep, enum chip8_quirks quirks) {
+    lockstep->quirks = quirks;
+    for(int lane = 0; lane < lockstep->lanes; lane++) {
+        chip8_set_quirks(&lockstep->machines[lane], quirks);
+    }
+}
+
+void chip8_lockstep_destroy(struct chip8_lockstep *lockstep) {
+    for(int lane = 0; lane < lockstep->lanes; lane++) {
+        chip8_destroy(&lockstep->machines[lane]);
+    }
+    free(lockstep->machines);
+    lockstep->machines = NULL;
+    lockstep->lanes = 0;
+}
+
+void chip8_lockstep_run_frame(struct chip8_lockstep *lockstep, long cycles_per_frame) {
+    pthread_once(&default_kernel_once, set_default_kernel);
+    run_cycles(lockstep, cycles_per_frame);
+
+    // Timers count down to zero.
+    for(int lane = 0; lane < lockstep->lanes; lane++) {
+        if(lockstep->delay_timer[lane] > 0) {
+            lockstep->delay_timer[lane]--;
+        }
+        if(lockstep->sound_timer[lane] > 0) {
+            lockstep->sound_timer[lane]--;
+        }
+    }
+}
+
+void chip8_lockstep_sync(struct chip8_lockstep *lockstep) {
+    for(int lane = 0; lane < lockstep->lanes; lane++) {
+        scatter_lane(lockstep, lane);
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+/*
+    Runs up to 32 copies of one rom in lockstep, for exploring many inputs
+    or seeds at once. The registers, PC, I and timers of every lane are
+    kept as structure of arrays, so the common instructions run for all
+    lanes at once in vector registers. Lanes on other instructions are
+    masked off and catch up later: the lanes furthest behind in memory go
+    first, which brings them back together after a branch.
+    Memory, display, stack and keypad stay in a chip8_machine per lane, and
+    the rarer instructions run on it one lane at a time with the same
+    semantics as the interpreter.
+*/
+
+#include <stdint.h>
+
+#include "./chip8.h"
+
+#define CHIP8_LOCKSTEP_MAX_LANES 32
+
+struct chip8_lockstep {
+    int lanes;
+    // The same for every lane. Set with chip8_lockstep_set_quirks.
+    enum chip8_quirks quirks;
+
+    // One element per lane. Lanes past `lanes` are never run.
+    uint8_t V[16][CHIP8_LOCKSTEP_MAX_LANES];
+    uint16_t PC[CHIP8_LOCKSTEP_MAX_LANES];
+    uint16_t I[CHIP8_LOCKSTEP_MAX_LANES];
+    uint8_t delay_timer[CHIP8_LOCKSTEP_MAX_LANES];
+    uint8_t sound_timer[CHIP8_LOCKSTEP_MAX_LANES];
+
+    // Addresses some lane has written to. Everywhere else every lane
+    // still holds the rom, so lanes at the same PC run the same instruction.
+    bool written[MEMORY_SIZE];
+
+    // The rest of each lane. Set keys in machines[lane].keypad.
+    // Registers, PC, I and timers in here are only current after chip8_lockstep_sync.
+    struct chip8_machine *machines;
+
+    // Instructions issued, each for one or more lanes.
+    long issued;
+    // Instructions executed, summed over lanes.
+    long executed;
+};
+
+// Which instruction set the vector code is compiled for.
+enum chip8_lockstep_kernel {
+    // The widest one the cpu supports.
+    CHIP8_LOCKSTEP_AUTO = 0,
+    CHIP8_LOCKSTEP_GENERIC,
+    CHIP8_LOCKSTEP_AVX2,
+    CHIP8_LOCKSTEP_AVX512,
+};
+
+// Starts `lanes` machines on the same rom, lane i seeded with i. Returns -1 on failure.
+int chip8_lockstep_init(struct chip8_lockstep *lockstep, int lanes, const unsigned char *rom, long size);
+void chip8_lockstep_destroy(struct chip8_lockstep *lockstep);
+// Switches every lane to another quirk profile.
+void chip8_lockstep_set_quirks(struct chip8_lockstep *lockstep, enum chip8_quirks quirks);
+
+// Runs `cycles_per_frame` instructions on every lane, then ticks the timers once.
+// A lane that stops on an invalid opcode stays stopped.
+void chip8_lockstep_run_frame(struct chip8_lockstep *lockstep, long cycles_per_frame);
+
+// Copies the registers, PC, I and timers of every lane into its machine.
+void chip8_lockstep_sync(struct chip8_lockstep *lockstep);
+
+// Returns false if the cpu can't run the kernel.
+// Call it before running frames on other threads, the first frame picks CHIP8_LOCKSTEP_AUTO.
+bool chip8_lockstep_set_kernel(enum chip8_lockstep_kernel kernel);
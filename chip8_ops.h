@@ -0,0 +1,627 @@
+#pragma once
+
+/*
+    Instruction semantics shared by every dispatch engine.
+    The call engine in chip8.c takes the address of these, the threaded
+    engine in chip8_threaded.c inlines them behind its labels.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "./chip8.h"
+
+#if defined(__GNUC__)
+#define CHIP8_OP static inline __attribute__((always_inline))
+#else
+#define CHIP8_OP static inline
+#endif
+
+// All writes to memory from instructions go through here,
+// so the decoded instruction and any translated block covering the
+// address are thrown away.
+static inline void write_memory(struct chip8_machine *machine, unsigned short address, unsigned char value) {
+    address &= MEMORY_SIZE - 1;
+    if(machine->memory[address] == value) {
+        return;
+    }
+    machine->memory[address] = value;
+    machine->effects++;
+    machine->dirty |= 1u << (address / CHIP8_PAGE_SIZE);
+    machine->decode_cache[address >> 1].handler = NULL;
+    if(machine->jit != NULL) {
+        chip8_jit_invalidate(machine, address);
+    }
+}
+
+// PCG32 (XSH RR), one step per random number.
+#define CHIP8_PCG_MULTIPLIER 6364136223846793005ULL
+#define CHIP8_PCG_INCREMENT 1442695040888963407ULL
+
+static inline uint32_t next_random(struct chip8_machine *machine) {
+    uint64_t state = machine->random_state;
+    machine->random_state = state * CHIP8_PCG_MULTIPLIER + CHIP8_PCG_INCREMENT;
+    uint32_t xorshifted = ((state >> 18) ^ state) >> 27;
+    uint32_t rotation = state >> 59;
+    return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+}
+
+static inline unsigned char read_memory(struct chip8_machine *machine, unsigned short address) {
+    return machine->memory[address & (MEMORY_SIZE - 1)];
+}
+
+/*
+    Instruction semantics.
+    PC has already been moved past the instruction when one of these runs.
+*/
+
+/*
+    Quirks. The ops that differ between interpreters are written once as
+    quirk_XXXX, taking the profile, and stamped out per profile by
+    CHIP8_QUIRK_VARIANTS as op_XXXX_vip, op_XXXX_schip and op_XXXX_xochip.
+    The profile is a constant inside each variant, so the chip8_quirk_*
+    checks fold away.
+*/
+#define CHIP8_QUIRK_VARIANT(name, suffix, quirks)                                                               \
+    CHIP8_OP void op_##name##_##suffix(struct chip8_machine *machine, const struct chip8_decoded *d) {          \
+        quirk_##name(machine, d, quirks);                                                                      \
+    }
+
+#define CHIP8_QUIRK_VARIANTS(name)                                                                              \
+    CHIP8_QUIRK_VARIANT(name, vip, CHIP8_QUIRKS_VIP)                                                            \
+    CHIP8_QUIRK_VARIANT(name, schip, CHIP8_QUIRKS_SCHIP)                                                        \
+    CHIP8_QUIRK_VARIANT(name, xochip, CHIP8_QUIRKS_XOCHIP)
+
+CHIP8_OP void op_invalid(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    printf("%x is not a valid instructon at PC=%d\n", d->NNN, machine->PC);
+    machine->status = CHIP8_INVALID_OPCODE;
+}
+
+CHIP8_OP void op_nop(struct chip8_machine *machine, const struct chip8_decoded *d) {
+}
+
+static inline void display_changed(struct chip8_machine *machine) {
+    machine->draw_flag = true;
+    machine->dirty |= CHIP8_DIRTY_DISPLAY;
+}
+
+CHIP8_OP void op_00e0(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    //00E0	Display	disp_clear()	Clears the screen.
+    // XO-CHIP: only the selected planes.
+    for(int plane = 0; plane < CHIP8_PLANES; plane++) {
+        if(machine->planes & (1 << plane)) {
+            memset(machine->display.rows[plane], 0x00, sizeof(machine->display.rows[plane]));
+        }
+    }
+    display_changed(machine);
+}
+
+CHIP8_OP void op_00ee(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    //00EE	Flow	return;	Returns from a subroutine.
+    if(machine->stack.elements == 0) {
+        machine->status = CHIP8_STACK_UNDERFLOW;
+        return;
+    }
+    machine->PC = pop_stack(&machine->stack);
+}
+
+CHIP8_OP void op_1nnn(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 1NNN	Flow	goto NNN;	Jumps to address NNN.
+    machine->PC = d->NNN;
+}
+
+CHIP8_OP void op_2nnn(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 2NNN	Flow	*(0xNNN)()	Calls subroutine at NNN.
+    // Push next PC to stack.
+    if(machine->stack.elements >= machine->stack.len) {
+        machine->status = CHIP8_STACK_OVERFLOW;
+        return;
+    }
+    push_stack(&machine->stack, machine->PC);
+    machine->PC = d->NNN;
+}
+
+CHIP8_OP void op_3xnn(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    //3XNN	Cond	if (Vx == NN)	Skips the next instruction if VX equals NN (usually the next instruction is a jump to skip a code block).
+    if(machine->registers[d->X] == d->NN) {
+        // Skip next instruction.
+        machine->PC += 2;
+    }
+}
+
+CHIP8_OP void op_4xnn(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    //4XNN	Cond	.chif (Vx != NN)	Skips the next instruction if VX does not equal NN (usually the next instruction is a jump to skip a code block).
+    if(machine->registers[d->X] != d->NN) {
+        machine->PC += 2;
+    }
+}
+
+CHIP8_OP void op_5xy0(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 5XY0	Cond	if (Vx == Vy)	Skips the next instruction if VX equals VY (usually the next instruction is a jump to skip a code block).
+    if(machine->registers[d->X] == machine->registers[d->Y]) {
+        machine->PC += 2;
+    }
+}
+
+CHIP8_OP void op_5xy2(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 5XY2	MEM	XO-CHIP: Stores VX to VY (including VY) in memory, starting at address I, in reverse
+    // order when X is above Y. I is left unmodified.
+    int step = d->X <= d->Y ? 1 : -1;
+    int count = chip8_memory_written(d);
+    for(int i = 0; i < count; i++) {
+        write_memory(machine, machine->I + i, machine->registers[d->X + i * step]);
+    }
+}
+
+CHIP8_OP void op_5xy3(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 5XY3	MEM	XO-CHIP: Fills VX to VY (including VY) from memory, starting at address I, in reverse
+    // order when X is above Y. I is left unmodified.
+    int step = d->X <= d->Y ? 1 : -1;
+    int count = (d->X > d->Y ? d->X - d->Y : d->Y - d->X) + 1;
+    for(int i = 0; i < count; i++) {
+        machine->registers[d->X + i * step] = read_memory(machine, machine->I + i);
+    }
+}
+
+CHIP8_OP void op_6xnn(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 6XNN	Const	Vx = NN	Sets VX to NN.
+    machine->registers[d->X] = d->NN;
+}
+
+CHIP8_OP void op_7xnn(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 7XNN	Const	Vx += NN	Adds NN to VX (carry flag is not changed).
+    machine->registers[d->X] += d->NN;
+}
+
+CHIP8_OP void op_8xy0(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 8XY0	Assig	Vx = Vy	Sets VX to the value of VY.
+    machine->registers[d->X] = machine->registers[d->Y];
+}
+
+CHIP8_OP void quirk_8xy1(struct chip8_machine *machine, const struct chip8_decoded *d, enum chip8_quirks quirks) {
+    // 8XY1	BitOp	Vx |= Vy	Sets VX to VX or VY. (bitwise OR operation)
+    machine->registers[d->X] |= machine->registers[d->Y];
+    if(chip8_quirk_vf_reset(quirks)) {
+        // Reset the flag register
+        machine->registers[0xF] = 0;
+    }
+}
+CHIP8_QUIRK_VARIANTS(8xy1)
+
+CHIP8_OP void quirk_8xy2(struct chip8_machine *machine, const struct chip8_decoded *d, enum chip8_quirks quirks) {
+    // 8XY2	BitOp	Vx &= Vy	Sets VX to VX and VY. (bitwise AND operation)
+    machine->registers[d->X] &= machine->registers[d->Y];
+    if(chip8_quirk_vf_reset(quirks)) {
+        // Reset the flag register
+        machine->registers[0xF] = 0;
+    }
+}
+CHIP8_QUIRK_VARIANTS(8xy2)
+
+CHIP8_OP void quirk_8xy3(struct chip8_machine *machine, const struct chip8_decoded *d, enum chip8_quirks quirks) {
+    // 8XY3[a]	BitOp	Vx ^= Vy	Sets VX to VX xor VY.
+    machine->registers[d->X] ^= machine->registers[d->Y];
+    if(chip8_quirk_vf_reset(quirks)) {
+        // Reset the flag register
+        machine->registers[0xF] = 0;
+    }
+}
+CHIP8_QUIRK_VARIANTS(8xy3)
+
+CHIP8_OP void op_8xy4(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 8XY4	Math	Vx += Vy	Adds VY to VX.
+    // VF is set to 1 when there's a carry, and to 0 when there is not.
+
+    // Vf cannot be used as Vx or Vy
+    unsigned char vx_temp = machine->registers[d->X];
+    unsigned char vy_temp = machine->registers[d->Y];
+    machine->registers[d->X] += machine->registers[d->Y];
+
+    // Check if there was a carry
+    machine->registers[0xF] = vx_temp + vy_temp > 0xFF;
+}
+
+CHIP8_OP void op_8xy5(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there is not.
+    unsigned char vx_temp = machine->registers[d->X];
+    unsigned char vy_temp = machine->registers[d->Y];
+    machine->registers[d->X] = vx_temp - vy_temp;
+    machine->registers[0xF] = vx_temp >= vy_temp;
+}
+
+CHIP8_OP void quirk_8xy6(struct chip8_machine *machine, const struct chip8_decoded *d, enum chip8_quirks quirks) {
+    // Ambigious instruction!!
+    if(chip8_quirk_shift_vy(quirks)) {
+        // For the original COSMAC VIP:
+        // Vy is stored in Vx, and Vx is shiftet to right by 1.
+        machine->registers[d->X] = machine->registers[d->Y];
+    }
+
+    // SCHIP: shifts the vx in place
+    unsigned char vx_temp = machine->registers[d->X];
+    machine->registers[d->X] = vx_temp >> 1;
+    // Both: Stores the least significant bit of vx in vf
+    machine->registers[0xF] = vx_temp & 0x1;
+}
+CHIP8_QUIRK_VARIANTS(8xy6)
+
+CHIP8_OP void op_8xy7(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 8XY7[a]	Math	Vx = Vy - Vx	Sets VX to VY minus VX.
+    // VF is set to 0 when there's a borrow, and 1 when there is not.
+    unsigned char vx_temp = machine->registers[d->X];
+    unsigned char vy_temp = machine->registers[d->Y];
+    machine->registers[d->X] = vy_temp - vx_temp;
+    machine->registers[0xF] = vy_temp >= vx_temp;
+}
+
+CHIP8_OP void quirk_8xye(struct chip8_machine *machine, const struct chip8_decoded *d, enum chip8_quirks quirks) {
+    // Ambiguous instruction
+    if(chip8_quirk_shift_vy(quirks)) {
+        // For the original COSMAC VIP:
+        // Vy is stored in Vx, and Vx is shiftet to left by 1.
+        machine->registers[d->X] = machine->registers[d->Y];
+    }
+
+    // 8XYE[a]	BitOp	Vx <<= 1
+    // Stores the most significant bit of VX in VF and then shifts VX to the left by 1.[b]
+    unsigned char vx_temp = machine->registers[d->X];
+    machine->registers[d->X] = vx_temp << 1;
+    machine->registers[0xF] = (vx_temp & 0x80) >> 7;
+}
+CHIP8_QUIRK_VARIANTS(8xye)
+
+CHIP8_OP void op_9xy0(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 9XY0	Cond	if (Vx != Vy)	Skips the next instruction if VX does not equal VY.
+    // (Usually the next instruction is a jump to skip a code block);
+    if(machine->registers[d->X] != machine->registers[d->Y]) {
+        machine->PC += 2;
+    }
+}
+
+CHIP8_OP void op_annn(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    //ANNN	MEM	I = NNN	Sets I to the address NNN.
+    machine->I = d->NNN;
+}
+
+CHIP8_OP void op_bnnn(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // BNNN	Flow	PC = V0 + NNN	Jumps to the address NNN plus V0.
+    machine->PC = d->NNN + machine->registers[0x0];
+}
+
+CHIP8_OP void op_cxnn(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // CXNN	Rand	Vx = rand() & NN	Sets VX to the result of a
+    // bitwise and operation on a random number (Typically: 0 to 255) and NN.
+    unsigned char r = next_random(machine) >> 24;
+    machine->effects++;
+    machine->registers[d->X] = r & d->NN;
+}
+
+// XORs a sprite row into a display row at x, the leftmost pixel of `bits`
+// its top bit. Pixels past the last of `words` words fall off.
+// Returns the lit pixels that were turned off.
+static inline uint64_t draw_row(uint64_t *row, uint64_t bits, int x, int words) {
+    int word = x / 64;
+    int shift = x % 64;
+    uint64_t collision = row[word] & (bits >> shift);
+    row[word] ^= bits >> shift;
+    if(shift != 0 && word + 1 < words) {
+        uint64_t spill = bits << (64 - shift);
+        collision |= row[word + 1] & spill;
+        row[word + 1] ^= spill;
+    }
+    return collision;
+}
+
+// DXYN in any resolution, plane or sprite size.
+static inline uint64_t draw_planes(struct chip8_machine *machine, const struct chip8_decoded *d, int vx, int vy,
+                                   int height) {
+    struct chip8_display *display = &machine->display;
+    int bytes = d->N == 0 ? 2 : 1;
+    int rows = d->N == 0 ? 16 : d->N;
+    int words = display->hires ? CHIP8_ROW_WORDS : 1;
+    unsigned short pixel_address = machine->I;
+    uint64_t collision = 0;
+
+    for(int plane = 0; plane < CHIP8_PLANES; plane++) {
+        if(!(machine->planes & (1 << plane))) {
+            continue;
+        }
+        for (int row = 0; row < height; row++) {
+            uint64_t sprite_row = (uint64_t) read_memory(machine, pixel_address + row * bytes) << 56;
+            if(bytes == 2) {
+                sprite_row |= (uint64_t) read_memory(machine, pixel_address + row * 2 + 1) << 48;
+            }
+            collision |= draw_row(display->rows[plane][vy + row], sprite_row, vx, words);
+        }
+        pixel_address += rows * bytes;
+    }
+    return collision;
+}
+
+CHIP8_OP void op_dxyn(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // DXYN	Display	draw(Vx, Vy, N)	Draws an 8xN sprite from I at (VX, VY).
+    // VF is set to 1 if any lit pixel is turned off, and to 0 if not.
+    // The start position wraps, the sprite itself is clipped at the edges.
+    // SUPER-CHIP: DXY0 draws a 16x16 sprite, two bytes per row.
+    // XO-CHIP: each selected plane takes the next sprite in memory.
+    struct chip8_display *display = &machine->display;
+    // Both resolutions are powers of two.
+    int vx = machine->registers[d->X] & (chip8_display_width(display) - 1);
+    int vy = machine->registers[d->Y] & (chip8_display_height(display) - 1);
+    int height = d->N == 0 ? 16 : d->N;
+    uint64_t collision = 0;
+
+    if(height > chip8_display_height(display) - vy) {
+        height = chip8_display_height(display) - vy;
+    }
+
+    if(machine->planes == 1 && !display->hires && d->N != 0) {
+        // The common case, one byte per row into one word of plane 0.
+        unsigned short pixel_address = machine->I;
+        for (int row = 0; row < height; row++) {
+            // Leftmost pixel is the top bit. Pixels shifted past the right edge fall off.
+            uint64_t sprite_row = ((uint64_t) read_memory(machine, pixel_address + row) << 56) >> vx;
+            collision |= display->rows[0][vy + row][0] & sprite_row;
+            display->rows[0][vy + row][0] ^= sprite_row;
+        }
+    } else {
+        collision = draw_planes(machine, d, vx, vy, height);
+    }
+
+    machine->registers[0xF] = collision != 0;
+    display_changed(machine);
+}
+
+/*
+    Scrolling, SUPER-CHIP and XO-CHIP. Moves the selected planes by whole
+    rows, or shifts each row's words, in pixels of the current resolution.
+*/
+
+CHIP8_OP void op_00cn(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 00CN	Display	Scrolls the display down by N pixels.
+    int height = chip8_display_height(&machine->display);
+    int n = d->N < height ? d->N : height;
+    for(int plane = 0; plane < CHIP8_PLANES; plane++) {
+        if(machine->planes & (1 << plane)) {
+            uint64_t (*rows)[CHIP8_ROW_WORDS] = machine->display.rows[plane];
+            memmove(rows + n, rows, sizeof(rows[0]) * (height - n));
+            memset(rows, 0, sizeof(rows[0]) * n);
+        }
+    }
+    display_changed(machine);
+}
+
+CHIP8_OP void op_00dn(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 00DN	Display	XO-CHIP: scrolls the display up by N pixels.
+    int height = chip8_display_height(&machine->display);
+    int n = d->N < height ? d->N : height;
+    for(int plane = 0; plane < CHIP8_PLANES; plane++) {
+        if(machine->planes & (1 << plane)) {
+            uint64_t (*rows)[CHIP8_ROW_WORDS] = machine->display.rows[plane];
+            memmove(rows, rows + n, sizeof(rows[0]) * (height - n));
+            memset(rows + height - n, 0, sizeof(rows[0]) * n);
+        }
+    }
+    display_changed(machine);
+}
+
+CHIP8_OP void op_00fb(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 00FB	Display	Scrolls the display right by 4 pixels.
+    int height = chip8_display_height(&machine->display);
+    bool hires = machine->display.hires;
+    for(int plane = 0; plane < CHIP8_PLANES; plane++) {
+        if(!(machine->planes & (1 << plane))) {
+            continue;
+        }
+        for(int y = 0; y < height; y++) {
+            uint64_t *row = machine->display.rows[plane][y];
+            if(hires) {
+                row[1] = row[1] >> 4 | row[0] << 60;
+            }
+            row[0] >>= 4;
+        }
+    }
+    display_changed(machine);
+}
+
+CHIP8_OP void op_00fc(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 00FC	Display	Scrolls the display left by 4 pixels.
+    int height = chip8_display_height(&machine->display);
+    bool hires = machine->display.hires;
+    for(int plane = 0; plane < CHIP8_PLANES; plane++) {
+        if(!(machine->planes & (1 << plane))) {
+            continue;
+        }
+        for(int y = 0; y < height; y++) {
+            uint64_t *row = machine->display.rows[plane][y];
+            if(hires) {
+                row[0] = row[0] << 4 | row[1] >> 60;
+                row[1] <<= 4;
+            } else {
+                row[0] <<= 4;
+            }
+        }
+    }
+    display_changed(machine);
+}
+
+CHIP8_OP void op_00fd(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 00FD	Flow	exit()	Stops the interpreter.
+    machine->status = CHIP8_EXITED;
+}
+
+// 00FE / 00FF. Every plane is cleared, so nothing is left outside the new resolution.
+static inline void set_resolution(struct chip8_machine *machine, bool hires) {
+    memset(machine->display.rows, 0x00, sizeof(machine->display.rows));
+    machine->display.hires = hires;
+    display_changed(machine);
+}
+
+CHIP8_OP void op_00fe(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 00FE	Display	Switches to 64x32.
+    set_resolution(machine, false);
+}
+
+CHIP8_OP void op_00ff(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // 00FF	Display	Switches to 128x64.
+    set_resolution(machine, true);
+}
+
+CHIP8_OP void op_ex9e(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    /* EX9E	KeyOp	if (key() == Vx)
+       Skips the next instruction if the key stored in VX is pressed
+       (usually the next instruction is a jump to skip a code block).
+    */
+    if(machine->keypad[machine->registers[d->X] & 0xF]) {
+        machine->PC += 2;
+    }
+}
+
+CHIP8_OP void op_exa1(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // EXA1	KeyOp	if (key() != Vx)
+    // Skips the next instruction if the key stored in VX is not pressed
+    // (usually the next instruction is a jump to skip a code block).
+    if(!machine->keypad[machine->registers[d->X] & 0xF]) {
+        machine->PC += 2;
+    }
+}
+
+CHIP8_OP void op_fn01(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // FN01	Display	XO-CHIP: selects the planes drawn, cleared and scrolled, bit p for plane p.
+    machine->planes = d->X & ((1 << CHIP8_PLANES) - 1);
+}
+
+CHIP8_OP void op_f002(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // F002	Sound	XO-CHIP: Loads the 16 byte audio pattern from I.
+    for(int i = 0; i < CHIP8_AUDIO_PATTERN_SIZE; i++) {
+        machine->audio_pattern[i] = read_memory(machine, machine->I + i);
+    }
+}
+
+CHIP8_OP void op_fx07(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // FX07	Timer	Vx = get_delay()	Sets VX to the value of the delay timer.
+    machine->registers[d->X] = machine->delay_timer;
+}
+
+CHIP8_OP void op_fx0a(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // FX0A	KeyOp	Vx = get_key()	A key press is awaited, and then stored in VX
+    // (blocking operation, all instruction halted until next key event).
+    short key_pressed = -1;
+
+    // For now just set it to first pressed key it finds.
+    // Should probably handle multiple key presses.
+    for(short i = 0; i < 16; i++) {
+        if(machine->keypad[i]) {
+            key_pressed = i;
+        }
+    }
+
+    // If there was no key press, decrement the PC and return
+    if(key_pressed == -1) {
+        machine->PC -= 2;
+        return;
+    }
+
+    // If there was a key press, store it in VX.
+    machine->registers[d->X] = key_pressed;
+}
+
+CHIP8_OP void op_fx15(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    //FX15	Timer	delay_timer(Vx)	Sets the delay timer to VX.
+    machine->delay_timer = machine->registers[d->X];
+}
+
+CHIP8_OP void op_fx18(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    //FX18	Sound	sound_timer(Vx)	Sets the sound timer to VX.
+    machine->sound_timer = machine->registers[d->X];
+}
+
+CHIP8_OP void op_fx1e(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // FX1E	MEM	I += Vx	Adds VX to I. VF is not affected.
+    machine->I += machine->registers[d->X];
+}
+
+CHIP8_OP void op_fx29(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // FX29	MEM	I = sprite_addr[Vx]	Sets I to the location of
+    // the sprite for the character in VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font.
+
+    // The font is stored from memory address 0x50
+    machine->I = FONT_START + 5 * machine->registers[d->X];
+}
+
+CHIP8_OP void op_fx30(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // FX30	MEM	I = big_sprite_addr[Vx]	SUPER-CHIP: Sets I to the 8x10 sprite for the character in VX.
+    machine->I = BIG_FONT_START + 10 * (machine->registers[d->X] & 0xF);
+}
+
+CHIP8_OP void op_fx33(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // FX33	BCD
+    // Stores the binary-coded decimal representation of VX, with the hundreds digit in memory at location in I,
+    // the tens digit at location I+1, and the ones digit at location I+2.
+    unsigned char vx = machine->registers[d->X];
+    write_memory(machine, machine->I, vx / 100 % 10);
+    write_memory(machine, machine->I + 1, vx / 10 % 10);
+    write_memory(machine, machine->I + 2, vx % 10);
+}
+
+CHIP8_OP void op_fx3a(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // FX3A	Sound	XO-CHIP: Sets the audio pitch to VX.
+    machine->pitch = machine->registers[d->X];
+}
+
+CHIP8_OP void quirk_fx55(struct chip8_machine *machine, const struct chip8_decoded *d, enum chip8_quirks quirks) {
+    // FX55	MEM	reg_dump(Vx, &I)	Stores from V0 to VX (including VX) in memory, starting at address I.
+    // The offset from I is increased by 1 for each value written, but I itself is left unmodified.
+    for(int i = 0; i <= d->X; i++) {
+        write_memory(machine, machine->I + i, machine->registers[i]);
+    }
+
+    if(chip8_quirk_increment_i(quirks)) {
+        machine->I += d->X + 1;
+    }
+}
+CHIP8_QUIRK_VARIANTS(fx55)
+
+CHIP8_OP void quirk_fx65(struct chip8_machine *machine, const struct chip8_decoded *d, enum chip8_quirks quirks) {
+    // FX65	MEM	reg_load(Vx, &I)	Fills from V0 to VX (including VX) with values from memory, starting at address I.
+    // The offset from I is increased by 1 for each value read, but I itself is left unmodified.
+    for(int i = 0; i <= d->X; i++) {
+        machine->registers[i] = read_memory(machine, machine->I + i);
+    }
+
+    if(chip8_quirk_increment_i(quirks)) {
+        machine->I += d->X + 1;
+    }
+}
+CHIP8_QUIRK_VARIANTS(fx65)
+
+CHIP8_OP void op_fx75(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // FX75	MEM	SUPER-CHIP: Stores V0 to VX (including VX) in the flags.
+    memcpy(machine->flags, machine->registers, d->X + 1);
+}
+
+CHIP8_OP void op_fx85(struct chip8_machine *machine, const struct chip8_decoded *d) {
+    // FX85	MEM	SUPER-CHIP: Fills V0 to VX (including VX) from the flags.
+    memcpy(machine->registers, machine->flags, d->X + 1);
+}
+
+// Returns the decoded instruction at PC and moves PC past it.
+// Odd addresses are not cached, so they are decoded into `uncached`.
+static inline const struct chip8_decoded *fetch_decoded(struct chip8_machine *machine, struct chip8_decoded *uncached) {
+    unsigned short PC = machine->PC & (MEMORY_SIZE - 1);
+    struct chip8_decoded *d;
+
+    if(PC & 1) {
+        d = uncached;
+        chip8_decode((read_memory(machine, PC) << 8) | read_memory(machine, PC + 1), machine->quirks, d);
+    } else {
+        d = &machine->decode_cache[PC >> 1];
+        if(d->handler == NULL) {
+            chip8_decode((machine->memory[PC] << 8) | machine->memory[PC + 1], machine->quirks, d);
+        }
+    }
+
+    machine->PC = PC + 2;
+    return d;
+}
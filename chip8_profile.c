@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "./chip8_profile.h"
+
+static const char *op_names[CHIP8_OP_COUNT] = {
+    [CHIP8_OP_INVALID] = "invalid", [CHIP8_OP_NOP] = "nop",
+    [CHIP8_OP_00E0] = "00E0", [CHIP8_OP_00EE] = "00EE", [CHIP8_OP_00CN] = "00CN", [CHIP8_OP_00DN] = "00DN",
+    [CHIP8_OP_00FB] = "00FB", [CHIP8_OP_00FC] = "00FC", [CHIP8_OP_00FD] = "00FD", [CHIP8_OP_00FE] = "00FE",
+    [CHIP8_OP_00FF] = "00FF", [CHIP8_OP_1NNN] = "1NNN", [CHIP8_OP_2NNN] = "2NNN", [CHIP8_OP_3XNN] = "3XNN",
+    [CHIP8_OP_4XNN] = "4XNN", [CHIP8_OP_5XY0] = "5XY0", [CHIP8_OP_5XY2] = "5XY2", [CHIP8_OP_5XY3] = "5XY3",
+    [CHIP8_OP_6XNN] = "6XNN", [CHIP8_OP_7XNN] = "7XNN",
+    [CHIP8_OP_8XY0] = "8XY0", [CHIP8_OP_8XY1] = "8XY1", [CHIP8_OP_8XY2] = "8XY2", [CHIP8_OP_8XY3] = "8XY3",
+    [CHIP8_OP_8XY4] = "8XY4", [CHIP8_OP_8XY5] = "8XY5", [CHIP8_OP_8XY6] = "8XY6", [CHIP8_OP_8XY7] = "8XY7",
+    [CHIP8_OP_8XYE] = "8XYE", [CHIP8_OP_9XY0] = "9XY0", [CHIP8_OP_ANNN] = "ANNN", [CHIP8_OP_BNNN] = "BNNN",
+    [CHIP8_OP_CXNN] = "CXNN", [CHIP8_OP_DXYN] = "DXYN", [CHIP8_OP_EX9E] = "EX9E", [CHIP8_OP_EXA1] = "EXA1",
+    [CHIP8_OP_FN01] = "FN01", [CHIP8_OP_F002] = "F002", [CHIP8_OP_FX07] = "FX07", [CHIP8_OP_FX0A] = "FX0A", [CHIP8_OP_FX15] = "FX15",
+    [CHIP8_OP_FX18] = "FX18", [CHIP8_OP_FX1E] = "FX1E", [CHIP8_OP_FX29] = "FX29", [CHIP8_OP_FX30] = "FX30",
+    [CHIP8_OP_FX33] = "FX33", [CHIP8_OP_FX3A] = "FX3A", [CHIP8_OP_FX55] = "FX55", [CHIP8_OP_FX65] = "FX65", [CHIP8_OP_FX75] = "FX75",
+    [CHIP8_OP_FX85] = "FX85",
+};
+
+#define INDEX_SIZE (CHIP8_PROFILE_MAX_STACKS * 2)
+
+const char *chip8_op_name(unsigned char op) {
+    return op < CHIP8_OP_COUNT ? op_names[op] : "invalid";
+}
+
+void chip8_profile_init(struct chip8_profile *profile) {
+    memset(profile, 0, sizeof(*profile));
+    // The root stack, code run outside any subroutine.
+    profile->stacks[0].parent = -1;
+    profile->stack_count = 1;
+}
+
+// Returns the stack for calling `address` from `parent`, or -1 if there is no room for a new one.
+static int find_stack(struct chip8_profile *profile, int parent, unsigned short address) {
+    unsigned int slot = ((unsigned int) parent * 2654435761u ^ address) % INDEX_SIZE;
+    while(profile->stack_index[slot] != 0) {
+        const struct chip8_profile_stack *stack = &profile->stacks[profile->stack_index[slot] - 1];
+        if(stack->parent == parent && stack->address == address) {
+            return profile->stack_index[slot] - 1;
+        }
+        slot = (slot + 1) % INDEX_SIZE;
+    }
+
+    if(profile->stack_count == CHIP8_PROFILE_MAX_STACKS) {
+        return -1;
+    }
+    int index = profile->stack_count++;
+    profile->stacks[index].parent = parent;
+    profile->stacks[index].address = address;
+    profile->stack_index[slot] = index + 1;
+    return index;
+}
+
+void chip8_profile_instruction(struct chip8_profile *profile, unsigned short PC, unsigned char op) {
+    profile->instructions++;
+    profile->ops[op]++;
+    profile->pcs[PC & (MEMORY_SIZE - 1)]++;
+    profile->stacks[profile->calls[profile->depth]].instructions++;
+}
+
+void chip8_profile_executed(struct chip8_profile *profile, const struct chip8_machine *machine,
+                            const struct chip8_decoded *decoded) {
+    switch(decoded->op) {
+        case CHIP8_OP_DXYN:
+            profile->draws++;
+            profile->collisions += machine->registers[0xF];
+            break;
+        case CHIP8_OP_2NNN:
+            if(profile->depth < STACK_SIZE) {
+                int stack = find_stack(profile, profile->calls[profile->depth], decoded->NNN);
+                profile->depth++;
+                profile->calls[profile->depth] = stack >= 0 ? stack : profile->calls[profile->depth - 1];
+            }
+            break;
+        case CHIP8_OP_00EE:
+            if(profile->depth > 0) {
+                profile->depth--;
+            }
+            break;
+    }
+}
+
+void chip8_profile_write_csv(const struct chip8_profile *profile, FILE *file) {
+    fprintf(file, "kind,key,count\n");
+    fprintf(file, "total,instructions,%llu\n", (unsigned long long) profile->instructions);
+    fprintf(file, "total,draws,%llu\n", (unsigned long long) profile->draws);
+    fprintf(file, "total,collisions,%llu\n", (unsigned long long) profile->collisions);
+    fprintf(file, "time,execute_ns,%llu\n", (unsigned long long) profile->execute_ns);
+    fprintf(file, "time,render_ns,%llu\n", (unsigned long long) profile->render_ns);
+    for(int op = 0; op < CHIP8_OP_COUNT; op++) {
+        if(profile->ops[op] != 0) {
+            fprintf(file, "op,%s,%llu\n", op_names[op], (unsigned long long) profile->ops[op]);
+        }
+    }
+    for(int address = 0; address < MEMORY_SIZE; address++) {
+        if(profile->pcs[address] != 0) {
+            fprintf(file, "pc,0x%03x,%llu\n", address, (unsigned long long) profile->pcs[address]);
+        }
+    }
+}
+
+void chip8_profile_write_json(const struct chip8_profile *profile, FILE *file) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"instructions\": %llu,\n", (unsigned long long) profile->instructions);
+    fprintf(file, "  \"draws\": %llu,\n", (unsigned long long) profile->draws);
+    fprintf(file, "  \"collisions\": %llu,\n", (unsigned long long) profile->collisions);
+    fprintf(file, "  \"execute_ns\": %llu,\n", (unsigned long long) profile->execute_ns);
+    fprintf(file, "  \"render_ns\": %llu,\n", (unsigned long long) profile->render_ns);
+
+    const char *separator = "";
+    fprintf(file, "  \"ops\": {");
+    for(int op = 0; op < CHIP8_OP_COUNT; op++) {
+        if(profile->ops[op] != 0) {
+            fprintf(file, "%s\n    \"%s\": %llu", separator, op_names[op], (unsigned long long) profile->ops[op]);
+            separator = ",";
+        }
+    }
+    fprintf(file, "\n  },\n");
+
+    separator = "";
+    fprintf(file, "  \"pcs\": {");
+    for(int address = 0; address < MEMORY_SIZE; address++) {
+        if(profile->pcs[address] != 0) {
+            fprintf(file, "%s\n    \"0x%03x\": %llu", separator, address, (unsigned long long) profile->pcs[address]);
+            separator = ",";
+        }
+    }
+    fprintf(file, "\n  }\n}\n");
+}
+
+void chip8_profile_write_folded(const struct chip8_profile *profile, FILE *file) {
+    int path[CHIP8_PROFILE_MAX_STACKS];
+
+    for(int index = 0; index < profile->stack_count; index++) {
+        if(profile->stacks[index].instructions == 0) {
+            continue;
+        }
+        int length = 0;
+        for(int stack = index; stack > 0; stack = profile->stacks[stack].parent) {
+            path[length++] = stack;
+        }
+
+        fprintf(file, "main");
+        while(length > 0) {
+            fprintf(file, ";sub_%03x", profile->stacks[path[--length]].address);
+        }
+        fprintf(file, " %llu\n", (unsigned long long) profile->stacks[index].instructions);
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+/*
+    Instruction profiler.
+    Counts the instructions a machine executes by kind and by address,
+    the sprites it draws, and which subroutines (by 2NNN/00EE nesting)
+    they ran in, for a flamegraph. Only compiled into the core when built
+    with -DCHIP8_PROFILE=1, and only used by machines with a profile
+    attached in machine->profile, which run on the call engine.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "./chip8.h"
+
+// Distinct call stacks kept. Instructions in deeper or further ones are
+// counted against the deepest stack that fit.
+#define CHIP8_PROFILE_MAX_STACKS 4096
+
+// One call stack: the subroutine entered from its parent stack.
+struct chip8_profile_stack {
+    int parent;
+    unsigned short address;
+    uint64_t instructions;
+};
+
+struct chip8_profile {
+    uint64_t instructions;
+    uint64_t ops[CHIP8_OP_COUNT];
+    uint64_t pcs[MEMORY_SIZE];
+    // DXYN executed, and the ones that set VF.
+    uint64_t draws;
+    uint64_t collisions;
+
+    // Filled in by the front end.
+    uint64_t execute_ns;
+    uint64_t render_ns;
+
+    // Stack 0 is the code outside any subroutine.
+    struct chip8_profile_stack stacks[CHIP8_PROFILE_MAX_STACKS];
+    int stack_count;
+    // Open addressing on (parent, address), holding stack index + 1.
+    int stack_index[CHIP8_PROFILE_MAX_STACKS * 2];
+    // The stacks of the calls in progress, innermost last.
+    int calls[STACK_SIZE + 1];
+    int depth;
+};
+
+void chip8_profile_init(struct chip8_profile *profile);
+
+// Called by the core around every instruction when profiling is compiled in.
+void chip8_profile_instruction(struct chip8_profile *profile, unsigned short PC, unsigned char op);
+void chip8_profile_executed(struct chip8_profile *profile, const struct chip8_machine *machine,
+                            const struct chip8_decoded *decoded);
+
+// The instruction's pattern, e.g. "8XY4".
+const char *chip8_op_name(unsigned char op);
+
+// Every counter as kind,key,count lines.
+void chip8_profile_write_csv(const struct chip8_profile *profile, FILE *file);
+void chip8_profile_write_json(const struct chip8_profile *profile, FILE *file);
+// One line per call stack, "main;sub_2a4;sub_31e count", for flamegraph.pl.
+void chip8_profile_write_folded(const struct chip8_profile *profile, FILE *file);
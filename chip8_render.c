@@ -0,0 +1,228 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "./chip8_render.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RENDER_X86 1
+#endif
+
+// Expands one display word into DISPLAY_WIDTH pixels.
+typedef void (*expand_function)(uint64_t row, uint32_t off, uint32_t on, uint32_t *out);
+
+// Repeats each of `width` pixels `size` times, size > 1. width is a multiple of 8.
+typedef void (*replicate_function)(const uint32_t *in, int width, int size, uint32_t *out);
+
+static void expand_row_scalar(uint64_t row, uint32_t off, uint32_t on, uint32_t *out) {
+    for(int x = 0; x < DISPLAY_WIDTH; x++) {
+        out[x] = (row >> (DISPLAY_WIDTH - 1 - x)) & 1 ? on : off;
+    }
+}
+
+static void replicate_row_scalar(const uint32_t *in, int width, int size, uint32_t *out) {
+    for(int x = 0; x < width; x++) {
+        for(int i = 0; i < size; i++) {
+            out[x * size + i] = in[x];
+        }
+    }
+}
+
+#if defined(RENDER_X86) && defined(__SSE2__)
+
+// 4 pixels at a time. Each lane tests its own bit of the nibble.
+static void expand_row_sse2(uint64_t row, uint32_t off, uint32_t on, uint32_t *out) {
+    const __m128i bits = _mm_set_epi32(0x1, 0x2, 0x4, 0x8);
+    const __m128i off_v = _mm_set1_epi32(off);
+    const __m128i diff_v = _mm_set1_epi32(off ^ on);
+
+    for(int x = 0; x < DISPLAY_WIDTH; x += 4) {
+        __m128i nibble = _mm_set1_epi32((row >> (DISPLAY_WIDTH - 4 - x)) & 0xF);
+        __m128i lit = _mm_cmpeq_epi32(_mm_and_si128(nibble, bits), bits);
+        __m128i colour = _mm_xor_si128(off_v, _mm_and_si128(diff_v, lit));
+        _mm_storeu_si128((__m128i *) (out + x), colour);
+    }
+}
+
+// Doubling interleaves 4 pixels with themselves. Wider pixels are a run
+// of broadcast stores, the last one overlapping the one before when size
+// is not a multiple of 4, so nothing is written past the pixel.
+static void replicate_row_sse2(const uint32_t *in, int width, int size, uint32_t *out) {
+    if(size == 2) {
+        for(int x = 0; x < width; x += 4) {
+            __m128i pixels = _mm_loadu_si128((const __m128i *) (in + x));
+            _mm_storeu_si128((__m128i *) (out + 2 * x), _mm_unpacklo_epi32(pixels, pixels));
+            _mm_storeu_si128((__m128i *) (out + 2 * x + 4), _mm_unpackhi_epi32(pixels, pixels));
+        }
+        return;
+    }
+    if(size < 4) {
+        replicate_row_scalar(in, width, size, out);
+        return;
+    }
+    for(int x = 0; x < width; x++) {
+        __m128i pixel = _mm_set1_epi32(in[x]);
+        uint32_t *run = out + x * size;
+        for(int i = 0; i < size - 4; i += 4) {
+            _mm_storeu_si128((__m128i *) (run + i), pixel);
+        }
+        _mm_storeu_si128((__m128i *) (run + size - 4), pixel);
+    }
+}
+
+#endif
+
+#if defined(RENDER_X86) && defined(__GNUC__)
+
+// 8 pixels at a time. Each lane tests its own bit of the byte.
+__attribute__((target("avx2")))
+static void expand_row_avx2(uint64_t row, uint32_t off, uint32_t on, uint32_t *out) {
+    const __m256i bits = _mm256_set_epi32(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+    const __m256i off_v = _mm256_set1_epi32(off);
+    const __m256i diff_v = _mm256_set1_epi32(off ^ on);
+
+    for(int x = 0; x < DISPLAY_WIDTH; x += 8) {
+        __m256i byte = _mm256_set1_epi32((row >> (DISPLAY_WIDTH - 8 - x)) & 0xFF);
+        __m256i lit = _mm256_cmpeq_epi32(_mm256_and_si256(byte, bits), bits);
+        __m256i colour = _mm256_xor_si256(off_v, _mm256_and_si256(diff_v, lit));
+        _mm256_storeu_si256((__m256i *) (out + x), colour);
+    }
+}
+
+// As replicate_row_sse2, 8 pixels wide. Doubling and quadrupling permute 8
+// input pixels into place, runs shorter than 8 use the SSE2 stores.
+__attribute__((target("avx2")))
+static void replicate_row_avx2(const uint32_t *in, int width, int size, uint32_t *out) {
+    if(size == 2 || size == 4) {
+        const __m256i step = _mm256_set1_epi32(8 / size);
+        for(int x = 0; x < width; x += 8) {
+            __m256i pixels = _mm256_loadu_si256((const __m256i *) (in + x));
+            __m256i index = size == 2 ? _mm256_set_epi32(3, 3, 2, 2, 1, 1, 0, 0) : _mm256_set_epi32(1, 1, 1, 1, 0, 0, 0, 0);
+            for(int i = 0; i < size; i++) {
+                _mm256_storeu_si256((__m256i *) (out + x * size + i * 8), _mm256_permutevar8x32_epi32(pixels, index));
+                index = _mm256_add_epi32(index, step);
+            }
+        }
+        return;
+    }
+    if(size < 8) {
+#if defined(__SSE2__)
+        replicate_row_sse2(in, width, size, out);
+#else
+        replicate_row_scalar(in, width, size, out);
+#endif
+        return;
+    }
+    for(int x = 0; x < width; x++) {
+        __m256i pixel = _mm256_set1_epi32(in[x]);
+        uint32_t *run = out + x * size;
+        for(int i = 0; i < size - 8; i += 8) {
+            _mm256_storeu_si256((__m256i *) (run + i), pixel);
+        }
+        _mm256_storeu_si256((__m256i *) (run + size - 8), pixel);
+    }
+}
+
+#endif
+
+static expand_function expand_row = NULL;
+static replicate_function replicate_row = NULL;
+
+static pthread_once_t default_kernel_once = PTHREAD_ONCE_INIT;
+
+static void set_default_kernel() {
+    chip8_render_set_kernel(CHIP8_RENDER_AUTO);
+}
+
+bool chip8_render_set_kernel(enum chip8_render_kernel kernel) {
+    // Pick the default first, so a later first render does not replace this choice.
+    if(kernel != CHIP8_RENDER_AUTO) {
+        pthread_once(&default_kernel_once, set_default_kernel);
+    }
+
+    switch(kernel) {
+        case CHIP8_RENDER_AUTO:
+#if defined(RENDER_X86) && defined(__GNUC__)
+            if(__builtin_cpu_supports("avx2")) {
+                expand_row = expand_row_avx2;
+                replicate_row = replicate_row_avx2;
+                return true;
+            }
+#endif
+#if defined(RENDER_X86) && defined(__SSE2__)
+            expand_row = expand_row_sse2;
+            replicate_row = replicate_row_sse2;
+            return true;
+#endif
+            expand_row = expand_row_scalar;
+            replicate_row = replicate_row_scalar;
+            return true;
+        case CHIP8_RENDER_SCALAR:
+            expand_row = expand_row_scalar;
+            replicate_row = replicate_row_scalar;
+            return true;
+        case CHIP8_RENDER_SSE2:
+#if defined(RENDER_X86) && defined(__SSE2__)
+            expand_row = expand_row_sse2;
+            replicate_row = replicate_row_sse2;
+            return true;
+#endif
+            return false;
+        case CHIP8_RENDER_AVX2:
+#if defined(RENDER_X86) && defined(__GNUC__)
+            if(__builtin_cpu_supports("avx2")) {
+                expand_row = expand_row_avx2;
+                replicate_row = replicate_row_avx2;
+                return true;
+            }
+#endif
+            return false;
+    }
+    return false;
+}
+
+// Recolours the pixels lit in plane 1, on top of those expanded from plane 0.
+static void overlay_plane(uint64_t plane0, uint64_t plane1, const struct chip8_palette *palette, uint32_t *out) {
+    for(int x = 0; x < DISPLAY_WIDTH; x++) {
+        if((plane1 >> (DISPLAY_WIDTH - 1 - x)) & 1) {
+            out[x] = palette->colours[2 | ((plane0 >> (DISPLAY_WIDTH - 1 - x)) & 1)];
+        }
+    }
+}
+
+void chip8_render_rgba(const struct chip8_display *display, const struct chip8_palette *palette,
+                       int scale, uint32_t *pixels, int pitch) {
+    uint32_t row_pixels[CHIP8_HIRES_WIDTH];
+    uint32_t off = palette->colours[0];
+    uint32_t on = palette->colours[1];
+    int words = display->hires ? CHIP8_ROW_WORDS : 1;
+    int width = chip8_display_width(display);
+    // Output pixels per display pixel.
+    int size = display->hires ? scale : scale * 2;
+
+    pthread_once(&default_kernel_once, set_default_kernel);
+
+    for(int y = 0; y < chip8_display_height(display); y++) {
+        uint32_t *out = (uint32_t *) ((unsigned char *) pixels + (long) y * size * pitch);
+        uint32_t *expanded = size == 1 ? out : row_pixels;
+
+        for(int word = 0; word < words; word++) {
+            uint32_t *word_pixels = expanded + word * DISPLAY_WIDTH;
+            expand_row(display->rows[0][y][word], off, on, word_pixels);
+            // Most roms never draw to plane 1.
+            if(display->rows[1][y][word] != 0) {
+                overlay_plane(display->rows[0][y][word], display->rows[1][y][word], palette, word_pixels);
+            }
+        }
+        if(size == 1) {
+            continue;
+        }
+
+        replicate_row(row_pixels, width, size, out);
+
+        // The other rows of a scaled pixel are copies of the first.
+        for(int i = 1; i < size; i++) {
+            memcpy((unsigned char *) out + (long) i * pitch, out, CHIP8_HIRES_WIDTH * scale * sizeof(uint32_t));
+        }
+    }
+}
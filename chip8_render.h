@@ -0,0 +1,45 @@
+#pragma once
+
+/*
+    Turns the 1 bit per pixel and plane display into 32 bit colour pixels.
+    No SDL in here, so it can also be used headless for frame capture.
+*/
+
+#include <stdint.h>
+
+#include "./chip8.h"
+
+// A colour as 4 bytes in memory: red, green, blue, alpha.
+// The same layout as SDL_PIXELFORMAT_RGBA32.
+#define CHIP8_RGBA(r, g, b, a) ((uint32_t) (r) | ((uint32_t) (g) << 8) | ((uint32_t) (b) << 16) | ((uint32_t) (a) << 24))
+
+// Indexed by a pixel's bit in plane 0, plus 2 for its bit in plane 1.
+struct chip8_palette {
+    uint32_t colours[1 << CHIP8_PLANES];
+};
+
+#define CHIP8_PALETTE_DEFAULT                                                                                  \
+    { { CHIP8_RGBA(0, 0, 0, 255), CHIP8_RGBA(255, 255, 255, 255), CHIP8_RGBA(170, 170, 170, 255),              \
+        CHIP8_RGBA(85, 85, 85, 255) } }
+
+// Which implementation of the expansion to use.
+enum chip8_render_kernel {
+    // The fastest one the cpu supports.
+    CHIP8_RENDER_AUTO = 0,
+    CHIP8_RENDER_SCALAR,
+    CHIP8_RENDER_SSE2,
+    CHIP8_RENDER_AVX2,
+};
+
+/*
+    Writes the display as (CHIP8_HIRES_WIDTH * scale) x (CHIP8_HIRES_HEIGHT * scale)
+    pixels in either resolution, each high resolution pixel repeated scale
+    times in both directions, each low resolution one twice that.
+    pitch is the number of bytes between the starts of two rows in pixels.
+*/
+void chip8_render_rgba(const struct chip8_display *display, const struct chip8_palette *palette,
+                       int scale, uint32_t *pixels, int pitch);
+
+// Picks the kernel used by chip8_render_rgba. Returns false if the cpu can't run it.
+// Call it before rendering on other threads, the first render picks CHIP8_RENDER_AUTO.
+bool chip8_render_set_kernel(enum chip8_render_kernel kernel);
@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "./chip8_replay.h"
+
+#define HEADER_SIZE 36
+
+static void put(unsigned char *out, uint64_t value, int bytes) {
+    for(int i = 0; i < bytes; i++) {
+        out[i] = value >> (i * 8);
+    }
+}
+
+static uint64_t get(const unsigned char *in, int bytes) {
+    uint64_t value = 0;
+    for(int i = 0; i < bytes; i++) {
+        value |= (uint64_t) in[i] << (i * 8);
+    }
+    return value;
+}
+
+static uint16_t keypad_mask(const struct chip8_machine *machine) {
+    uint16_t keys = 0;
+    for(int key = 0; key < 16; key++) {
+        keys |= (machine->keypad[key] != 0) << key;
+    }
+    return keys;
+}
+
+static void write_record(struct chip8_recorder *recorder, enum chip8_replay_tag tag, uint64_t payload, int bytes) {
+    unsigned char record[10 + 1 + 8];
+    unsigned char *out = record;
+    unsigned long delta = recorder->frame - recorder->last_record;
+
+    while(delta >= 0x80) {
+        *out++ = (delta & 0x7F) | 0x80;
+        delta >>= 7;
+    }
+    *out++ = delta;
+    *out++ = tag;
+    put(out, payload, bytes);
+    fwrite(record, 1, out + bytes - record, recorder->file);
+    recorder->last_record = recorder->frame;
+}
+
+int chip8_recorder_open(struct chip8_recorder *recorder, const char *path, const struct chip8_machine *machine,
+                        uint64_t seed, long cycles_per_frame, long hash_interval) {
+    unsigned char header[HEADER_SIZE];
+
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->header.seed = seed;
+    recorder->header.cycles_per_frame = cycles_per_frame;
+    recorder->header.hash_interval = hash_interval > 0 ? hash_interval : CHIP8_REPLAY_HASH_INTERVAL;
+    recorder->header.start_hash = chip8_state_hash(machine);
+    recorder->header.quirks = machine->quirks;
+
+    recorder->file = fopen(path, "wb");
+    if(recorder->file == NULL) {
+        return -1;
+    }
+
+    memcpy(header, CHIP8_REPLAY_MAGIC, 4);
+    put(header + 4, CHIP8_REPLAY_VERSION, 4);
+    put(header + 8, seed, 8);
+    put(header + 16, cycles_per_frame, 4);
+    put(header + 20, recorder->header.hash_interval, 4);
+    put(header + 24, recorder->header.start_hash, 8);
+    put(header + 32, recorder->header.quirks, 4);
+    if(fwrite(header, 1, sizeof(header), recorder->file) != sizeof(header)) {
+        fclose(recorder->file);
+        recorder->file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void chip8_recorder_frame(struct chip8_recorder *recorder, const struct chip8_machine *machine) {
+    // The core never changes the keypad, so it still holds the keys the frame ran with.
+    uint16_t keys = keypad_mask(machine);
+    if(keys != recorder->keys) {
+        write_record(recorder, CHIP8_REPLAY_KEYS, keys, 2);
+        recorder->keys = keys;
+    }
+
+    recorder->frame++;
+    if(recorder->frame % recorder->header.hash_interval == 0) {
+        write_record(recorder, CHIP8_REPLAY_HASH, chip8_state_hash(machine), 8);
+    }
+}
+
+int chip8_recorder_close(struct chip8_recorder *recorder) {
+    if(recorder->file == NULL) {
+        return -1;
+    }
+    write_record(recorder, CHIP8_REPLAY_END, 0, 0);
+    int status = ferror(recorder->file) ? -1 : 0;
+    if(fclose(recorder->file) != 0) {
+        status = -1;
+    }
+    recorder->file = NULL;
+    return status;
+}
+
+int chip8_replay_open(struct chip8_replay *replay, const char *path) {
+    unsigned char header[HEADER_SIZE];
+
+    memset(replay, 0, sizeof(*replay));
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) {
+        return -1;
+    }
+
+    if(fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, CHIP8_REPLAY_MAGIC, 4) != 0 ||
+       get(header + 4, 4) != CHIP8_REPLAY_VERSION) {
+        fclose(file);
+        return -1;
+    }
+    replay->header.seed = get(header + 8, 8);
+    replay->header.cycles_per_frame = get(header + 16, 4);
+    replay->header.hash_interval = get(header + 20, 4);
+    replay->header.start_hash = get(header + 24, 8);
+    replay->header.quirks = get(header + 32, 4);
+    if(replay->header.quirks >= CHIP8_QUIRKS_COUNT) {
+        fclose(file);
+        return -1;
+    }
+
+    // The rest of the file is records.
+    fseek(file, 0L, SEEK_END);
+    replay->size = ftell(file) - HEADER_SIZE;
+    fseek(file, HEADER_SIZE, SEEK_SET);
+    replay->records = malloc(replay->size > 0 ? replay->size : 1);
+    if(replay->records == NULL || fread(replay->records, 1, replay->size, file) != (size_t) replay->size) {
+        fclose(file);
+        chip8_replay_close(replay);
+        return -1;
+    }
+    fclose(file);
+    return 0;
+}
+
+void chip8_replay_close(struct chip8_replay *replay) {
+    free(replay->records);
+    replay->records = NULL;
+    replay->size = 0;
+}
+
+void chip8_replay_run(const struct chip8_replay *replay, struct chip8_machine *machine,
+                      struct chip8_replay_result *result) {
+    chip8_replay_run_frames(replay, machine, result, NULL, NULL);
+}
+
+void chip8_replay_run_frames(const struct chip8_replay *replay, struct chip8_machine *machine,
+                             struct chip8_replay_result *result,
+                             void (*on_frame)(void *context, const struct chip8_machine *machine), void *context) {
+    const unsigned char *in = replay->records;
+    const unsigned char *end = replay->records + replay->size;
+    long frame = 0;
+
+    memset(result, 0, sizeof(*result));
+    result->diverged_at = -1;
+    result->truncated = true;
+
+    chip8_seed(machine, replay->header.seed);
+    chip8_set_quirks(machine, replay->header.quirks);
+    if(chip8_state_hash(machine) != replay->header.start_hash) {
+        result->diverged_at = 0;
+        return;
+    }
+
+    while(in < end) {
+        unsigned long delta = 0;
+        for(int shift = 0; in < end; shift += 7) {
+            delta |= (unsigned long) (*in & 0x7F) << shift;
+            if(!(*in++ & 0x80)) {
+                break;
+            }
+        }
+        if(in >= end) {
+            break;
+        }
+        enum chip8_replay_tag tag = *in++;
+
+        long target = frame + delta;
+        for(; frame < target && machine->status == CHIP8_OK; frame++) {
+            result->cycles += chip8_run_frame(machine, replay->header.cycles_per_frame);
+            if(on_frame != NULL) {
+                on_frame(context, machine);
+            }
+        }
+        result->frames = frame;
+
+        if(tag == CHIP8_REPLAY_KEYS && end - in >= 2) {
+            chip8_set_keypad(machine, get(in, 2));
+            in += 2;
+        } else if(tag == CHIP8_REPLAY_HASH && end - in >= 8) {
+            if(chip8_state_hash(machine) != get(in, 8)) {
+                result->diverged_at = frame;
+                result->truncated = false;
+                return;
+            }
+            in += 8;
+        } else if(tag == CHIP8_REPLAY_END) {
+            result->truncated = false;
+            return;
+        } else {
+            return;
+        }
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+/*
+    Input recording and replay.
+    A recording is the keypad changes of a session, one record per frame
+    where the keys changed, plus a state hash every few frames. Replaying
+    it feeds the same keys to a machine seeded the same way, with no
+    front end, as fast as the core runs, and reports the first frame
+    where a hash does not match.
+
+    File format, all integers little endian:
+    magic, version (uint32), seed (uint64), instructions per frame
+    (uint32), frames between hashes (uint32), state hash before the first
+    frame (uint64), quirk profile (uint32), then records. A record is the frames since the
+    previous record as a varint, a tag, and the tag's payload:
+    keys (uint16) to hold from that frame on, the state hash (uint64)
+    after that many frames, or the end of the recording.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "./chip8.h"
+
+#define CHIP8_REPLAY_MAGIC "C8RP"
+#define CHIP8_REPLAY_VERSION 3
+
+// Frames between state hashes unless asked otherwise.
+#define CHIP8_REPLAY_HASH_INTERVAL CHIP8_FRAME_RATE
+
+enum chip8_replay_tag {
+    CHIP8_REPLAY_KEYS = 0,
+    CHIP8_REPLAY_HASH,
+    CHIP8_REPLAY_END,
+};
+
+struct chip8_replay_header {
+    uint64_t seed;
+    long cycles_per_frame;
+    long hash_interval;
+    uint64_t start_hash;
+    enum chip8_quirks quirks;
+};
+
+struct chip8_recorder {
+    FILE *file;
+    struct chip8_replay_header header;
+    // Frames recorded so far.
+    long frame;
+    // Frame of the last record written.
+    long last_record;
+    uint16_t keys;
+};
+
+/*
+    Starts recording to path. The machine must have its rom loaded and be
+    seeded with `seed`, and not have run yet.
+    Returns -1 if the file can't be written.
+*/
+int chip8_recorder_open(struct chip8_recorder *recorder, const char *path, const struct chip8_machine *machine,
+                        uint64_t seed, long cycles_per_frame, long hash_interval);
+// Call after each chip8_run_frame. Records the keys the frame ran with.
+void chip8_recorder_frame(struct chip8_recorder *recorder, const struct chip8_machine *machine);
+// Writes the end record and closes the file. Returns -1 on an I/O error.
+int chip8_recorder_close(struct chip8_recorder *recorder);
+
+struct chip8_replay {
+    struct chip8_replay_header header;
+    // The records, read into memory in one go.
+    unsigned char *records;
+    long size;
+};
+
+struct chip8_replay_result {
+    // Frames replayed, up to and including the diverging one.
+    long frames;
+    long cycles;
+    // Frames run when a hash first did not match, or -1. 0 means the
+    // machine did not start out as recorded: another rom, or another build.
+    long diverged_at;
+    // The recording ended before its end record, or has an unknown tag.
+    bool truncated;
+};
+
+// Returns -1 if the file can't be read, or is of another format or version.
+int chip8_replay_open(struct chip8_replay *replay, const char *path);
+void chip8_replay_close(struct chip8_replay *replay);
+
+/*
+    Seeds the machine and sets its quirks from the recording, and runs it
+    through every frame.
+    The machine must have the same rom loaded and not have run yet.
+    Stops at the first hash that does not match.
+*/
+void chip8_replay_run(const struct chip8_replay *replay, struct chip8_machine *machine,
+                      struct chip8_replay_result *result);
+// The same, calling on_frame(context, machine) after every frame.
+void chip8_replay_run_frames(const struct chip8_replay *replay, struct chip8_machine *machine,
+                             struct chip8_replay_result *result,
+                             void (*on_frame)(void *context, const struct chip8_machine *machine), void *context);
@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "./chip8_state.h"
+#include "./chip8_ops.h"
+
+#define DISPLAY_WORDS (CHIP8_PLANES * CHIP8_HIRES_HEIGHT * CHIP8_ROW_WORDS)
+
+_Static_assert(sizeof(struct chip8_snapshot) ==
+               sizeof(uint64_t) * (DISPLAY_WORDS + 1) + MEMORY_SIZE + sizeof(uint16_t) * (STACK_SIZE + 2) + 16 * 4 + 12,
+               "chip8_snapshot has padding");
+
+void chip8_save_state(const struct chip8_machine *machine, struct chip8_snapshot *snapshot) {
+    memcpy(snapshot->display, machine->display.rows, sizeof(snapshot->display));
+    snapshot->random_state = machine->random_state;
+    memcpy(snapshot->memory, machine->memory, sizeof(snapshot->memory));
+    for(int i = 0; i < STACK_SIZE; i++) {
+        snapshot->stack[i] = i < machine->stack.elements ? machine->stack.stack[i] : 0;
+    }
+    snapshot->PC = machine->PC;
+    snapshot->I = machine->I;
+    memcpy(snapshot->registers, machine->registers, sizeof(snapshot->registers));
+    memcpy(snapshot->keypad, machine->keypad, sizeof(snapshot->keypad));
+    memcpy(snapshot->flags, machine->flags, sizeof(snapshot->flags));
+    memcpy(snapshot->audio_pattern, machine->audio_pattern, sizeof(snapshot->audio_pattern));
+    snapshot->delay_timer = machine->delay_timer;
+    snapshot->sound_timer = machine->sound_timer;
+    snapshot->stack_depth = machine->stack.elements;
+    snapshot->status = machine->status;
+    snapshot->hires = machine->display.hires;
+    snapshot->planes = machine->planes;
+    snapshot->pitch = machine->pitch;
+    memset(snapshot->unused, 0, sizeof(snapshot->unused));
+}
+
+void chip8_load_state(struct chip8_machine *machine, const struct chip8_snapshot *snapshot) {
+    // Compared a word at a time, most of memory is usually the same.
+    for(int address = 0; address < MEMORY_SIZE; address += 8) {
+        uint64_t have, want;
+        memcpy(&have, machine->memory + address, sizeof(have));
+        memcpy(&want, snapshot->memory + address, sizeof(want));
+        if(have == want) {
+            continue;
+        }
+        for(int i = address; i < address + 8; i++) {
+            write_memory(machine, i, snapshot->memory[i]);
+        }
+    }
+
+    memcpy(machine->display.rows, snapshot->display, sizeof(machine->display.rows));
+    machine->display.hires = snapshot->hires;
+    machine->planes = snapshot->planes;
+    memcpy(machine->flags, snapshot->flags, sizeof(machine->flags));
+    memcpy(machine->audio_pattern, snapshot->audio_pattern, sizeof(machine->audio_pattern));
+    machine->pitch = snapshot->pitch;
+    machine->dirty |= CHIP8_DIRTY_DISPLAY;
+    machine->stack.elements = snapshot->stack_depth <= STACK_SIZE ? snapshot->stack_depth : STACK_SIZE;
+    for(int i = 0; i < STACK_SIZE; i++) {
+        machine->stack.stack[i] = i < machine->stack.elements ? snapshot->stack[i] : 0;
+    }
+    machine->PC = snapshot->PC;
+    machine->I = snapshot->I;
+    memcpy(machine->registers, snapshot->registers, sizeof(machine->registers));
+    memcpy(machine->keypad, snapshot->keypad, sizeof(machine->keypad));
+    machine->delay_timer = snapshot->delay_timer;
+    machine->sound_timer = snapshot->sound_timer;
+    machine->status = snapshot->status;
+    machine->random_state = snapshot->random_state;
+    machine->draw_flag = true;
+    machine->effects++;
+}
+
+/*
+    File format, all integers little endian:
+    magic, version (uint32), size of the rest (uint32), then the fields
+    of chip8_snapshot in the order they are declared.
+*/
+
+#define STATE_HEADER_SIZE 12
+#define STATE_BODY_SIZE (DISPLAY_WORDS * 8 + 8 + MEMORY_SIZE + STACK_SIZE * 2 + 2 + 2 + 16 + 16 + 16 + 16 + 7)
+
+static unsigned char *put(unsigned char *out, uint64_t value, int bytes) {
+    for(int i = 0; i < bytes; i++) {
+        *out++ = value >> (i * 8);
+    }
+    return out;
+}
+
+static const unsigned char *get(const unsigned char *in, uint64_t *value, int bytes) {
+    *value = 0;
+    for(int i = 0; i < bytes; i++) {
+        *value |= (uint64_t) *in++ << (i * 8);
+    }
+    return in;
+}
+
+int chip8_write_state(FILE *file, const struct chip8_snapshot *snapshot) {
+    unsigned char buffer[STATE_HEADER_SIZE + STATE_BODY_SIZE];
+    unsigned char *out = buffer;
+
+    memcpy(out, CHIP8_STATE_MAGIC, 4);
+    out = put(out + 4, CHIP8_STATE_VERSION, 4);
+    out = put(out, STATE_BODY_SIZE, 4);
+
+    const uint64_t *display = &snapshot->display[0][0][0];
+    for(int i = 0; i < DISPLAY_WORDS; i++) {
+        out = put(out, display[i], 8);
+    }
+    out = put(out, snapshot->random_state, 8);
+    memcpy(out, snapshot->memory, MEMORY_SIZE);
+    out += MEMORY_SIZE;
+    for(int i = 0; i < STACK_SIZE; i++) {
+        out = put(out, snapshot->stack[i], 2);
+    }
+    out = put(out, snapshot->PC, 2);
+    out = put(out, snapshot->I, 2);
+    memcpy(out, snapshot->registers, 16);
+    memcpy(out + 16, snapshot->keypad, 16);
+    memcpy(out + 32, snapshot->flags, 16);
+    memcpy(out + 48, snapshot->audio_pattern, 16);
+    out += 64;
+    *out++ = snapshot->delay_timer;
+    *out++ = snapshot->sound_timer;
+    *out++ = snapshot->stack_depth;
+    *out++ = snapshot->status;
+    *out++ = snapshot->hires;
+    *out++ = snapshot->planes;
+    *out++ = snapshot->pitch;
+
+    return fwrite(buffer, 1, sizeof(buffer), file) == sizeof(buffer) ? 0 : -1;
+}
+
+int chip8_read_state(FILE *file, struct chip8_snapshot *snapshot) {
+    unsigned char buffer[STATE_HEADER_SIZE + STATE_BODY_SIZE];
+    const unsigned char *in = buffer;
+    uint64_t value;
+
+    if(fread(buffer, 1, STATE_HEADER_SIZE, file) != STATE_HEADER_SIZE || memcmp(in, CHIP8_STATE_MAGIC, 4) != 0) {
+        return -1;
+    }
+    in = get(in + 4, &value, 4);
+    if(value != CHIP8_STATE_VERSION) {
+        return -1;
+    }
+    in = get(in, &value, 4);
+    if(value != STATE_BODY_SIZE || fread(buffer + STATE_HEADER_SIZE, 1, STATE_BODY_SIZE, file) != STATE_BODY_SIZE) {
+        return -1;
+    }
+
+    uint64_t *display = &snapshot->display[0][0][0];
+    for(int i = 0; i < DISPLAY_WORDS; i++) {
+        in = get(in, &display[i], 8);
+    }
+    in = get(in, &snapshot->random_state, 8);
+    memcpy(snapshot->memory, in, MEMORY_SIZE);
+    in += MEMORY_SIZE;
+    for(int i = 0; i < STACK_SIZE; i++) {
+        in = get(in, &value, 2);
+        snapshot->stack[i] = value;
+    }
+    in = get(in, &value, 2);
+    snapshot->PC = value;
+    in = get(in, &value, 2);
+    snapshot->I = value;
+    memcpy(snapshot->registers, in, 16);
+    memcpy(snapshot->keypad, in + 16, 16);
+    memcpy(snapshot->flags, in + 32, 16);
+    memcpy(snapshot->audio_pattern, in + 48, 16);
+    in += 64;
+    snapshot->delay_timer = *in++;
+    snapshot->sound_timer = *in++;
+    snapshot->stack_depth = *in++;
+    snapshot->status = *in++;
+    if(snapshot->status > CHIP8_EXITED) {
+        return -1;
+    }
+    snapshot->hires = *in++ != 0;
+    snapshot->planes = *in++;
+    snapshot->pitch = *in++;
+    memset(snapshot->unused, 0, sizeof(snapshot->unused));
+    return 0;
+}
+
+/*
+    Delta encoding.
+    The XOR of two snapshots is mostly zero bytes. It is stored as pairs
+    of a zero run and a literal run, both lengths as varints, followed by
+    the literal bytes. A literal run ends at the first 4 zero bytes.
+*/
+
+#define SNAPSHOT_SIZE sizeof(struct chip8_snapshot)
+// Zero bytes that end a literal run.
+#define MIN_ZERO_RUN 4
+// Every pair covers at least MIN_ZERO_RUN + 1 bytes, apart from the
+// first and last, and costs at most 6 bytes more than its literals.
+#define MAX_DELTA_SIZE (SNAPSHOT_SIZE * 2 + 16)
+// Length before and after each delta in the ring.
+#define LENGTH_SIZE 4
+
+static unsigned char *put_varint(unsigned char *out, size_t value) {
+    while(value >= 0x80) {
+        *out++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+static const unsigned char *get_varint(const unsigned char *in, size_t *value) {
+    *value = 0;
+    for(int shift = 0; ; shift += 7) {
+        *value |= (size_t) (*in & 0x7F) << shift;
+        if(!(*in++ & 0x80)) {
+            return in;
+        }
+    }
+}
+
+// Encodes a ^ b into out. Returns the encoded length.
+static size_t encode_delta(const unsigned char *a, const unsigned char *b, unsigned char *out) {
+    unsigned char *start = out;
+    size_t i = 0;
+
+    while(i < SNAPSHOT_SIZE) {
+        size_t zeros = i;
+        while(zeros < SNAPSHOT_SIZE && a[zeros] == b[zeros]) {
+            zeros++;
+        }
+
+        size_t end = zeros;
+        size_t run = 0;
+        while(end < SNAPSHOT_SIZE && run < MIN_ZERO_RUN) {
+            run = a[end] == b[end] ? run + 1 : 0;
+            end++;
+        }
+        if(run == MIN_ZERO_RUN) {
+            end -= run;
+        }
+
+        out = put_varint(out, zeros - i);
+        out = put_varint(out, end - zeros);
+        for(size_t j = zeros; j < end; j++) {
+            *out++ = a[j] ^ b[j];
+        }
+        i = end;
+    }
+    return out - start;
+}
+
+// XORs an encoded delta into target.
+static void apply_delta(unsigned char *target, const unsigned char *in, size_t length) {
+    const unsigned char *end = in + length;
+    size_t i = 0;
+
+    while(in < end) {
+        size_t zeros, literals;
+        in = get_varint(in, &zeros);
+        in = get_varint(in, &literals);
+        i += zeros;
+        for(size_t j = 0; j < literals; j++) {
+            target[i++] ^= *in++;
+        }
+    }
+}
+
+static void ring_write(struct chip8_rewind *rewind, size_t offset, const unsigned char *data, size_t length) {
+    offset %= rewind->capacity;
+    size_t first = length < rewind->capacity - offset ? length : rewind->capacity - offset;
+    memcpy(rewind->ring + offset, data, first);
+    memcpy(rewind->ring, data + first, length - first);
+}
+
+static void ring_read(const struct chip8_rewind *rewind, size_t offset, unsigned char *data, size_t length) {
+    offset %= rewind->capacity;
+    size_t first = length < rewind->capacity - offset ? length : rewind->capacity - offset;
+    memcpy(data, rewind->ring + offset, first);
+    memcpy(data + first, rewind->ring, length - first);
+}
+
+static size_t ring_read_length(const struct chip8_rewind *rewind, size_t offset) {
+    unsigned char bytes[LENGTH_SIZE];
+    uint64_t length;
+    ring_read(rewind, offset, bytes, LENGTH_SIZE);
+    get(bytes, &length, LENGTH_SIZE);
+    return length;
+}
+
+int chip8_rewind_init(struct chip8_rewind *rewind, size_t capacity) {
+    memset(rewind, 0, sizeof(*rewind));
+    rewind->ring = malloc(capacity);
+    rewind->scratch = malloc(MAX_DELTA_SIZE);
+    if(capacity == 0 || rewind->ring == NULL || rewind->scratch == NULL) {
+        chip8_rewind_destroy(rewind);
+        return -1;
+    }
+    rewind->capacity = capacity;
+    return 0;
+}
+
+void chip8_rewind_destroy(struct chip8_rewind *rewind) {
+    free(rewind->ring);
+    free(rewind->scratch);
+    rewind->ring = NULL;
+    rewind->scratch = NULL;
+    rewind->capacity = 0;
+    rewind->used = 0;
+    rewind->deltas = 0;
+    rewind->has_newest = false;
+}
+
+void chip8_rewind_push(struct chip8_rewind *rewind, const struct chip8_machine *machine) {
+    struct chip8_snapshot snapshot;
+    chip8_save_state(machine, &snapshot);
+
+    if(!rewind->has_newest) {
+        rewind->newest = snapshot;
+        rewind->has_newest = true;
+        return;
+    }
+
+    size_t length = encode_delta((const unsigned char *) &rewind->newest, (const unsigned char *) &snapshot,
+                                 rewind->scratch);
+    size_t entry = length + 2 * LENGTH_SIZE;
+    if(entry > rewind->capacity) {
+        // Nothing older can be rebuilt without this delta.
+        rewind->head = 0;
+        rewind->used = 0;
+        rewind->deltas = 0;
+        rewind->newest = snapshot;
+        return;
+    }
+
+    while(rewind->capacity - rewind->used < entry) {
+        size_t oldest = ring_read_length(rewind, rewind->head) + 2 * LENGTH_SIZE;
+        rewind->head = (rewind->head + oldest) % rewind->capacity;
+        rewind->used -= oldest;
+        rewind->deltas--;
+    }
+
+    unsigned char length_bytes[LENGTH_SIZE];
+    put(length_bytes, length, LENGTH_SIZE);
+    size_t tail = rewind->head + rewind->used;
+    ring_write(rewind, tail, length_bytes, LENGTH_SIZE);
+    ring_write(rewind, tail + LENGTH_SIZE, rewind->scratch, length);
+    ring_write(rewind, tail + LENGTH_SIZE + length, length_bytes, LENGTH_SIZE);
+    rewind->used += entry;
+    rewind->deltas++;
+    rewind->newest = snapshot;
+}
+
+bool chip8_rewind_pop(struct chip8_rewind *rewind, struct chip8_machine *machine) {
+    // The newest state is the one the machine is in, step back from it.
+    if(rewind->deltas == 0) {
+        return false;
+    }
+
+    size_t tail = rewind->head + rewind->used;
+    size_t length = ring_read_length(rewind, tail - LENGTH_SIZE);
+    ring_read(rewind, tail - LENGTH_SIZE - length, rewind->scratch, length);
+    apply_delta((unsigned char *) &rewind->newest, rewind->scratch, length);
+    rewind->used -= length + 2 * LENGTH_SIZE;
+    rewind->deltas--;
+    chip8_load_state(machine, &rewind->newest);
+    return true;
+}
+
+long chip8_rewind_frames(const struct chip8_rewind *rewind) {
+    return rewind->deltas;
+}
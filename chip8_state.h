@@ -0,0 +1,82 @@
+#pragma once
+
+/*
+    Save states and rewind.
+    A snapshot is the complete state of a machine as one flat struct, so
+    it can be copied with memcpy. Files hold a snapshot behind a versioned
+    header, written field by field in little endian.
+    The rewind ring keeps one snapshot per frame as the run length encoded
+    XOR of it and the next newer one, so a frame costs a few bytes when
+    little changes.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "./chip8.h"
+
+#define CHIP8_STATE_MAGIC "C8ST"
+#define CHIP8_STATE_VERSION 4
+
+// Widest fields first, so there is no padding to leave uninitialised.
+struct chip8_snapshot {
+    uint64_t display[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][CHIP8_ROW_WORDS];
+    uint64_t random_state;
+    uint8_t memory[MEMORY_SIZE];
+    uint16_t stack[STACK_SIZE];
+    uint16_t PC;
+    uint16_t I;
+    uint8_t registers[16];
+    uint8_t keypad[16];
+    uint8_t flags[16];
+    uint8_t audio_pattern[CHIP8_AUDIO_PATTERN_SIZE];
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t stack_depth;
+    uint8_t status;
+    uint8_t hires;
+    uint8_t planes;
+    uint8_t pitch;
+    // Rounds the size up to a whole uint64_t.
+    uint8_t unused[5];
+};
+
+void chip8_save_state(const struct chip8_machine *machine, struct chip8_snapshot *snapshot);
+// Only the instructions at addresses whose memory changed are decoded again.
+void chip8_load_state(struct chip8_machine *machine, const struct chip8_snapshot *snapshot);
+
+// Return 0, or -1 on an I/O error or, when reading, a file of another format or version
+// or with a status no machine can be in.
+int chip8_write_state(FILE *file, const struct chip8_snapshot *snapshot);
+int chip8_read_state(FILE *file, struct chip8_snapshot *snapshot);
+
+struct chip8_rewind {
+    // Ring of deltas, oldest first. Each is its payload length, the
+    // payload, and the length again so the newest can be found from the end.
+    unsigned char *ring;
+    size_t capacity;
+    size_t head;
+    size_t used;
+    // Deltas in the ring.
+    long deltas;
+
+    // The newest snapshot. Older ones are rebuilt from it.
+    struct chip8_snapshot newest;
+    bool has_newest;
+
+    // Room for encoding one delta.
+    unsigned char *scratch;
+};
+
+// `capacity` is the size of the ring in bytes. Returns -1 on failure.
+int chip8_rewind_init(struct chip8_rewind *rewind, size_t capacity);
+void chip8_rewind_destroy(struct chip8_rewind *rewind);
+
+// Records the machine's state. The oldest states are dropped when the ring is full.
+void chip8_rewind_push(struct chip8_rewind *rewind, const struct chip8_machine *machine);
+// Forgets the newest recorded state, the one the machine was left in, and
+// restores the one recorded before it. Returns false if there is none.
+bool chip8_rewind_pop(struct chip8_rewind *rewind, struct chip8_machine *machine);
+// How many states can be popped.
+long chip8_rewind_frames(const struct chip8_rewind *rewind);
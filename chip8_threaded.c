@@ -0,0 +1,179 @@
+// Direct threaded dispatch engine.
+// Needs the labels-as-values extension (GCC/Clang), otherwise it runs the call engine.
+
+#include "./chip8.h"
+#include "./chip8_ops.h"
+#include "./chip8_trace.h"
+
+#if defined(__GNUC__)
+
+long chip8_run_threaded(struct chip8_machine *machine, long cycles) {
+    // One table per quirk profile, jumping to that profile's variants.
+    #define LABELS(quirks) {                  \
+        [CHIP8_OP_INVALID] = &&l_invalid,     \
+        [CHIP8_OP_NOP] = &&l_nop,             \
+        [CHIP8_OP_00E0] = &&l_00e0,           \
+        [CHIP8_OP_00EE] = &&l_00ee,           \
+        [CHIP8_OP_00CN] = &&l_00cn,           \
+        [CHIP8_OP_00DN] = &&l_00dn,           \
+        [CHIP8_OP_00FB] = &&l_00fb,           \
+        [CHIP8_OP_00FC] = &&l_00fc,           \
+        [CHIP8_OP_00FD] = &&l_00fd,           \
+        [CHIP8_OP_00FE] = &&l_00fe,           \
+        [CHIP8_OP_00FF] = &&l_00ff,           \
+        [CHIP8_OP_1NNN] = &&l_1nnn,           \
+        [CHIP8_OP_2NNN] = &&l_2nnn,           \
+        [CHIP8_OP_3XNN] = &&l_3xnn,           \
+        [CHIP8_OP_4XNN] = &&l_4xnn,           \
+        [CHIP8_OP_5XY0] = &&l_5xy0,           \
+        [CHIP8_OP_5XY2] = &&l_5xy2,           \
+        [CHIP8_OP_5XY3] = &&l_5xy3,           \
+        [CHIP8_OP_6XNN] = &&l_6xnn,           \
+        [CHIP8_OP_7XNN] = &&l_7xnn,           \
+        [CHIP8_OP_8XY0] = &&l_8xy0,           \
+        [CHIP8_OP_8XY1] = &&l_8xy1_##quirks,  \
+        [CHIP8_OP_8XY2] = &&l_8xy2_##quirks,  \
+        [CHIP8_OP_8XY3] = &&l_8xy3_##quirks,  \
+        [CHIP8_OP_8XY4] = &&l_8xy4,           \
+        [CHIP8_OP_8XY5] = &&l_8xy5,           \
+        [CHIP8_OP_8XY6] = &&l_8xy6_##quirks,  \
+        [CHIP8_OP_8XY7] = &&l_8xy7,           \
+        [CHIP8_OP_8XYE] = &&l_8xye_##quirks,  \
+        [CHIP8_OP_9XY0] = &&l_9xy0,           \
+        [CHIP8_OP_ANNN] = &&l_annn,           \
+        [CHIP8_OP_BNNN] = &&l_bnnn,           \
+        [CHIP8_OP_CXNN] = &&l_cxnn,           \
+        [CHIP8_OP_DXYN] = &&l_dxyn,           \
+        [CHIP8_OP_EX9E] = &&l_ex9e,           \
+        [CHIP8_OP_EXA1] = &&l_exa1,           \
+        [CHIP8_OP_FN01] = &&l_fn01,           \
+        [CHIP8_OP_F002] = &&l_f002,           \
+        [CHIP8_OP_FX07] = &&l_fx07,           \
+        [CHIP8_OP_FX0A] = &&l_fx0a,           \
+        [CHIP8_OP_FX15] = &&l_fx15,           \
+        [CHIP8_OP_FX18] = &&l_fx18,           \
+        [CHIP8_OP_FX1E] = &&l_fx1e,           \
+        [CHIP8_OP_FX29] = &&l_fx29,           \
+        [CHIP8_OP_FX30] = &&l_fx30,           \
+        [CHIP8_OP_FX33] = &&l_fx33,           \
+        [CHIP8_OP_FX3A] = &&l_fx3a,           \
+        [CHIP8_OP_FX55] = &&l_fx55_##quirks,  \
+        [CHIP8_OP_FX65] = &&l_fx65_##quirks,  \
+        [CHIP8_OP_FX75] = &&l_fx75,           \
+        [CHIP8_OP_FX85] = &&l_fx85,           \
+        }
+    static void *const labels[CHIP8_QUIRKS_COUNT][CHIP8_OP_COUNT] = {
+        [CHIP8_QUIRKS_VIP] = LABELS(vip),
+        [CHIP8_QUIRKS_SCHIP] = LABELS(schip),
+        [CHIP8_QUIRKS_XOCHIP] = LABELS(xochip),
+    };
+    #undef LABELS
+    // With a trace attached every instruction goes through l_traced, so
+    // an untraced run pays nothing for it.
+    static void *const traced[CHIP8_OP_COUNT] = { [0 ... CHIP8_OP_COUNT - 1] = &&l_traced };
+    void *const *table = machine->trace != NULL ? traced : labels[machine->quirks];
+
+    struct chip8_decoded uncached;
+    const struct chip8_decoded *d;
+    long executed = 0;
+
+    // Every handler ends in its own copy of this, so each instruction
+    // gets its own indirect jump instead of sharing one at the loop head.
+    #define DISPATCH() \
+        do { \
+            if(executed >= cycles || machine->status != CHIP8_OK) { \
+                goto done; \
+            } \
+            executed++; \
+            d = fetch_decoded(machine, &uncached); \
+            goto *table[d->op]; \
+        } while(0)
+
+    DISPATCH();
+
+    l_invalid:     op_invalid(machine, d);       DISPATCH();
+    l_nop:         op_nop(machine, d);           DISPATCH();
+    l_00e0:        op_00e0(machine, d);          DISPATCH();
+    l_00ee:        op_00ee(machine, d);          DISPATCH();
+    l_00cn:        op_00cn(machine, d);          DISPATCH();
+    l_00dn:        op_00dn(machine, d);          DISPATCH();
+    l_00fb:        op_00fb(machine, d);          DISPATCH();
+    l_00fc:        op_00fc(machine, d);          DISPATCH();
+    l_00fd:        op_00fd(machine, d);          DISPATCH();
+    l_00fe:        op_00fe(machine, d);          DISPATCH();
+    l_00ff:        op_00ff(machine, d);          DISPATCH();
+    l_1nnn:        op_1nnn(machine, d);          DISPATCH();
+    l_2nnn:        op_2nnn(machine, d);          DISPATCH();
+    l_3xnn:        op_3xnn(machine, d);          DISPATCH();
+    l_4xnn:        op_4xnn(machine, d);          DISPATCH();
+    l_5xy0:        op_5xy0(machine, d);          DISPATCH();
+    l_5xy2:        op_5xy2(machine, d);          DISPATCH();
+    l_5xy3:        op_5xy3(machine, d);          DISPATCH();
+    l_6xnn:        op_6xnn(machine, d);          DISPATCH();
+    l_7xnn:        op_7xnn(machine, d);          DISPATCH();
+    l_8xy0:        op_8xy0(machine, d);          DISPATCH();
+    l_8xy1_vip:    op_8xy1_vip(machine, d);      DISPATCH();
+    l_8xy1_schip:  op_8xy1_schip(machine, d);    DISPATCH();
+    l_8xy1_xochip: op_8xy1_xochip(machine, d);   DISPATCH();
+    l_8xy2_vip:    op_8xy2_vip(machine, d);      DISPATCH();
+    l_8xy2_schip:  op_8xy2_schip(machine, d);    DISPATCH();
+    l_8xy2_xochip: op_8xy2_xochip(machine, d);   DISPATCH();
+    l_8xy3_vip:    op_8xy3_vip(machine, d);      DISPATCH();
+    l_8xy3_schip:  op_8xy3_schip(machine, d);    DISPATCH();
+    l_8xy3_xochip: op_8xy3_xochip(machine, d);   DISPATCH();
+    l_8xy4:        op_8xy4(machine, d);          DISPATCH();
+    l_8xy5:        op_8xy5(machine, d);          DISPATCH();
+    l_8xy6_vip:    op_8xy6_vip(machine, d);      DISPATCH();
+    l_8xy6_schip:  op_8xy6_schip(machine, d);    DISPATCH();
+    l_8xy6_xochip: op_8xy6_xochip(machine, d);   DISPATCH();
+    l_8xy7:        op_8xy7(machine, d);          DISPATCH();
+    l_8xye_vip:    op_8xye_vip(machine, d);      DISPATCH();
+    l_8xye_schip:  op_8xye_schip(machine, d);    DISPATCH();
+    l_8xye_xochip: op_8xye_xochip(machine, d);   DISPATCH();
+    l_9xy0:        op_9xy0(machine, d);          DISPATCH();
+    l_annn:        op_annn(machine, d);          DISPATCH();
+    l_bnnn:        op_bnnn(machine, d);          DISPATCH();
+    l_cxnn:        op_cxnn(machine, d);          DISPATCH();
+    l_dxyn:        op_dxyn(machine, d);          DISPATCH();
+    l_ex9e:        op_ex9e(machine, d);          DISPATCH();
+    l_exa1:        op_exa1(machine, d);          DISPATCH();
+    l_fn01:        op_fn01(machine, d);          DISPATCH();
+    l_f002:        op_f002(machine, d);          DISPATCH();
+    l_fx07:        op_fx07(machine, d);          DISPATCH();
+    l_fx0a:        op_fx0a(machine, d);          DISPATCH();
+    l_fx15:        op_fx15(machine, d);          DISPATCH();
+    l_fx18:        op_fx18(machine, d);          DISPATCH();
+    l_fx1e:        op_fx1e(machine, d);          DISPATCH();
+    l_fx29:        op_fx29(machine, d);          DISPATCH();
+    l_fx30:        op_fx30(machine, d);          DISPATCH();
+    l_fx33:        op_fx33(machine, d);          DISPATCH();
+    l_fx3a:        op_fx3a(machine, d);          DISPATCH();
+    l_fx55_vip:    op_fx55_vip(machine, d);      DISPATCH();
+    l_fx55_schip:  op_fx55_schip(machine, d);    DISPATCH();
+    l_fx55_xochip: op_fx55_xochip(machine, d);   DISPATCH();
+    l_fx65_vip:    op_fx65_vip(machine, d);      DISPATCH();
+    l_fx65_schip:  op_fx65_schip(machine, d);    DISPATCH();
+    l_fx65_xochip: op_fx65_xochip(machine, d);   DISPATCH();
+    l_fx75:        op_fx75(machine, d);          DISPATCH();
+    l_fx85:        op_fx85(machine, d);          DISPATCH();
+
+    // PC has already moved past the instruction.
+    l_traced:      chip8_trace_step(machine->trace, machine, (machine->PC - 2) & (MEMORY_SIZE - 1), d); DISPATCH();
+
+done:
+    #undef DISPATCH
+    return executed;
+}
+
+#else
+
+long chip8_run_threaded(struct chip8_machine *machine, long cycles) {
+    long executed = 0;
+    while(executed < cycles && machine->status == CHIP8_OK) {
+        chip8_step(machine);
+        executed++;
+    }
+    return executed;
+}
+
+#endif
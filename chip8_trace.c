@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "./chip8_trace.h"
+
+void chip8_trace_init(struct chip8_trace *trace) {
+    memset(trace, 0, sizeof(struct chip8_trace));
+}
+
+int chip8_trace_copy(const struct chip8_trace *trace, struct chip8_trace_entry *entries, int max) {
+    uint64_t end = __atomic_load_n(&trace->count, __ATOMIC_ACQUIRE);
+    uint64_t start = end > (uint64_t) max ? end - max : 0;
+    if(end - start > CHIP8_TRACE_SIZE) {
+        start = end - CHIP8_TRACE_SIZE;
+    }
+    for(uint64_t n = start; n < end; n++) {
+        entries[n - start] = trace->entries[n & (CHIP8_TRACE_SIZE - 1)];
+    }
+    // The writer may have lapped the oldest entries while they were copied.
+    // The fence keeps the copy above from moving past the load of count.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t now = __atomic_load_n(&trace->count, __ATOMIC_RELAXED);
+    // Entry `now` is being written, in the slot of entry now - CHIP8_TRACE_SIZE.
+    uint64_t valid = now + 1 > CHIP8_TRACE_SIZE ? now + 1 - CHIP8_TRACE_SIZE : 0;
+    if(valid > end) {
+        return 0;
+    }
+    if(valid > start) {
+        memmove(entries, entries + (valid - start), (end - valid) * sizeof(struct chip8_trace_entry));
+        start = valid;
+    }
+    return end - start;
+}
+
+void chip8_trace_dump_text(const struct chip8_trace *trace, const struct chip8_machine *machine, FILE *file) {
+    struct chip8_trace_entry *entries = malloc(CHIP8_TRACE_SIZE * sizeof(struct chip8_trace_entry));
+    // Without memory for the copy, the rest is still worth having.
+    int count = entries != NULL ? chip8_trace_copy(trace, entries, CHIP8_TRACE_SIZE) : 0;
+
+    fprintf(file, "Machine halted on %s, PC 0x%03x\n", chip8_status_name(machine->status), machine->PC);
+    fprintf(file, "Last %d instructions, oldest first:\n", count);
+    for(int i = 0; i < count; i++) {
+        const struct chip8_trace_entry *entry = &entries[i];
+        fprintf(file, "  0x%03x  %04x  I=0x%03x", entry->PC, entry->opcode, entry->I);
+        if(entry->reg != CHIP8_TRACE_NO_REGISTER) {
+            fprintf(file, "  V%X=0x%02x", entry->reg, entry->value);
+        }
+        fprintf(file, "\n");
+    }
+
+    // The stack holds return addresses, the calls are just before them.
+    fprintf(file, "Call stack, innermost first:\n");
+    for(int i = machine->stack.elements - 1; i >= 0; i--) {
+        fprintf(file, "  0x%03x called from 0x%03x\n", machine->stack.stack[i], machine->stack.stack[i] - 2);
+    }
+    if(machine->stack.elements == 0) {
+        fprintf(file, "  (empty)\n");
+    }
+    free(entries);
+}
+
+static void put_u16(unsigned char *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void put_u32(unsigned char *out, uint32_t value) {
+    put_u16(out, value);
+    put_u16(out + 2, value >> 16);
+}
+
+int chip8_trace_dump_binary(const struct chip8_trace *trace, const struct chip8_machine *machine, FILE *file) {
+    struct chip8_trace_entry *entries = malloc(CHIP8_TRACE_SIZE * sizeof(struct chip8_trace_entry));
+    if(entries == NULL) {
+        return -1;
+    }
+    int count = chip8_trace_copy(trace, entries, CHIP8_TRACE_SIZE);
+
+    unsigned char header[16];
+    memcpy(header, CHIP8_TRACE_MAGIC, 4);
+    put_u32(header + 4, CHIP8_TRACE_VERSION);
+    put_u32(header + 8, machine->status);
+    put_u16(header + 12, machine->PC);
+    put_u16(header + 14, machine->stack.elements);
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+
+    for(int i = 0; i < machine->stack.elements; i++) {
+        unsigned char address[2];
+        put_u16(address, machine->stack.stack[i]);
+        ok = ok && fwrite(address, sizeof(address), 1, file) == 1;
+    }
+
+    unsigned char size[4];
+    put_u32(size, count);
+    ok = ok && fwrite(size, sizeof(size), 1, file) == 1;
+    for(int i = 0; i < count; i++) {
+        unsigned char record[8];
+        put_u16(record, entries[i].PC);
+        put_u16(record + 2, entries[i].opcode);
+        put_u16(record + 4, entries[i].I);
+        record[6] = entries[i].reg;
+        record[7] = entries[i].value;
+        ok = ok && fwrite(record, sizeof(record), 1, file) == 1;
+    }
+    free(entries);
+    return ok ? 0 : -1;
+}
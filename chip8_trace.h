@@ -0,0 +1,98 @@
+#pragma once
+
+/*
+    Execution trace.
+    A fixed ring of the last CHIP8_TRACE_SIZE instructions a machine ran:
+    where, which, I after it, and the register it wrote. Recording one is a
+    few stores, so a trace can stay attached in release builds and be
+    dumped, with the call stack, when the machine halts on a fault.
+
+    The machine is the only writer. It fills in an entry, then publishes
+    it by bumping `count` with a release store, so another thread can copy
+    the trace out with chip8_trace_copy while the machine runs.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "./chip8.h"
+
+// Entries kept. Must be a power of two.
+#ifndef CHIP8_TRACE_SIZE
+#define CHIP8_TRACE_SIZE 1024
+#endif
+
+#define CHIP8_TRACE_MAGIC "C8TR"
+#define CHIP8_TRACE_VERSION 1
+
+// No register written by the instruction.
+#define CHIP8_TRACE_NO_REGISTER 0xFF
+
+struct chip8_trace_entry {
+    uint16_t PC;
+    uint16_t opcode;
+    uint16_t I;
+    // The register the instruction wrote, and its value after. Loads of a
+    // range (5XY3, FX65, FX85) record only the last register loaded.
+    uint8_t reg;
+    uint8_t value;
+};
+
+struct chip8_trace {
+    // Instructions recorded so far. Entry n is at entries[n % CHIP8_TRACE_SIZE].
+    uint64_t count;
+    struct chip8_trace_entry entries[CHIP8_TRACE_SIZE];
+};
+
+// Ops that write VX. DXYN writes VF, the others that set VF also write VX.
+#define CHIP8_TRACE_WRITES_VX                                                                                   \
+    (1ULL << CHIP8_OP_5XY3 | 1ULL << CHIP8_OP_6XNN | 1ULL << CHIP8_OP_7XNN | 1ULL << CHIP8_OP_8XY0 | 1ULL << CHIP8_OP_8XY1 |            \
+     1ULL << CHIP8_OP_8XY2 | 1ULL << CHIP8_OP_8XY3 | 1ULL << CHIP8_OP_8XY4 | 1ULL << CHIP8_OP_8XY5 |            \
+     1ULL << CHIP8_OP_8XY6 | 1ULL << CHIP8_OP_8XY7 | 1ULL << CHIP8_OP_8XYE | 1ULL << CHIP8_OP_CXNN |            \
+     1ULL << CHIP8_OP_FX07 | 1ULL << CHIP8_OP_FX0A | 1ULL << CHIP8_OP_FX65 | 1ULL << CHIP8_OP_FX85)
+
+void chip8_trace_init(struct chip8_trace *trace);
+
+// Runs one decoded instruction at PC and records it. Called by chip8_step
+// and the threaded engine.
+static inline void chip8_trace_step(struct chip8_trace *trace, struct chip8_machine *machine, unsigned short PC,
+                                    const struct chip8_decoded *d) {
+    uint64_t count = trace->count;
+    struct chip8_trace_entry *entry = &trace->entries[count & (CHIP8_TRACE_SIZE - 1)];
+    // Read before running, the instruction may overwrite itself.
+    entry->opcode = machine->memory[PC] << 8 | machine->memory[(PC + 1) & (MEMORY_SIZE - 1)];
+    d->handler(machine, d);
+    entry->PC = PC;
+    entry->I = machine->I;
+    if(d->op == CHIP8_OP_DXYN) {
+        entry->reg = 0xF;
+    } else if((CHIP8_TRACE_WRITES_VX >> d->op) & 1) {
+        // 5XY3 loads VX to VY, in that order.
+        entry->reg = d->op == CHIP8_OP_5XY3 ? d->Y : d->X;
+    } else {
+        entry->reg = CHIP8_TRACE_NO_REGISTER;
+    }
+    entry->value = entry->reg == CHIP8_TRACE_NO_REGISTER ? 0 : machine->registers[entry->reg];
+    __atomic_store_n(&trace->count, count + 1, __ATOMIC_RELEASE);
+}
+
+/*
+    Copies up to `max` of the latest entries to `entries`, oldest first.
+    Safe to call from another thread while the machine runs; entries
+    overwritten during the copy are left out.
+    Returns how many were copied.
+*/
+int chip8_trace_copy(const struct chip8_trace *trace, struct chip8_trace_entry *entries, int max);
+
+// The trace, the machine's status and its call stack, as text.
+void chip8_trace_dump_text(const struct chip8_trace *trace, const struct chip8_machine *machine, FILE *file);
+
+/*
+    The same as chip8_trace_dump_text, all integers little endian:
+    magic, version (uint32), status (uint32), PC (uint16), stack depth
+    (uint16), the return addresses on the stack (uint16 each, outermost
+    first), entry count (uint32), then the entries oldest first, each
+    PC, opcode, I (uint16) and register, value (uint8).
+    Returns -1 on an I/O error.
+*/
+int chip8_trace_dump_binary(const struct chip8_trace *trace, const struct chip8_machine *machine, FILE *file);
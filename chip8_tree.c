@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "./chip8_tree.h"
+#include "./chip8_ops.h"
+
+// Nodes, pages or frames allocated at a time.
+#define BLOCK_ITEMS 256
+
+static void *allocate_block(struct chip8_tree *tree, size_t size) {
+    void **blocks = realloc(tree->blocks, sizeof(void *) * (tree->block_count + 1));
+    if(blocks == NULL) {
+        return NULL;
+    }
+    tree->blocks = blocks;
+
+    void *block = malloc(size * BLOCK_ITEMS);
+    if(block != NULL) {
+        tree->blocks[tree->block_count++] = block;
+    }
+    return block;
+}
+
+// The three free lists work the same way, on different types.
+#define TAKE_FREE(tree, list, type) ({                                   \
+    if((tree)->list == NULL) {                                           \
+        type *block_ = allocate_block((tree), sizeof(type));             \
+        for(int i_ = 0; block_ != NULL && i_ < BLOCK_ITEMS; i_++) {      \
+            block_[i_].next_free = (tree)->list;                         \
+            (tree)->list = &block_[i_];                                  \
+        }                                                                \
+    }                                                                    \
+    type *item_ = (tree)->list;                                          \
+    if(item_ != NULL) {                                                  \
+        (tree)->list = item_->next_free;                                 \
+    }                                                                    \
+    item_;                                                               \
+})
+
+static struct chip8_page *new_page(struct chip8_tree *tree) {
+    struct chip8_page *page = TAKE_FREE(tree, free_pages, struct chip8_page);
+    if(page != NULL) {
+        page->refs = 1;
+        tree->pages++;
+    }
+    return page;
+}
+
+static struct chip8_frame *new_frame(struct chip8_tree *tree) {
+    struct chip8_frame *frame = TAKE_FREE(tree, free_frames, struct chip8_frame);
+    if(frame != NULL) {
+        frame->refs = 1;
+    }
+    return frame;
+}
+
+static void release_page(struct chip8_tree *tree, struct chip8_page *page) {
+    if(page != NULL && --page->refs == 0) {
+        page->next_free = tree->free_pages;
+        tree->free_pages = page;
+        tree->pages--;
+    }
+}
+
+static void release_frame(struct chip8_tree *tree, struct chip8_frame *frame) {
+    if(frame != NULL && --frame->refs == 0) {
+        frame->next_free = tree->free_frames;
+        tree->free_frames = frame;
+    }
+}
+
+void chip8_tree_init(struct chip8_tree *tree, struct chip8_machine *machine) {
+    memset(tree, 0, sizeof(*tree));
+    tree->machine = machine;
+    // Nothing is mirrored yet, so the first capture copies everything.
+    machine->dirty = ~0u;
+}
+
+void chip8_tree_destroy(struct chip8_tree *tree) {
+    for(int i = 0; i < tree->block_count; i++) {
+        free(tree->blocks[i]);
+    }
+    free(tree->blocks);
+    memset(tree->mirrors, 0, sizeof(tree->mirrors));
+    tree->display_mirror = NULL;
+    tree->blocks = NULL;
+    tree->block_count = 0;
+    tree->free_nodes = NULL;
+    tree->free_pages = NULL;
+    tree->free_frames = NULL;
+    tree->nodes = 0;
+    tree->pages = 0;
+    if(tree->machine != NULL) {
+        tree->machine->dirty = ~0u;
+    }
+}
+
+struct chip8_node *chip8_tree_capture(struct chip8_tree *tree) {
+    struct chip8_machine *machine = tree->machine;
+    struct chip8_page *written[CHIP8_PAGES] = { NULL };
+    struct chip8_frame *display = NULL;
+
+    // Allocate everything first, so running out of memory leaves the mirrors as they were.
+    // New pages start with the reference of the mirror, the node takes another.
+    struct chip8_node *node = TAKE_FREE(tree, free_nodes, struct chip8_node);
+    bool failed = node == NULL;
+    for(int p = 0; !failed && p < CHIP8_PAGES; p++) {
+        if(machine->dirty & (1u << p)) {
+            written[p] = new_page(tree);
+            failed = written[p] == NULL;
+        }
+    }
+    if(!failed && machine->dirty & CHIP8_DIRTY_DISPLAY) {
+        display = new_frame(tree);
+        failed = display == NULL;
+    }
+    if(failed) {
+        for(int p = 0; p < CHIP8_PAGES; p++) {
+            release_page(tree, written[p]);
+        }
+        release_frame(tree, display);
+        if(node != NULL) {
+            node->next_free = tree->free_nodes;
+            tree->free_nodes = node;
+        }
+        return NULL;
+    }
+
+    for(int p = 0; p < CHIP8_PAGES; p++) {
+        if(written[p] != NULL) {
+            memcpy(written[p]->bytes, machine->memory + p * CHIP8_PAGE_SIZE, CHIP8_PAGE_SIZE);
+            release_page(tree, tree->mirrors[p]);
+            tree->mirrors[p] = written[p];
+        }
+        node->pages[p] = tree->mirrors[p];
+        node->pages[p]->refs++;
+    }
+    if(display != NULL) {
+        memcpy(&display->display, &machine->display, sizeof(display->display));
+        release_frame(tree, tree->display_mirror);
+        tree->display_mirror = display;
+    }
+    node->display = tree->display_mirror;
+    node->display->refs++;
+    machine->dirty = 0;
+
+    memcpy(node->registers, machine->registers, sizeof(node->registers));
+    node->PC = machine->PC;
+    node->I = machine->I;
+    node->delay_timer = machine->delay_timer;
+    node->sound_timer = machine->sound_timer;
+    memcpy(node->keypad, machine->keypad, sizeof(node->keypad));
+    node->planes = machine->planes;
+    memcpy(node->flags, machine->flags, sizeof(node->flags));
+    memcpy(node->audio_pattern, machine->audio_pattern, sizeof(node->audio_pattern));
+    node->pitch = machine->pitch;
+    node->status = machine->status;
+    node->random_state = machine->random_state;
+    node->stack = machine->stack;
+    tree->nodes++;
+    return node;
+}
+
+struct chip8_node *chip8_tree_fork(struct chip8_tree *tree, const struct chip8_node *node) {
+    struct chip8_node *child = TAKE_FREE(tree, free_nodes, struct chip8_node);
+    if(child == NULL) {
+        return NULL;
+    }
+    *child = *node;
+    for(int p = 0; p < CHIP8_PAGES; p++) {
+        child->pages[p]->refs++;
+    }
+    child->display->refs++;
+    tree->nodes++;
+    return child;
+}
+
+void chip8_tree_enter(struct chip8_tree *tree, const struct chip8_node *node) {
+    struct chip8_machine *machine = tree->machine;
+
+    for(int p = 0; p < CHIP8_PAGES; p++) {
+        struct chip8_page *page = node->pages[p];
+        if(tree->mirrors[p] == page && !(machine->dirty & (1u << p))) {
+            continue;
+        }
+        // Only the bytes that differ, so instructions elsewhere in the page stay decoded.
+        unsigned char *memory = machine->memory + p * CHIP8_PAGE_SIZE;
+        if(memcmp(memory, page->bytes, CHIP8_PAGE_SIZE) != 0) {
+            for(int i = 0; i < CHIP8_PAGE_SIZE; i++) {
+                write_memory(machine, p * CHIP8_PAGE_SIZE + i, page->bytes[i]);
+            }
+        }
+        page->refs++;
+        release_page(tree, tree->mirrors[p]);
+        tree->mirrors[p] = page;
+    }
+
+    if(tree->display_mirror != node->display || machine->dirty & CHIP8_DIRTY_DISPLAY) {
+        memcpy(&machine->display, &node->display->display, sizeof(machine->display));
+        machine->draw_flag = true;
+        node->display->refs++;
+        release_frame(tree, tree->display_mirror);
+        tree->display_mirror = node->display;
+    }
+    machine->dirty = 0;
+
+    memcpy(machine->registers, node->registers, sizeof(machine->registers));
+    machine->PC = node->PC;
+    machine->I = node->I;
+    machine->delay_timer = node->delay_timer;
+    machine->sound_timer = node->sound_timer;
+    memcpy(machine->keypad, node->keypad, sizeof(machine->keypad));
+    machine->planes = node->planes;
+    memcpy(machine->flags, node->flags, sizeof(machine->flags));
+    memcpy(machine->audio_pattern, node->audio_pattern, sizeof(machine->audio_pattern));
+    machine->pitch = node->pitch;
+    machine->status = node->status;
+    machine->random_state = node->random_state;
+    machine->stack = node->stack;
+    machine->effects++;
+}
+
+void chip8_tree_release(struct chip8_tree *tree, struct chip8_node *node) {
+    for(int p = 0; p < CHIP8_PAGES; p++) {
+        release_page(tree, node->pages[p]);
+    }
+    release_frame(tree, node->display);
+    node->next_free = tree->free_nodes;
+    tree->free_nodes = node;
+    tree->nodes--;
+}
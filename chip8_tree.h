@@ -0,0 +1,81 @@
+#pragma once
+
+/*
+    Forkable machine states for tree search.
+    A node holds the registers, stack, timers and keypad of a state, and
+    shares its memory pages and display with the nodes it was forked
+    from. Forking a node copies only the registers and takes a reference
+    on each page.
+    Nodes are run by entering them into the tree's working machine, which
+    copies in only the pages that differ from what it holds. Capturing the
+    machine as a new node copies only the pages it has written since.
+    A tree is not thread safe. Use one per thread.
+*/
+
+#include "./chip8.h"
+
+struct chip8_page {
+    int refs;
+    struct chip8_page *next_free;
+    unsigned char bytes[CHIP8_PAGE_SIZE];
+};
+
+struct chip8_frame {
+    int refs;
+    struct chip8_frame *next_free;
+    struct chip8_display display;
+};
+
+struct chip8_node {
+    unsigned char registers[16];
+    unsigned short PC;
+    unsigned short I;
+    unsigned char delay_timer;
+    unsigned char sound_timer;
+    unsigned char keypad[16];
+    unsigned char planes;
+    unsigned char flags[16];
+    unsigned char audio_pattern[CHIP8_AUDIO_PATTERN_SIZE];
+    unsigned char pitch;
+    enum chip8_status status;
+    uint64_t random_state;
+    struct Stack stack;
+
+    struct chip8_page *pages[CHIP8_PAGES];
+    struct chip8_frame *display;
+
+    struct chip8_node *next_free;
+};
+
+struct chip8_tree {
+    // Runs the nodes. Change it only by running it or entering nodes.
+    struct chip8_machine *machine;
+    // What the working machine's pages and display hold, where their
+    // bit in machine->dirty is clear. Each holds a reference.
+    struct chip8_page *mirrors[CHIP8_PAGES];
+    struct chip8_frame *display_mirror;
+
+    struct chip8_node *free_nodes;
+    struct chip8_page *free_pages;
+    struct chip8_frame *free_frames;
+    // Every block allocated, freed by chip8_tree_destroy.
+    void **blocks;
+    int block_count;
+
+    // Live nodes and pages, for seeing how much is shared.
+    long nodes;
+    long pages;
+};
+
+// The tree takes over `machine` as its working machine, as it is now.
+void chip8_tree_init(struct chip8_tree *tree, struct chip8_machine *machine);
+// Frees every node and page. The working machine stays with the caller.
+void chip8_tree_destroy(struct chip8_tree *tree);
+
+// Makes a node of the working machine's state. Returns NULL if out of memory.
+struct chip8_node *chip8_tree_capture(struct chip8_tree *tree);
+// Makes a copy of a node that shares its pages. Returns NULL if out of memory.
+struct chip8_node *chip8_tree_fork(struct chip8_tree *tree, const struct chip8_node *node);
+// Loads a node into the working machine.
+void chip8_tree_enter(struct chip8_tree *tree, const struct chip8_node *node);
+void chip8_tree_release(struct chip8_tree *tree, struct chip8_node *node);
@@ -0,0 +1,27 @@
+#include <string.h>
+
+#include "./chip8_triple.h"
+
+void chip8_triple_init(struct chip8_triple *triple) {
+    memset(triple, 0, sizeof(*triple));
+    triple->write = 0;
+    triple->middle = 1;
+    triple->read = 2;
+}
+
+void chip8_triple_publish(struct chip8_triple *triple) {
+    // Release the frame written, acquire the slot given back, which the
+    // consumer may have just finished reading.
+    unsigned previous = __atomic_exchange_n(&triple->middle, triple->write | CHIP8_TRIPLE_FRESH, __ATOMIC_ACQ_REL);
+    triple->write = previous & ~CHIP8_TRIPLE_FRESH;
+}
+
+const struct chip8_triple_frame *chip8_triple_acquire(struct chip8_triple *triple) {
+    if(!(__atomic_load_n(&triple->middle, __ATOMIC_RELAXED) & CHIP8_TRIPLE_FRESH)) {
+        return NULL;
+    }
+    // Only the producer sets the bit, so the middle is still fresh here.
+    unsigned previous = __atomic_exchange_n(&triple->middle, triple->read, __ATOMIC_ACQ_REL);
+    triple->read = previous & ~CHIP8_TRIPLE_FRESH;
+    return &triple->slots[triple->read];
+}
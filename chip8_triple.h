@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+    Triple buffered frames.
+    Hands finished displays from the thread that runs a machine to the
+    thread that shows them, without either waiting. Of three slots the
+    producer owns one to fill, the consumer owns one to show, and the
+    third sits between them. Publishing swaps the filled slot with the
+    middle one, taking whatever was there; acquiring swaps the shown slot
+    with the middle one if a newer frame landed there. So the producer
+    never waits and the consumer always gets the newest frame, frames in
+    between are dropped.
+
+    The middle is one atomic word: the slot index, and a bit set when the
+    slot holds a frame the consumer has not taken yet.
+*/
+
+#include <stdint.h>
+
+#include "./chip8.h"
+
+struct chip8_triple_frame {
+    struct chip8_display display;
+    // Frames the machine had run.
+    uint64_t frame;
+    // CLOCK_MONOTONIC ns of the earliest input first run in this frame, or 0.
+    uint64_t input_ns;
+};
+
+struct chip8_triple {
+    struct chip8_triple_frame slots[3];
+    // Producer only.
+    int write;
+    // Consumer only.
+    int read;
+    // Shared: slot index | CHIP8_TRIPLE_FRESH.
+    unsigned middle;
+};
+
+#define CHIP8_TRIPLE_FRESH 4u
+
+void chip8_triple_init(struct chip8_triple *triple);
+
+// Producer. The slot to fill, then publish it.
+static inline struct chip8_triple_frame *chip8_triple_back(struct chip8_triple *triple) {
+    return &triple->slots[triple->write];
+}
+void chip8_triple_publish(struct chip8_triple *triple);
+
+// Consumer. The newest frame published since the last call, or NULL if
+// there is none. It stays valid until the next call.
+const struct chip8_triple_frame *chip8_triple_acquire(struct chip8_triple *triple);
@@ -0,0 +1,197 @@
+// Compile: gcc -O2 -pthread -o fleet fleet.c chip8_fleet.c chip8.c chip8_threaded.c chip8_jit.c stack.c
+// Usage: ./fleet jobs.txt [threads] [instructions per frame]
+//
+// Runs every session in the jobs file across all cores and prints one
+// CSV line per session. Each line of the jobs file is
+//
+//     rom frames [seed] [vip|schip|xochip] [frame:keys ...]
+//
+// where keys is the keypad as a hex mask, bit k for key k, set from that
+// frame on. Jobs run with SUPER-CHIP quirks unless they name others. Blank lines and lines starting with # are skipped.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "./chip8_fleet.h"
+
+#define MAX_LINE 4096
+
+static const char *halt_names[] = {
+    [CHIP8_HALT_DONE] = "done",
+    [CHIP8_HALT_INVALID_OPCODE] = "invalid_opcode",
+    [CHIP8_HALT_STACK_OVERFLOW] = "stack_overflow",
+    [CHIP8_HALT_STACK_UNDERFLOW] = "stack_underflow",
+    [CHIP8_HALT_EXITED] = "exited",
+    [CHIP8_HALT_BAD_ROM] = "bad_rom",
+    [CHIP8_HALT_NO_MEMORY] = "no_memory",
+};
+
+// Roms are loaded once and shared by every job that names them.
+struct rom_file {
+    char *path;
+    unsigned char data[MEMORY_SIZE - PROGRAM_START];
+    long size;
+};
+
+struct job_list {
+    struct chip8_fleet_job *jobs;
+    const char **rom_paths;
+    long count;
+    long capacity;
+
+    struct rom_file **roms;
+    int rom_count;
+};
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct rom_file *load_rom(struct job_list *list, const char *path) {
+    for(int i = 0; i < list->rom_count; i++) {
+        if(strcmp(list->roms[i]->path, path) == 0) {
+            return list->roms[i];
+        }
+    }
+
+    struct rom_file *rom = calloc(1, sizeof(struct rom_file));
+    rom->path = strdup(path);
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) {
+        fprintf(stderr, "Error open rom file %s\n", path);
+        // An empty rom still runs and reports what it did.
+    } else {
+        rom->size = fread(rom->data, 1, sizeof(rom->data), file);
+        fclose(file);
+    }
+
+    list->roms = realloc(list->roms, sizeof(struct rom_file *) * (list->rom_count + 1));
+    list->roms[list->rom_count++] = rom;
+    return rom;
+}
+
+// Parses one line of the jobs file. Returns -1 if it is malformed.
+static int parse_job(struct job_list *list, char *line, int line_number) {
+    char *token = strtok(line, " \t\r\n");
+    if(token == NULL || token[0] == '#') {
+        return 0;
+    }
+
+    struct chip8_fleet_job job;
+    memset(&job, 0, sizeof(job));
+    job.quirks = CHIP8_DEFAULT_QUIRKS;
+    struct rom_file *rom = load_rom(list, token);
+    job.rom = rom->data;
+    job.rom_size = rom->size;
+
+    token = strtok(NULL, " \t\r\n");
+    if(token == NULL) {
+        fprintf(stderr, "Line %d: missing frame count\n", line_number);
+        return -1;
+    }
+    job.frames = atol(token);
+
+    struct chip8_input_event *inputs = NULL;
+    while((token = strtok(NULL, " \t\r\n")) != NULL) {
+        char *colon = strchr(token, ':');
+        int quirks = chip8_quirks_from_name(token);
+        if(quirks >= 0) {
+            job.quirks = quirks;
+            continue;
+        }
+        if(colon == NULL) {
+            job.seed = strtoull(token, NULL, 0);
+            continue;
+        }
+        inputs = realloc(inputs, sizeof(struct chip8_input_event) * (job.input_count + 1));
+        inputs[job.input_count].frame = atol(token);
+        inputs[job.input_count].keys = strtoul(colon + 1, NULL, 16);
+        if(job.input_count > 0 && inputs[job.input_count].frame < inputs[job.input_count - 1].frame) {
+            fprintf(stderr, "Line %d: input events out of order\n", line_number);
+            free(inputs);
+            return -1;
+        }
+        job.input_count++;
+    }
+    job.inputs = inputs;
+
+    if(list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        list->jobs = realloc(list->jobs, sizeof(struct chip8_fleet_job) * list->capacity);
+        list->rom_paths = realloc(list->rom_paths, sizeof(const char *) * list->capacity);
+    }
+    list->rom_paths[list->count] = rom->path;
+    list->jobs[list->count++] = job;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    struct chip8_fleet_options options = CHIP8_FLEET_OPTIONS_DEFAULT;
+
+    if(argc < 2) {
+        printf("Usage: %s jobs.txt [threads] [instructions per frame]\n", argv[0]);
+        return -1;
+    }
+    if(argc > 2) {
+        options.threads = atoi(argv[2]);
+    }
+    if(argc > 3) {
+        options.cycles_per_frame = atol(argv[3]);
+    }
+
+    FILE *file = fopen(argv[1], "r");
+    if(file == NULL) {
+        fprintf(stderr, "Error open jobs file\n");
+        return -1;
+    }
+
+    struct job_list list;
+    memset(&list, 0, sizeof(list));
+    char line[MAX_LINE];
+    int line_number = 0;
+    while(fgets(line, sizeof(line), file) != NULL) {
+        if(parse_job(&list, line, ++line_number) < 0) {
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+
+    struct chip8_fleet_result *results = malloc(sizeof(struct chip8_fleet_result) * (list.count ? list.count : 1));
+    double start = now_seconds();
+    if(chip8_fleet_run(list.jobs, results, list.count, &options) < 0) {
+        fprintf(stderr, "Could not start the workers\n");
+        return -1;
+    }
+    double elapsed = now_seconds() - start;
+
+    long total_cycles = 0;
+    printf("job,rom,seed,quirks,halt,frames,cycles,idle_cycles,display_hash\n");
+    for(long i = 0; i < list.count; i++) {
+        const struct chip8_fleet_result *result = &results[i];
+        printf("%ld,%s,%llu,%s,%s,%ld,%ld,%ld,%016llx\n", i, list.rom_paths[i],
+               (unsigned long long) list.jobs[i].seed, chip8_quirks_name(list.jobs[i].quirks),
+               halt_names[result->halt], result->frames,
+               result->cycles, result->idle_cycles, (unsigned long long) result->display_hash);
+        total_cycles += result->cycles;
+    }
+    fprintf(stderr, "%ld sessions in %.2f s: %.0f sessions/hour, %.0f instr/s\n", list.count, elapsed,
+            list.count / elapsed * 3600, total_cycles / elapsed);
+
+    for(long i = 0; i < list.count; i++) {
+        free((void *) list.jobs[i].inputs);
+    }
+    for(int i = 0; i < list.rom_count; i++) {
+        free(list.roms[i]->path);
+        free(list.roms[i]);
+    }
+    free(list.roms);
+    free(list.jobs);
+    free(list.rom_paths);
+    free(results);
+    return 0;
+}
@@ -0,0 +1,144 @@
+// Compile: gcc -O2 -pthread -o lockstep lockstep.c chip8_lockstep.c chip8.c chip8_threaded.c chip8_jit.c stack.c
+// Usage: ./lockstep rom [lanes] [frames] [instructions per frame] [check|nocheck] [vip|schip|xochip]
+//
+// Runs one rom on up to 32 lanes in lockstep, each lane pressing its own
+// random keys, and reports the throughput and how often lanes ran together.
+// With check, every lane is also run on its own machine with the
+// interpreter and the two are compared after each frame.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "./chip8_lockstep.h"
+
+// Frames between key changes on a lane.
+#define KEY_HOLD_FRAMES 8
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The keys a lane holds on a frame, the same for a lane on every run.
+static uint16_t lane_keys(int lane, long frame) {
+    uint32_t x = (uint32_t) (lane + 1) * 2654435761u ^ (uint32_t) (frame / KEY_HOLD_FRAMES) * 40503u;
+    x ^= x >> 15;
+    x *= 2246822519u;
+    x ^= x >> 13;
+    // Mostly no key or one key.
+    return x & 0x30 ? 0 : 1 << (x >> 8 & 0xF);
+}
+
+// Returns true if the lane matches the machine.
+static bool same_state(const struct chip8_machine *lane, const struct chip8_machine *machine) {
+    return memcmp(lane->registers, machine->registers, sizeof(machine->registers)) == 0 &&
+           lane->PC == machine->PC && lane->I == machine->I &&
+           lane->delay_timer == machine->delay_timer && lane->sound_timer == machine->sound_timer &&
+           lane->status == machine->status &&
+           memcmp(lane->memory, machine->memory, sizeof(machine->memory)) == 0 &&
+           memcmp(&lane->display, &machine->display, sizeof(machine->display)) == 0 &&
+           lane->planes == machine->planes && memcmp(lane->flags, machine->flags, sizeof(machine->flags)) == 0 &&
+           lane->pitch == machine->pitch &&
+           memcmp(lane->audio_pattern, machine->audio_pattern, sizeof(machine->audio_pattern)) == 0 &&
+           lane->stack.elements == machine->stack.elements &&
+           memcmp(lane->stack.stack, machine->stack.stack, sizeof(int) * machine->stack.elements) == 0;
+}
+
+int main(int argc, char **argv) {
+    int lanes = CHIP8_LOCKSTEP_MAX_LANES;
+    long frames = 600;
+    long cycles_per_frame = CHIP8_CYCLES_PER_FRAME;
+    bool check = false;
+
+    if(argc < 2) {
+        printf("Usage: %s rom [lanes] [frames] [instructions per frame] [check|nocheck] [vip|schip|xochip]\n",
+               argv[0]);
+        return -1;
+    }
+    if(argc > 2) {
+        lanes = atoi(argv[2]);
+    }
+    if(argc > 3) {
+        frames = atol(argv[3]);
+    }
+    if(argc > 4) {
+        cycles_per_frame = atol(argv[4]);
+    }
+    if(argc > 5) {
+        check = strcmp(argv[5], "check") == 0;
+    }
+    int quirks = argc > 6 ? chip8_quirks_from_name(argv[6]) : CHIP8_DEFAULT_QUIRKS;
+    if(quirks < 0) {
+        printf("Unknown quirks %s\n", argv[6]);
+        return -1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if(file == NULL) {
+        printf("Error open rom file\n");
+        return -1;
+    }
+    static unsigned char rom[MEMORY_SIZE - PROGRAM_START];
+    long size = fread(rom, 1, sizeof(rom), file);
+    fclose(file);
+
+    struct chip8_lockstep *lockstep = malloc(sizeof(struct chip8_lockstep));
+    if(chip8_lockstep_init(lockstep, lanes, rom, size) < 0) {
+        printf("Could not start %d lanes\n", lanes);
+        return -1;
+    }
+    chip8_lockstep_set_quirks(lockstep, quirks);
+
+    struct chip8_machine *machines = NULL;
+    if(check) {
+        machines = malloc(sizeof(struct chip8_machine) * lanes);
+        for(int lane = 0; lane < lanes; lane++) {
+            chip8_init(&machines[lane]);
+            machines[lane].idle.enabled = false;
+            chip8_seed(&machines[lane], lane);
+            chip8_set_quirks(&machines[lane], quirks);
+            chip8_load_rom_buffer(&machines[lane], rom, size);
+        }
+    }
+
+    double elapsed = 0;
+    for(long frame = 0; frame < frames; frame++) {
+        for(int lane = 0; lane < lanes; lane++) {
+            chip8_set_keypad(&lockstep->machines[lane], lane_keys(lane, frame));
+        }
+
+        double start = now_seconds();
+        chip8_lockstep_run_frame(lockstep, cycles_per_frame);
+        elapsed += now_seconds() - start;
+
+        if(!check) {
+            continue;
+        }
+        chip8_lockstep_sync(lockstep);
+        for(int lane = 0; lane < lanes; lane++) {
+            chip8_set_keypad(&machines[lane], lane_keys(lane, frame));
+            chip8_run_frame(&machines[lane], cycles_per_frame);
+            if(!same_state(&lockstep->machines[lane], &machines[lane])) {
+                printf("Lane %d differs from the interpreter after frame %ld\n", lane, frame);
+                return 1;
+            }
+        }
+    }
+
+    printf("%d lanes, %ld frames: %.0f instr/s, %.1f lanes per instruction issued\n", lanes, frames,
+           lockstep->executed / elapsed, (double) lockstep->executed / lockstep->issued);
+    if(check) {
+        printf("All lanes match the interpreter\n");
+        for(int lane = 0; lane < lanes; lane++) {
+            chip8_destroy(&machines[lane]);
+        }
+        free(machines);
+    }
+
+    chip8_lockstep_destroy(lockstep);
+    free(lockstep);
+    return 0;
+}
@@ -1,700 +1,667 @@
-// Compile: gcc -o main main.c stack.c `sdl2-config --cflags --libs`
+// Compile: gcc -pthread -o main main.c chip8.c chip8_threaded.c chip8_jit.c chip8_audio.c chip8_capture.c chip8_render.c chip8_triple.c chip8_state.c chip8_replay.c chip8_trace.c stack.c `sdl2-config --cflags --libs`
+// Add -DCHIP8_PROFILE=1 and chip8_profile.c to write a profile next to the rom on exit.
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <time.h>
-#include <arpa/inet.h>
+#include <pthread.h>
 #include <SDL2/SDL.h>
 #include <stdbool.h>
 
-#include "./stack.h"
+#include "./chip8.h"
+#include "./chip8_audio.h"
+#include "./chip8_capture.h"
+#include "./chip8_profile.h"
+#include "./chip8_render.h"
+#include "./chip8_replay.h"
+#include "./chip8_state.h"
+#include "./chip8_trace.h"
+#include "./chip8_triple.h"
 
-#define DISPLAY_WIDTH 64
-#define DISPLAY_HEIGHT 32
+// The display is presented at most this often.
+#define FRAME_RATE 60
 
-#define DEBUG_MODE false
-#define COSMAC_VIP false
+// Window pixels per high resolution pixel.
+#define WINDOW_SCALE 5
 
+#define NS_PER_SECOND 1000000000ULL
 
-/*
-    Using one struct for all instructions.
-    Which field that are used is dependent on the first.
-*/
+// Bytes of rewind history, minutes of play for most roms.
+#define REWIND_CAPACITY (4 << 20)
 
-struct opcode {
-    unsigned short opcode;
-    unsigned char first;
-    unsigned char X;
-    unsigned char Y;
-    unsigned char N;
-    unsigned char NN;
-    unsigned short NNN;
-};
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
 
-struct opcode fetch_instruction(short *PC, unsigned char *memory) {
-    struct opcode opcode;
-    unsigned char a = htonl(memory[*PC]) >> 24;
-    unsigned char b = htonl(memory[*PC +1]) >>  24;
-    unsigned short instruction = ((short) a << 8) | b;
-	
-    // Short is 2 bytes - 16bits
-    // Instruction is now ABCD 
-    opcode.opcode = instruction;
-    // First nibblr
-    opcode.first = instruction >> 12;
-    // Second nibble
-    opcode.X = (instruction >> 8) & 0xF;
-    // Third nibble
-    opcode.Y = (instruction >> 4) & 0xF;
-    // Fourth nibble
-    opcode.N = (instruction) & 0xF;
-    // Second byte (third and fourth nibble)
-    opcode.NN = instruction & 0x00FF;
-    // Second, third and fourth nibble
-    opcode.NNN = instruction & 0x0FFF;
-
-    *PC += 2;
-    return opcode;
+// Sleeps until the monotonic clock reaches `deadline`.
+static void sleep_until(uint64_t deadline) {
+    struct timespec ts = { deadline / NS_PER_SECOND, deadline % NS_PER_SECOND };
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+        // Interrupted by a signal, go back to sleep.
+    }
 }
 
 
-void draw_display(SDL_Renderer *renderer, unsigned char display[DISPLAY_WIDTH][DISPLAY_HEIGHT]) {
-    
-    #define PIXEL_SIZE 10
-    // Clear the renderer before drawing the updated display
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
-    //SDL_RenderPresent(renderer);
+static const struct chip8_palette palette = CHIP8_PALETTE_DEFAULT;
 
+// Expands the display into the streaming texture and scales it to the window in one copy.
+void draw_display(SDL_Renderer *renderer, SDL_Texture *texture, const struct chip8_display *display) {
+    void *pixels;
+    int pitch;
 
-    // Draw the updated display
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    for (int x = 0; x < DISPLAY_WIDTH; x++) {
-        for (int y = 0; y < DISPLAY_HEIGHT; y++) {
-            if (display[x][y]) {
-                SDL_Rect pixelRect = {x * PIXEL_SIZE, y * PIXEL_SIZE, PIXEL_SIZE, PIXEL_SIZE};
-                SDL_RenderFillRect(renderer, &pixelRect);
-            }
-        }
+    if(SDL_LockTexture(texture, NULL, &pixels, &pitch) == 0) {
+        chip8_render_rgba(display, &palette, 1, pixels, pitch);
+        SDL_UnlockTexture(texture);
     }
 
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
     SDL_RenderPresent(renderer);
+}
 
-} 
+/*
+    Presents the newest frame from the emulation thread once per frame,
+    on the main thread, so vsync and the driver never hold up emulation.
+    Skipped when nothing was drawn since the last frame, or when the
+    drawing left the display as it was on screen.
+*/
 
-void load_rom(char *pathname, char *memory) {
-    printf("from memory: %c\n", *memory);
-    FILE *rom;
-    long fsize;
+struct frame_scheduler {
+    uint64_t next_frame_ns;
+    struct chip8_display presented;
+    // From a key change to the present of the first frame that ran it.
+    // Keys whose frame was skipped or changed nothing are not counted.
+    uint64_t latencies;
+    uint64_t latency_total_ns;
+    uint64_t latency_max_ns;
+};
 
-    if((rom = fopen(pathname, "rb")) == NULL) {
-        printf("Error open rom file\n");
+void present_frame(struct frame_scheduler *frames, SDL_Renderer *renderer, SDL_Texture *texture, struct chip8_triple *triple, uint64_t now) {
+    if(now < frames->next_frame_ns) {
+        return;
     }
 
-    // Find size of file
-    fseek(rom, 0L, SEEK_END);
-    fsize = ftell(rom);
-    rewind(rom);
-    printf("file size: %d\n",fsize);
-    // Read entire file into memory
-    fread(memory+0x200, fsize, 1,rom);
-    fclose(rom);
-}
+    frames->next_frame_ns += NS_PER_SECOND / FRAME_RATE;
+    if(frames->next_frame_ns < now) {
+        // Fell behind, don't try to catch up on missed frames.
+        frames->next_frame_ns = now + NS_PER_SECOND / FRAME_RATE;
+    }
 
-unsigned char vx_temp;
-unsigned char vy_temp;
+    const struct chip8_triple_frame *frame = chip8_triple_acquire(triple);
+    if(frame == NULL) {
+        return;
+    }
 
-int main() {
-	printf("Hello chip-8 :)\n");
+    if(memcmp(&frames->presented, &frame->display, sizeof(frames->presented)) == 0) {
+        return;
+    }
+    memcpy(&frames->presented, &frame->display, sizeof(frames->presented));
+    draw_display(renderer, texture, &frame->display);
+
+    if(frame->input_ns != 0) {
+        uint64_t latency = now_ns() - frame->input_ns;
+        frames->latencies++;
+        frames->latency_total_ns += latency;
+        if(latency > frames->latency_max_ns) {
+            frames->latency_max_ns = latency;
+        }
+    }
+}
 
-    // Program counter
-    // points at currenct incstruction in memory
-    short PC = 0x200;
-    // Index register
-    // Points at location in memory
-    short I = 0x00;
-    unsigned char display[DISPLAY_WIDTH][DISPLAY_HEIGHT];
-    memset(display,0x00, DISPLAY_WIDTH * DISPLAY_HEIGHT);
-    unsigned char memory[4096];
-    memset(memory,0x00, 4096);
-    unsigned char registers[16];
-
-    // Font as sprite data.
-    // The font has 16 hexadecimal characters
-    // Each character is 4x5 pixels
-    char font[80] = { 0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-                      0x20, 0x60, 0x20, 0x20, 0x70, // 1
-                      0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-                      0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-                      0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-                      0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-                      0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-                      0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-                      0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-                      0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-                      0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-                      0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-                      0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-                      0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-                      0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-                      0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-                      };
-
-    // Store the font in interpreters memory.
-    // From 0x50 by convention.
-    for(int i = 0; i < sizeof(font) / sizeof(font[0]); i++) {
-        memory[0x50 + i] = font[i];   
-    }
-
-    // Delay and sound timer
-    // Will be set to a register.
-    short delay_timer = 0;
-    short sound_timer = 0;
-
-    // Stack
-    // Will be used to store 12bit addresses
-    // Probably enough with 16
-    struct Stack stack;
-    stack.len = STACK_SIZE;
-    stack.elements = 0;
-    stack.stack = malloc(sizeof(int) * STACK_SIZE);
-
-    // Keypad
-    // Will be set to 1 on key down, and 0 on key up.
-    int numkeys;
-    short keypad[16];
-    const short keypad_values[16] = { 0x1, 0x2, 0x3, 0xC,
-                                      0x4, 0x5, 0x6, 0xD,
-                                      0x7, 0x8, 0x9, 0xE,
-                                      0xA, 0x0, 0xB, 0xF};
+// Called on the audio thread for every device buffer.
+void play_audio(void *userdata, Uint8 *stream, int len) {
+    chip8_audio_read(userdata, (int16_t *) stream, len / sizeof(int16_t));
+}
 
-    // Keeps the index for where the key is in keypad[]
-    const short keypad_indexes[16] = {13, 0, 1, 2,4,5,6,8,9,10,12,14,3,7,11,15};
+// Opens the default audio device to play from audio. Returns 0, with no sound, if there is none.
+SDL_AudioDeviceID open_audio(struct chip8_audio *audio) {
+    SDL_AudioSpec want = { 0 };
+    want.freq = audio->options.sample_rate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = CHIP8_AUDIO_DEVICE_SAMPLES;
+    want.callback = play_audio;
+    want.userdata = audio;
+    SDL_AudioDeviceID device = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+    if(device == 0) {
+        printf("No sound: %s\n", SDL_GetError());
+    }
+    return device;
+}
 
-    const Uint8* keyboard;
+// Keypad layout on the keyboard, row by row.
+static const SDL_Scancode keypad_scancodes[16] = { SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, SDL_SCANCODE_4,
+                                                   SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_R,
+                                                   SDL_SCANCODE_A, SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_F,
+                                                   SDL_SCANCODE_Z, SDL_SCANCODE_X, SDL_SCANCODE_C, SDL_SCANCODE_V };
 
-    load_rom("./roms/pong1pl.ch8", memory);
-   
-	// Set up SDL
-	SDL_Window *window;
-	SDL_Renderer *renderer;
-	if(SDL_Init(SDL_INIT_VIDEO) < 0) {
-		printf("Error initializing SDL\n");
-		return -1;
-	}
-	
-	SDL_CreateWindowAndRenderer(DISPLAY_WIDTH * 10,DISPLAY_HEIGHT * 10, 0, &window, &renderer);
-	if(!window)	{
-	printf("Failed to create window\n");
-	return -1;
-	}
+// The chip-8 key value at each position of the layout above.
+static const unsigned char keypad_values[16] = { 0x1, 0x2, 0x3, 0xC,
+                                                 0x4, 0x5, 0x6, 0xD,
+                                                 0x7, 0x8, 0x9, 0xE,
+                                                 0xA, 0x0, 0xB, 0xF};
 
-	
-	Uint64 prev_getticks = 0;
+// The keys held, bit n for key n.
+uint16_t read_keypad() {
+    int numkeys;
+    const Uint8 *keyboard = SDL_GetKeyboardState(&numkeys);
+    uint16_t keys = 0;
+    for(int i = 0; i < 16; i++) {
+        keys |= keyboard[keypad_scancodes[i]] << keypad_values[i];
+    }
+    return keys;
+}
 
-    int run_program  = 1;
-	while(run_program) {
-      SDL_Event e;
-      while(SDL_PollEvent(&e) > 0)
-        {   
-            switch(e.type) {
-                case SDL_QUIT:
-                    run_program = 0;
-                    break;
-                case SDL_KEYDOWN:
-                    keyboard = SDL_GetKeyboardState(&numkeys);
-                    keypad[0] = keyboard[SDL_SCANCODE_1];
-                    keypad[1] = keyboard[SDL_SCANCODE_2];
-                    keypad[2] = keyboard[SDL_SCANCODE_3];
-                    keypad[3] = keyboard[SDL_SCANCODE_4];
-                    keypad[4] = keyboard[SDL_SCANCODE_Q];
-                    keypad[5] = keyboard[SDL_SCANCODE_W];
-                    keypad[6] = keyboard[SDL_SCANCODE_E];
-                    keypad[7] = keyboard[SDL_SCANCODE_R];
-                    keypad[8] = keyboard[SDL_SCANCODE_A];
-                    keypad[9] = keyboard[SDL_SCANCODE_S];
-                    keypad[10] = keyboard[SDL_SCANCODE_D];
-                    keypad[11] = keyboard[SDL_SCANCODE_F];
-                    keypad[12] = keyboard[SDL_SCANCODE_Z];
-                    keypad[13] = keyboard[SDL_SCANCODE_X];
-                    keypad[14] = keyboard[SDL_SCANCODE_C];
-                    keypad[15] = keyboard[SDL_SCANCODE_V];
-                    break;
-                case SDL_KEYUP:
-                    keyboard = SDL_GetKeyboardState(&numkeys);
-                    keypad[0] = keyboard[SDL_SCANCODE_1];
-                    keypad[1] = keyboard[SDL_SCANCODE_2];
-                    keypad[2] = keyboard[SDL_SCANCODE_3];
-                    keypad[3] = keyboard[SDL_SCANCODE_4];
-                    keypad[4] = keyboard[SDL_SCANCODE_Q];
-                    keypad[5] = keyboard[SDL_SCANCODE_W];
-                    keypad[6] = keyboard[SDL_SCANCODE_E];
-                    keypad[7] = keyboard[SDL_SCANCODE_R];
-                    keypad[8] = keyboard[SDL_SCANCODE_A];
-                    keypad[9] = keyboard[SDL_SCANCODE_S];
-                    keypad[10] = keyboard[SDL_SCANCODE_D];
-                    keypad[11] = keyboard[SDL_SCANCODE_F];
-                    keypad[12] = keyboard[SDL_SCANCODE_Z];
-                    keypad[13] = keyboard[SDL_SCANCODE_X];
-                    keypad[14] = keyboard[SDL_SCANCODE_C];
-                    keypad[15] = keyboard[SDL_SCANCODE_V];
-                    break;
+/*
+    What the window thread tells the emulation thread. Events are polled
+    on the main thread, as SDL wants, and read by the emulation thread
+    once a frame with atomics, so neither waits on the other.
+*/
 
-                default:
-                    break;
-            }           
-        }   
-
-        // Fetch next expression
-        struct opcode opcode = fetch_instruction(&PC, memory);
-    
-        // If debug mode and current PC is breakpoint, wait for stepforward.
-
-        if(DEBUG_MODE) {
-            // Print current instruction, and options for what to do next.
-            printf("PC=%d\n", PC);
-            printf("opcode: %x\n", opcode.opcode);
-            printf("Press enter to step forward\n");
-            unsigned char c;
-            while(!isspace((c = getchar()))) {
-                // Consume newline
-                getchar();
-                switch(c) {
-                    case 'a':
-                        // Print registers
-                        printf("Registers V0 - VF:\n");
-                        printf("---------------------\n");
-                        for(int i = 0; i < sizeof(registers) / sizeof(registers[0]); i++) {
-                            printf("V%1x: %x (Decimal: %d)\n", i, registers[i], registers[i]);
-                        }
-                        printf("---------------------\n");
-                        break;
-                    default: 
-                        break;
-                }
+#define REQUEST_SAVE 1
+#define REQUEST_LOAD 2
+
+struct controls {
+    uint16_t keys;
+    // When the keys changed, if the emulation has not run them yet, else 0.
+    uint64_t input_ns;
+    bool fast_forward;
+    bool rewinding;
+    // REQUEST_ bits, taken by the emulation thread.
+    int requests;
+    // Set by the window on close, or by the emulation when the machine halts.
+    bool quit;
+};
 
-            }
-            
-        }
-  
-        // Decode and execute instructions
-        switch(opcode.first) {
-            case 0x00:
-                // 0NNN	Call - Calls machine code routine (RCA 1802 for COSMAC VIP) at address NNN. Not necessary for most ROMs.
-				switch(opcode.NN) {
-					case 0xE0:
-                		//00E0	Display	disp_clear()	Clears the screen.
-                        memset(display,0x00, DISPLAY_WIDTH * DISPLAY_HEIGHT);
-						break;
-					case 0xEE:		
-                		//00EE	Flow	return;	Returns from a subroutine.
-                        short return_addr = pop_stack(&stack);
-                        PC = return_addr;
-						break;
-					default:
-						printf("%x is not a valid instructon at PC=%d\n",opcode.opcode, PC);
-						exit(-1);
-				}
-				break;
-            case 0x1:
-                // 1NNN	Flow	goto NNN;	Jumps to address NNN.
-                PC = opcode.NNN;
-                break;
-            case 0x2:
-                // 2NNN	Flow	*(0xNNN)()	Calls subroutine at NNN.
-                // Push next PC to stack.
-                push_stack(&stack, PC);
-                PC = opcode.NNN;
-                break;
-            case 0x3:
-                //3XNN	Cond	if (Vx == NN)	Skips the next instruction if VX equals NN (usually the next instruction is a jump to skip a code block).
-                if(registers[opcode.X] == opcode.NN) {
-                    // Skip next instruction.
-                    PC += 2;
+void handle_key(struct controls *controls, const SDL_Event *e) {
+    uint16_t keys = read_keypad();
+    if(keys != __atomic_load_n(&controls->keys, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&controls->keys, keys, __ATOMIC_RELAXED);
+        // Keeps the earliest change. Releases the keys along with it.
+        uint64_t none = 0;
+        __atomic_compare_exchange_n(&controls->input_ns, &none, now_ns(), false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+    const Uint8 *keyboard = SDL_GetKeyboardState(NULL);
+    __atomic_store_n(&controls->fast_forward, keyboard[SDL_SCANCODE_TAB], __ATOMIC_RELAXED);
+    __atomic_store_n(&controls->rewinding, keyboard[SDL_SCANCODE_BACKSPACE], __ATOMIC_RELAXED);
+    if(e->type == SDL_KEYDOWN && !e->key.repeat && e->key.keysym.scancode == SDL_SCANCODE_F5) {
+        __atomic_or_fetch(&controls->requests, REQUEST_SAVE, __ATOMIC_RELAXED);
+    }
+    if(e->type == SDL_KEYDOWN && !e->key.repeat && e->key.keysym.scancode == SDL_SCANCODE_F9) {
+        __atomic_or_fetch(&controls->requests, REQUEST_LOAD, __ATOMIC_RELAXED);
+    }
+}
+
+void debug_prompt(struct chip8_machine *machine) {
+    // Print current instruction, and options for what to do next.
+    unsigned short PC = machine->PC & (MEMORY_SIZE - 1);
+    printf("PC=%d\n", machine->PC);
+    printf("opcode: %x\n", (machine->memory[PC] << 8) | machine->memory[(PC + 1) & (MEMORY_SIZE - 1)]);
+    printf("Press enter to step forward\n");
+    unsigned char c;
+    while(!isspace((c = getchar()))) {
+        // Consume newline
+        getchar();
+        switch(c) {
+            case 'a':
+                // Print registers
+                printf("Registers V0 - VF:\n");
+                printf("---------------------\n");
+                for(int i = 0; i < sizeof(machine->registers) / sizeof(machine->registers[0]); i++) {
+                    printf("V%1x: %x (Decimal: %d)\n", i, machine->registers[i], machine->registers[i]);
                 }
+                printf("---------------------\n");
                 break;
-            case 0x4:
-                //4XNN	Cond	.chif (Vx != NN)	Skips the next instruction if VX does not equal NN (usually the next instruction is a jump to skip a code block).
-                if(registers[opcode.X] != opcode.NN) {
-                    PC += 2;
-                }
+            default:
                 break;
-            
-            case 0x5:
-                // 5XY0	Cond	if (Vx == Vy)	Skips the next instruction if VX equals VY (usually the next instruction is a jump to skip a code block).
-              
-                if(registers[opcode.X] == registers[opcode.Y]) {
-                    PC += 2;
-                }
+        }
+    }
+}
 
-                
-                break;
+// Saves the machine to path. Returns -1 on failure.
+int save_state_file(const struct chip8_machine *machine, const char *path) {
+    struct chip8_snapshot snapshot;
+    FILE *file = fopen(path, "wb");
+    if(file == NULL) {
+        return -1;
+    }
+    chip8_save_state(machine, &snapshot);
+    int status = chip8_write_state(file, &snapshot);
+    fclose(file);
+    return status;
+}
 
+int load_state_file(struct chip8_machine *machine, const char *path) {
+    struct chip8_snapshot snapshot;
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) {
+        return -1;
+    }
+    int status = chip8_read_state(file, &snapshot);
+    fclose(file);
+    if(status == 0) {
+        chip8_load_state(machine, &snapshot);
+    }
+    return status;
+}
 
-            case 0x6:
-                // 6XNN	Const	Vx = NN	Sets VX to NN.
-                registers[opcode.X] = opcode.NN;
-                break;
-            case 0x7:     
-                // 7XNN	Const	Vx += NN	Adds NN to VX (carry flag is not changed).
-                registers[opcode.X] += opcode.NN;
-                break;
-            case 0x8:
-                switch(opcode.N) {
-                    case 0x0:
-                        // 8XY0	Assig	Vx = Vy	Sets VX to the value of VY.
-                        registers[opcode.X] = registers[opcode.Y];
-                        break;
-                    case 0x1:
-                        // 8XY1	BitOp	Vx |= Vy	Sets VX to VX or VY. (bitwise OR operation)
-                        registers[opcode.X] = registers[opcode.X] | registers[opcode.Y];
-
-                        if(COSMAC_VIP) {
-                            // Reset the flag register
-                            registers[0xF] = 0;
-                        }
-                        break;
-                    case 0x2:
-                        // 8XY2	BitOp	Vx &= Vy	Sets VX to VX and VY. (bitwise AND operation)
-                        registers[opcode.X] &= registers[opcode.Y];
-                        if(COSMAC_VIP) {
-                            // Reset the flag register
-                            registers[0xF] = 0;
-                        }
-                        break;
-                    case 0x3:
-                        // 8XY3[a]	BitOp	Vx ^= Vy	Sets VX to VX xor VY.
-                        registers[opcode.X] ^= registers[opcode.Y];
-                        if(COSMAC_VIP) {
-                            // Reset the flag register
-                            registers[0xF] = 0;
-                        }
-                        break;
-                    case 0x4:
-
-                        // 8XY4	Math	Vx += Vy	Adds VY to VX. 
-                        // VF is set to 1 when there's a carry, and to 0 when there is not.
-
-                        // Vf cannot be used as Vx or Vy 
-                        vx_temp = registers[opcode.X];
-                        vy_temp = registers[opcode.Y];
-                        registers[opcode.X] +=  registers[opcode.Y];
-
-                        // Check if there was a carry
-                        if(vx_temp + vy_temp > 0xFF) {
-                            registers[0xF] = 1;
-                        } else {
-                            registers[0xF] = 0;
-                        }
-
-                        break;
-                    case 0x5:
-                        // VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there is not.
-
-                        vx_temp = registers[opcode.X];
-                        vy_temp = registers[opcode.Y];
-                        //unsigned char result = registers[opcode.X] - registers[opcode.Y];
-                        registers[opcode.X] =  registers[opcode.X] - registers[opcode.Y];
-
-                        if(vx_temp < vy_temp) {
-                            registers[0xF] = 0;
-                        } else {
-                            registers[0xF] = 1;
-                        }
-
-                        break;
-                    case 0x6:
-
-                        // Ambigious instruction!!
-                        
-                        if(COSMAC_VIP) {
-                            // For the original COSMAC VIP:
-                            // Vy is stored in Vx, and Vx is shiftet to right by 1.
-                            registers[opcode.X] = registers[opcode.Y];
-                        } 
-                        
-                        // SCHIP: shifts the vx in place
-                        vx_temp = registers[opcode.X];
-                        registers[opcode.X] = registers[opcode.X] >> 1;
-                        // Both: Stores the least significant bit of vx in vf
-                        registers[0xF] = vx_temp & 0x1;
-
-
-                        break;
-                    case 0x7:
-                        // 8XY7[a]	Math	Vx = Vy - Vx	Sets VX to VY minus VX. 
-                        // VF is set to 0 when there's a borrow, and 1 when there is not.
-
-                        vx_temp = registers[opcode.X];
-                        vy_temp = registers[opcode.Y];
-
-                        registers[opcode.X] =  registers[opcode.Y] - registers[opcode.X]; 
-
-                        if(vy_temp < vx_temp) {
-                            registers[0xF] = 0;
-                        } else {
-                            registers[0xF] = 1;
-                        }
-
-                        break;
-                    case 0xE:
-
-                        // Ambiguous instruction
-                        if(COSMAC_VIP) {
-                            // For the original COSMAC VIP:
-                            // Vy is stored in Vx, and Vx is shiftet to left by 1.
-                            registers[opcode.X] = registers[opcode.Y];
-                        } 
-                        
-                        // 8XYE[a]	BitOp	Vx <<= 1	
-                        // Stores the most significant bit of VX in VF and then shifts VX to the left by 1.[b]
-                        vx_temp = registers[opcode.X];
-                        registers[opcode.X] = registers[opcode.X] << 1;
-                        registers[0xF] = (vx_temp & 0x80) >> 7; 
-
-                        break;
-                 }
+#if CHIP8_PROFILE
+void write_profile(const struct chip8_profile *profile, const char *rom) {
+    const char *extensions[] = { "csv", "json", "folded" };
+    void (*writers[])(const struct chip8_profile *, FILE *) = { chip8_profile_write_csv, chip8_profile_write_json,
+                                                               chip8_profile_write_folded };
+    char path[4096];
+    for(int i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s.profile.%s", rom, extensions[i]);
+        FILE *file = fopen(path, "w");
+        if(file == NULL) {
+            printf("Error open %s\n", path);
+            continue;
+        }
+        writers[i](profile, file);
+        fclose(file);
+    }
+    printf("Profile written to %s.profile.*\n", rom);
+}
+#endif
+
+// Prints the last instructions and the call stack of a halted machine, and writes them next to the rom.
+void write_trace(const struct chip8_trace *trace, const struct chip8_machine *machine, const char *rom) {
+    chip8_trace_dump_text(trace, machine, stdout);
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.trace", rom);
+    FILE *file = fopen(path, "wb");
+    if(file == NULL || chip8_trace_dump_binary(trace, machine, file) < 0) {
+        printf("Error writing trace to %s\n", path);
+    } else {
+        printf("Trace written to %s\n", path);
+    }
+    if(file != NULL) {
+        fclose(file);
+    }
+}
 
-                break;
-            case 0x9:
-                // 9XY0	Cond	if (Vx != Vy)	Skips the next instruction if VX does not equal VY.
-                // (Usually the next instruction is a jump to skip a code block);
-                if(registers[opcode.X] != registers[opcode.Y]) {
-                    PC += 2;
-                }
+// Stops a recording, which can't follow the machine through a rewind or a loaded state.
+void stop_recording(struct chip8_recorder *recorder, bool *recording) {
+    if(!*recording) {
+        return;
+    }
+    if(chip8_recorder_close(recorder) < 0) {
+        printf("Error writing recording\n");
+    } else {
+        printf("Recorded %ld frames\n", recorder->frame);
+    }
+    *recording = false;
+}
 
-                break;
+/*
+    The emulation thread. It owns the machine and everything that follows
+    it frame by frame, runs at CHIP8_FRAME_RATE or flat out, and publishes
+    each frame that drew something to `frames`.
+*/
 
-            case 0xa:
-                //ANNN	MEM	I = NNN	Sets I to the address NNN.
-                I = opcode.NNN;
-				break;
+struct emulator {
+    struct chip8_machine *machine;
+    long cycles_per_frame;
+    bool debug_mode;
+    struct chip8_rewind *rewind;
+    struct chip8_recorder *recorder;
+    bool recording;
+    struct chip8_audio *audio;
+    bool audio_on;
+    // Or NULL.
+    struct chip8_capture *capture;
+    const char *state_path;
+    struct controls *controls;
+    struct chip8_triple *frames;
+    // The earliest key change run but not yet in a published frame, or 0.
+    uint64_t input_ns;
+};
 
-            case 0xB:
-                // BNNN	Flow	PC = V0 + NNN	Jumps to the address NNN plus V0.
-                PC = opcode.NNN + registers[0x0];
-                break;
-            case 0xC:
-                // CXNN	Rand	Vx = rand() & NN	Sets VX to the result of a 
-                // bitwise and operation on a random number (Typically: 0 to 255) and NN.
-                srand(time(NULL));
-                short r = rand() % 256;
-                registers[opcode.X] = r & opcode.NN;
-                break;
+// Hands the display to the window thread if anything was drawn.
+void publish_frame(struct emulator *emulator, uint64_t frame_number) {
+    struct chip8_machine *machine = emulator->machine;
+    if(!machine->draw_flag) {
+        return;
+    }
+    machine->draw_flag = false;
+
+    struct chip8_triple_frame *frame = chip8_triple_back(emulator->frames);
+    frame->display = machine->display;
+    frame->frame = frame_number;
+    frame->input_ns = emulator->input_ns;
+    emulator->input_ns = 0;
+    chip8_triple_publish(emulator->frames);
+}
 
-            case 0xD:
-                
-                short vx = registers[opcode.X] % 64;
-                short vy = registers[opcode.Y] % 32;
-                short width = 8;
-                short height = opcode.N;
-                int pixel_address = I;
-                
-                //SDL_SetRenderDrawColor(renderer, 255,255,255,255);
-
-                registers[0xF] = 0;
-                for (int row = 0; row < height; row++) {
-                    char sprite_byte = memory[pixel_address + row];
-                    for (int col = 0; col < width; col++) {
-                        int pixelValue = (sprite_byte >> (7 - col)) & 0x1;
-                        
-                        //int x = (col + vx) % DISPLAY_WIDTH;
-                        //int y = (row + vy) % DISPLAY_HEIGHT;
-                        int x = (col + vx);
-                        int y = (row + vy);
-
-                        if(x >= 0 && x <= DISPLAY_WIDTH && y >= 0 && y <= DISPLAY_HEIGHT) {
-
-                            if (pixelValue) {
-                                if(display[x][y]) {
-                                    registers[0xF] = 1;
-                                }
-                                display[x][y] ^= 1;
-                            }
-                            
-                        }
-                        
-                    }
-                }
-                draw_display(renderer, display);
-        
-                break;
-            
-            case 0xE:
-                switch(opcode.NN) {
-                    case 0x9E:
-                        /* EX9E	KeyOp	if (key() == Vx)
-                           Skips the next instruction if the key stored in VX is pressed 
-                           (usually the next instruction is a jump to skip a code block).
-                        */
-
-                        // Get the keypad index of the key stored in vx from keypad_indexes.
-                        // If it is pressed, the key will be set to 1 in keypad[]
-                        if(keypad[keypad_indexes[registers[opcode.X]]]) {
-                            //printf("key is pressed");
-                            PC += 2;
-                        }
-                        break;
-                    case 0xA1:
-                        // EXA1	KeyOp	if (key() != Vx)	
-                        // Skips the next instruction if the key stored in VX is not pressed 
-                        // (usually the next instruction is a jump to skip a code block).
-                        
-                        // Get the keypad index of the key stored in vx from keypad_indexes.
-                        // If it is not pressed, the key will be set to 0 in keypad[]
-                        if(!keypad[keypad_indexes[registers[opcode.X]]]) {
-                            PC += 2;
-                        }
-                        break;
-                    default: 
-                        break;
-                }
-                break;
-            case 0xF:
-                switch (opcode.NN)
-                {
-                case 0x07:
-                    // FX07	Timer	Vx = get_delay()	Sets VX to the value of the delay timer.
-                    registers[opcode.X] = delay_timer;
-                    break;
-                case 0x0A:
-                    // FX0A	KeyOp	Vx = get_key()	A key press is awaited, and then stored in VX 
-                    // (blocking operation, all instruction halted until next key event).
-
-                    short key_pressed = -1;
-
-                    // For now just set it to first pressed key it finds.
-                    // Should probably handle multiple key presses.
-
-                    for(short i = 0; i < 16; i++) {
-                        if(keypad[i]) {
-                            key_pressed = i;
-                        }
-                    }
-                    
-                    // If there was no key press, decrement the PC and break
-                    if(key_pressed == -1) {
-                        PC -= 2;
-                        break;
-                    }
-
-                    // If there was a key press, store it in VX.
-        
-                    registers[opcode.X] = keypad_values[key_pressed];
-                    break;
-                case 0x15:
-                    //FX15	Timer	delay_timer(Vx)	Sets the delay timer to VX.
-                    delay_timer = registers[opcode.X];
-                    break;
-                case 0x18:
-                    //FX18	Sound	sound_timer(Vx)	Sets the sound timer to VX.
-                    sound_timer = registers[opcode.X];
-                    break;
-                case 0x1E:
-                    // FX1E	MEM	I += Vx	Adds VX to I. VF is not affected.
-                    I += registers[opcode.X];
-                    break;
-                case 0x29:
-                    // FX29	MEM	I = sprite_addr[Vx]	Sets I to the location of 
-                    // the sprite for the character in VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font.
-                    
-                    // The font is stored from memory address 0x50
-                    I = 0x50 + 5 * registers[opcode.X];
-                    break;
-                case 0x33:
-                    // FX33	BCD	
-                    // Stores the binary-coded decimal representation of VX, with the hundreds digit in memory at location in I, 
-                    // the tens digit at location I+1, and the ones digit at location I+2.
-                    
-                    memory[I] = registers[opcode.X] / 100 % 10;
-                    memory[I + 1] = registers[opcode.X] / 10 % 10;
-                    memory[I + 2] = registers[opcode.X] % 10;
+void *emulate(void *arg) {
+    struct emulator *emulator = arg;
+    struct chip8_machine *machine = emulator->machine;
+    struct controls *controls = emulator->controls;
+
+    // When the next emulated frame is due.
+    uint64_t deadline = now_ns();
+    for(uint64_t frame = 1; !__atomic_load_n(&controls->quit, __ATOMIC_ACQUIRE); frame++) {
+        uint64_t input_ns = __atomic_exchange_n(&controls->input_ns, 0, __ATOMIC_ACQUIRE);
+        if(emulator->input_ns == 0) {
+            emulator->input_ns = input_ns;
+        }
+        chip8_set_keypad(machine, __atomic_load_n(&controls->keys, __ATOMIC_RELAXED));
 
-                    break;
-                case 0x55:
-                    // FX55	MEM	reg_dump(Vx, &I)	Stores from V0 to VX (including VX) in memory, starting at address I. 
-                    // The offset from I is increased by 1 for each value written, but I itself is left unmodified.
+        int requests = __atomic_exchange_n(&controls->requests, 0, __ATOMIC_RELAXED);
+        if((requests & REQUEST_SAVE) && save_state_file(machine, emulator->state_path) < 0) {
+            printf("Error saving state to %s\n", emulator->state_path);
+        }
+        if(requests & REQUEST_LOAD) {
+            if(load_state_file(machine, emulator->state_path) < 0) {
+                printf("Error loading state from %s\n", emulator->state_path);
+            } else {
+                // Keep the keys held now, not the ones saved with the state.
+                chip8_set_keypad(machine, __atomic_load_n(&controls->keys, __ATOMIC_RELAXED));
+                stop_recording(emulator->recorder, &emulator->recording);
+            }
+        }
 
-                    for(int i = 0, offset = 0; i <= opcode.X; i++, offset++) {
-                        memory[I+offset] = registers[i];
+        bool rewinding = __atomic_load_n(&controls->rewinding, __ATOMIC_RELAXED);
+        if(rewinding) {
+            // Keep the keys held now, not the ones recorded with the state.
+            chip8_rewind_pop(emulator->rewind, machine);
+            chip8_set_keypad(machine, __atomic_load_n(&controls->keys, __ATOMIC_RELAXED));
+            stop_recording(emulator->recorder, &emulator->recording);
+        } else if(emulator->debug_mode) {
+            // If debug mode, wait for stepforward before each instruction.
+            for(long i = 0; i < emulator->cycles_per_frame && machine->status == CHIP8_OK; i++) {
+                debug_prompt(machine);
+                chip8_run_cycles(machine, 1);
+            }
+            chip8_tick_timers(machine);
+        } else {
+#if CHIP8_PROFILE
+            uint64_t started = now_ns();
+            chip8_run_frame(machine, emulator->cycles_per_frame);
+            machine->profile->execute_ns += now_ns() - started;
+#else
+            chip8_run_frame(machine, emulator->cycles_per_frame);
+#endif
+        }
+        if(!rewinding) {
+            chip8_rewind_push(emulator->rewind, machine);
+        }
+        if(emulator->recording) {
+            chip8_recorder_frame(emulator->recorder, machine);
+        }
+        if(emulator->audio_on) {
+            chip8_audio_frame(emulator->audio, machine);
+        }
+        publish_frame(emulator, frame);
+        if(emulator->capture != NULL) {
+            chip8_capture_frame(emulator->capture, &machine->display);
+        }
 
-                    }
+        if(machine->status != CHIP8_OK) {
+            break;
+        }
 
-                    if(COSMAC_VIP) {
-                        I += opcode.X + 1;
-                    }
-                    break;
-                case 0x65:
-                    // FX65	MEM	reg_load(Vx, &I)	Fills from V0 to VX (including VX) with values from memory, starting at address I. 
-                    // The offset from I is increased by 1 for each value read, but I itself is left unmodified.
-                    for(int i = 0, offset = 0; i <= opcode.X; i++, offset++) {
-                        registers[i] =  memory[I+offset];
+        uint64_t now = now_ns();
+        if(__atomic_load_n(&controls->fast_forward, __ATOMIC_RELAXED)) {
+            deadline = now;
+            continue;
+        }
 
-                    }
+        deadline += NS_PER_SECOND / CHIP8_FRAME_RATE;
+        if(deadline < now) {
+            // Fell behind, run the next frame right away but don't try to catch up.
+            deadline = now;
+        }
+        sleep_until(deadline);
+    }
+    __atomic_store_n(&controls->quit, true, __ATOMIC_RELEASE);
+    return NULL;
+}
 
-                    if(COSMAC_VIP) {
-                        I += opcode.X +1;
-                    }
-                    break;
+// Usage: ./main [--quirks=vip|schip|xochip] [--debug] [--audio-depth=samples] [--capture=video] [rom] [instructions per frame] [recording]
+// --debug waits for a key before each instruction.
+// --audio-depth is the most sound queued ahead of the audio device, one frame and one device buffer by default.
+// --capture records every frame to a .y4m, .avi or .png sequence, dropping frames rather than slowing down.
+// Hold tab to run uncapped, hold backspace to rewind.
+// F5 saves the state next to the rom, F9 loads it.
+// With a recording path, the keypad is recorded for ./replay until a rewind or a load.
+// Prints the delay from a key to the frame that shows it on exit.
+int main(int argc, char **argv) {
+	printf("Hello chip-8 :)\n");
 
-                default:
-                    break;
+    // Options first, then positional arguments.
+    int quirks = CHIP8_DEFAULT_QUIRKS;
+    bool debug_mode = false;
+    struct chip8_audio_options audio_options = CHIP8_AUDIO_OPTIONS_DEFAULT;
+    const char *capture_path = NULL;
+    int arg = 1;
+    for(; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if(strncmp(argv[arg], "--quirks=", 9) == 0) {
+            quirks = chip8_quirks_from_name(argv[arg] + 9);
+            if(quirks < 0) {
+                printf("Unknown quirks %s\n", argv[arg] + 9);
+                return -1;
+            }
+        } else if(strcmp(argv[arg], "--debug") == 0) {
+            debug_mode = true;
+        } else if(strncmp(argv[arg], "--audio-depth=", 14) == 0) {
+            audio_options.depth = atoi(argv[arg] + 14);
+        } else if(strncmp(argv[arg], "--capture=", 10) == 0) {
+            capture_path = argv[arg] + 10;
+        } else {
+            printf("Unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    argc -= arg - 1;
+    argv += arg - 1;
+
+    const char *rom = argc > 1 ? argv[1] : "./roms/pong1pl.ch8";
+    long cycles_per_frame = argc > 2 ? atol(argv[2]) : CHIP8_CYCLES_PER_FRAME;
+    const char *recording_path = argc > 3 ? argv[3] : NULL;
+    uint64_t seed = time(NULL);
+
+    struct chip8_machine *machine = malloc(sizeof(struct chip8_machine));
+    chip8_init(machine);
+    chip8_seed(machine, seed);
+    chip8_set_quirks(machine, quirks);
+    // The trace is only for the dump on a fault, run without one if there is no room.
+    struct chip8_trace *trace = malloc(sizeof(struct chip8_trace));
+    if(trace != NULL) {
+        chip8_trace_init(trace);
+        machine->trace = trace;
+    }
+#if CHIP8_PROFILE
+    struct chip8_profile *profile = malloc(sizeof(struct chip8_profile));
+    chip8_profile_init(profile);
+    machine->profile = profile;
+#endif
+
+    if(chip8_load_rom(machine, rom) < 0) {
+        chip8_destroy(machine);
+        free(machine);
+        free(trace);
+        return -1;
+    }
 
+	// Set up SDL
+	SDL_Window *window;
+	SDL_Renderer *renderer;
+	if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
+		printf("Error initializing SDL\n");
+		return -1;
+	}
 
-                break;
-            }
+	SDL_CreateWindowAndRenderer(CHIP8_HIRES_WIDTH * WINDOW_SCALE,CHIP8_HIRES_HEIGHT * WINDOW_SCALE, 0, &window, &renderer);
+	if(!window)	{
+	printf("Failed to create window\n");
+	return -1;
+	}
 
-            break;
+    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING,
+                                             CHIP8_HIRES_WIDTH, CHIP8_HIRES_HEIGHT);
+    if(!texture) {
+        printf("Failed to create texture\n");
+        return -1;
+    }
 
-        default:		
-            printf(" - %x is not a valid instructon at PC=%d\n",opcode.opcode, PC);
-            continue;
-            //exit(-1);
+
+    // Start with a blank frame on screen.
+    struct frame_scheduler frames = { 0 };
+    draw_display(renderer, texture, &machine->display);
+
+    struct chip8_rewind rewind;
+    if(chip8_rewind_init(&rewind, REWIND_CAPACITY) < 0) {
+        printf("Failed to allocate rewind buffer\n");
+        return -1;
+    }
+
+    struct chip8_audio audio;
+    if(chip8_audio_init(&audio, &audio_options) < 0) {
+        return -1;
+    }
+    SDL_AudioDeviceID audio_device = open_audio(&audio);
+    if(audio_device != 0) {
+        SDL_PauseAudioDevice(audio_device, 0);
+    }
+
+    struct chip8_recorder recorder;
+    bool recording = false;
+    if(recording_path != NULL) {
+        if(chip8_recorder_open(&recorder, recording_path, machine, seed, cycles_per_frame, CHIP8_REPLAY_HASH_INTERVAL) < 0) {
+            printf("Error open recording file %s\n", recording_path);
+            return -1;
         }
-		
-    
-        // Delay timer
-            // Count down timer if its larger than zero.
-        if(delay_timer > 0) {
-            delay_timer -= 1;
+        recording = true;
+    }
 
+    char state_path[4096];
+    snprintf(state_path, sizeof(state_path), "%s.state", rom);
+
+    int status = 0;
+    struct chip8_triple *triple = malloc(sizeof(struct chip8_triple));
+    struct chip8_capture *capture = NULL;
+    if(capture_path != NULL) {
+        struct chip8_capture_options capture_options = CHIP8_CAPTURE_OPTIONS_DEFAULT;
+        capture = malloc(sizeof(struct chip8_capture));
+        if(capture == NULL || chip8_capture_open(capture, capture_path, &capture_options) < 0) {
+            free(capture);
+            capture = NULL;
+            status = -1;
         }
-        
+    }
+    if(triple == NULL) {
+        printf("Failed to allocate frames\n");
+        status = -1;
+    }
+    if(status < 0) {
+        goto done;
+    }
 
-        // Sound timer
-        // Should also play a beep
-        // Count down timer if its larger than zero.
-        if(sound_timer > 0) {
-            sound_timer -= 1;
+    struct controls controls = { 0 };
+    chip8_triple_init(triple);
+    struct emulator emulator = {
+        .machine = machine,
+        .cycles_per_frame = cycles_per_frame,
+        .debug_mode = debug_mode,
+        .rewind = &rewind,
+        .recorder = &recorder,
+        .recording = recording,
+        .audio = &audio,
+        .audio_on = audio_device != 0,
+        .capture = capture,
+        .state_path = state_path,
+        .controls = &controls,
+        .frames = triple,
+    };
+    pthread_t emulation;
+    if(pthread_create(&emulation, NULL, emulate, &emulator) != 0) {
+        printf("Failed to start the emulation thread\n");
+        status = -1;
+        goto done;
+    }
+
+    // Sleeps in SDL_WaitEventTimeout until the next present is due, so keys are seen as they come.
+    while(!__atomic_load_n(&controls.quit, __ATOMIC_ACQUIRE)) {
+        uint64_t now = now_ns();
+        int timeout_ms = frames.next_frame_ns > now ? (frames.next_frame_ns - now) / 1000000 : 0;
+        SDL_Event e;
+        int pending = SDL_WaitEventTimeout(&e, timeout_ms);
+        while(pending > 0) {
+            switch(e.type) {
+                case SDL_QUIT:
+                    __atomic_store_n(&controls.quit, true, __ATOMIC_RELEASE);
+                    break;
+                case SDL_KEYDOWN:
+                case SDL_KEYUP:
+                    handle_key(&controls, &e);
+                    break;
 
+                default:
+                    break;
+            }
+            pending = SDL_PollEvent(&e);
         }
-    
-
-		Uint64 ticks = SDL_GetTicks64();
-		double seconds = ((double) (ticks - prev_getticks)) / 1000.0;
-			
-		// Wait until 1/60 seconds
-		while(seconds < 1.0 / (60.0 * 10.0)) {
-			ticks = SDL_GetTicks64();
-			seconds = (double) (ticks - prev_getticks) / 1000.0;
-		}
-		
-		prev_getticks = ticks;
-
-		draw_display(renderer, display);
-	}
 
+        now = now_ns();
+        present_frame(&frames, renderer, texture, triple, now);
+#if CHIP8_PROFILE
+        profile->render_ns += now_ns() - now;
+#endif
+	}
+    pthread_join(emulation, NULL);
+    recording = emulator.recording;
+
+    // Everything set up before the emulation thread is released from here on.
+done:
+    if(frames.latencies > 0) {
+        printf("Input to display: %llu frames, %.1f ms average, %.1f ms worst\n", (unsigned long long) frames.latencies,
+               frames.latency_total_ns / 1e6 / frames.latencies, frames.latency_max_ns / 1e6);
+    }
 
-    free(stack.stack);
+    stop_recording(&recorder, &recording);
+    if(audio_device != 0) {
+        SDL_CloseAudioDevice(audio_device);
+        printf("Audio: %llu underruns, %llu overruns\n", (unsigned long long) chip8_audio_underruns(&audio),
+               (unsigned long long) chip8_audio_overruns(&audio));
+    }
+    chip8_audio_destroy(&audio);
+    if(capture != NULL) {
+        uint64_t dropped = capture->dropped;
+        if(chip8_capture_close(capture) == 0) {
+            printf("Captured %llu frames to %s, dropped %llu\n", (unsigned long long) capture->written, capture_path,
+                   (unsigned long long) dropped);
+        }
+        free(capture);
+    }
+    if(trace != NULL && machine->status != CHIP8_OK && machine->status != CHIP8_EXITED) {
+        write_trace(trace, machine, rom);
+    }
+    machine->trace = NULL;
+    free(trace);
+#if CHIP8_PROFILE
+    write_profile(profile, rom);
+    machine->profile = NULL;
+    free(profile);
+#endif
+    chip8_rewind_destroy(&rewind);
+    free(triple);
+    chip8_destroy(machine);
+    free(machine);
 	SDL_Delay(10);
 
 	// Clean up SDL
+    SDL_DestroyTexture(texture);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 
 
-	return 0;
+	return status;
 
 }
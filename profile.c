@@ -0,0 +1,119 @@
+// Compile: gcc -O2 -DCHIP8_PROFILE=1 -o profile profile.c chip8_profile.c chip8_replay.c chip8.c chip8_threaded.c chip8_jit.c stack.c
+// Usage: ./profile rom output [recording | frames]
+//
+// Profiles a rom, replaying a recording made with ./main, or running a
+// number of frames with no keys pressed. Writes output.csv, output.json
+// and output.folded (for flamegraph.pl) and prints the busiest
+// instructions and addresses.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "./chip8_profile.h"
+#include "./chip8_replay.h"
+
+#if !CHIP8_PROFILE
+#error "Build with -DCHIP8_PROFILE=1"
+#endif
+
+#define DEFAULT_FRAMES 3600
+// Rows printed of each table.
+#define TOP 10
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int write_file(const struct chip8_profile *profile, const char *output, const char *extension,
+                      void (*write)(const struct chip8_profile *, FILE *)) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.%s", output, extension);
+    FILE *file = fopen(path, "w");
+    if(file == NULL) {
+        printf("Error open %s\n", path);
+        return -1;
+    }
+    write(profile, file);
+    fclose(file);
+    return 0;
+}
+
+// Prints the largest of `count` counters, as picked by repeated selection.
+static void print_top(const uint64_t *counters, int count, bool addresses, uint64_t total) {
+    bool *printed = calloc(count, sizeof(bool));
+    for(int row = 0; row < TOP; row++) {
+        int best = -1;
+        for(int i = 0; i < count; i++) {
+            if(!printed[i] && counters[i] != 0 && (best < 0 || counters[i] > counters[best])) {
+                best = i;
+            }
+        }
+        if(best < 0) {
+            break;
+        }
+        printed[best] = true;
+        if(addresses) {
+            printf("  0x%03x %14llu %6.2f%%\n", best, (unsigned long long) counters[best], 100.0 * counters[best] / total);
+        } else {
+            printf("  %-5s %14llu %6.2f%%\n", chip8_op_name(best), (unsigned long long) counters[best],
+                   100.0 * counters[best] / total);
+        }
+    }
+    free(printed);
+}
+
+int main(int argc, char **argv) {
+    if(argc < 3) {
+        printf("Usage: %s rom output [recording | frames]\n", argv[0]);
+        return -1;
+    }
+
+    struct chip8_machine *machine = malloc(sizeof(struct chip8_machine));
+    struct chip8_profile *profile = malloc(sizeof(struct chip8_profile));
+    chip8_init(machine);
+    chip8_profile_init(profile);
+    machine->profile = profile;
+    if(chip8_load_rom(machine, argv[1]) < 0) {
+        return -1;
+    }
+
+    struct chip8_replay replay;
+    uint64_t start = now_ns();
+    if(argc > 3 && chip8_replay_open(&replay, argv[3]) == 0) {
+        struct chip8_replay_result result;
+        chip8_replay_run(&replay, machine, &result);
+        chip8_replay_close(&replay);
+        if(result.diverged_at >= 0) {
+            printf("Diverged from the recording after frame %ld\n", result.diverged_at);
+        }
+    } else {
+        long frames = argc > 3 ? atol(argv[3]) : DEFAULT_FRAMES;
+        for(long frame = 0; frame < frames && machine->status == CHIP8_OK; frame++) {
+            chip8_run_frame(machine, CHIP8_CYCLES_PER_FRAME);
+        }
+    }
+    profile->execute_ns = now_ns() - start;
+
+    uint64_t total = profile->instructions ? profile->instructions : 1;
+    printf("%llu instructions, %llu skipped as idle, %llu draws, %llu collisions\n",
+           (unsigned long long) profile->instructions, (unsigned long long) machine->idle.skipped,
+           (unsigned long long) profile->draws, (unsigned long long) profile->collisions);
+    printf("Instructions:\n");
+    print_top(profile->ops, CHIP8_OP_COUNT, false, total);
+    printf("Addresses:\n");
+    print_top(profile->pcs, MEMORY_SIZE, true, total);
+
+    int status = 0;
+    status |= write_file(profile, argv[2], "csv", chip8_profile_write_csv);
+    status |= write_file(profile, argv[2], "json", chip8_profile_write_json);
+    status |= write_file(profile, argv[2], "folded", chip8_profile_write_folded);
+
+    chip8_destroy(machine);
+    free(machine);
+    free(profile);
+    return status;
+}
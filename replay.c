@@ -0,0 +1,78 @@
+// Compile: gcc -O2 -o replay replay.c chip8_replay.c chip8.c chip8_threaded.c chip8_jit.c stack.c
+// Usage: ./replay rom recording [call|threaded|jit]
+//
+// Replays a session recorded with ./main rom [instructions per frame] recording
+// at full speed, checks the state hashes in it, and reports the first frame
+// where the run diverges from the recording.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "./chip8_replay.h"
+
+static const char *engine_names[] = {
+    [CHIP8_ENGINE_CALL] = "call",
+    [CHIP8_ENGINE_THREADED] = "threaded",
+    [CHIP8_ENGINE_JIT] = "jit",
+};
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    if(argc < 3) {
+        printf("Usage: %s rom recording [call|threaded|jit]\n", argv[0]);
+        return -1;
+    }
+
+    struct chip8_replay replay;
+    if(chip8_replay_open(&replay, argv[2]) < 0) {
+        printf("Error reading recording %s\n", argv[2]);
+        return -1;
+    }
+
+    struct chip8_machine *machine = malloc(sizeof(struct chip8_machine));
+    chip8_init(machine);
+    if(argc > 3) {
+        for(int engine = CHIP8_ENGINE_CALL; engine <= CHIP8_ENGINE_JIT; engine++) {
+            if(strcmp(argv[3], engine_names[engine]) == 0) {
+                machine->engine = engine;
+            }
+        }
+    }
+    if(chip8_load_rom(machine, argv[1]) < 0) {
+        return -1;
+    }
+
+    struct chip8_replay_result result;
+    double start = now_seconds();
+    chip8_replay_run(&replay, machine, &result);
+    double elapsed = now_seconds() - start;
+
+    printf("%ld frames, %ld instructions in %.3f s: %.0f frames/s, %.0f instr/s\n", result.frames, result.cycles,
+           elapsed, result.frames / elapsed, result.cycles / elapsed);
+
+    int status = 0;
+    if(result.diverged_at == 0) {
+        printf("The machine does not start out as recorded, is it the same rom?\n");
+        status = 1;
+    } else if(result.diverged_at > 0) {
+        printf("Diverged from the recording after frame %ld\n", result.diverged_at);
+        status = 1;
+    } else if(result.truncated) {
+        printf("The recording is truncated, all %ld frames in it match\n", result.frames);
+        status = 1;
+    } else {
+        printf("Matches the recording\n");
+    }
+
+    chip8_replay_close(&replay);
+    chip8_destroy(machine);
+    free(machine);
+    return status;
+}
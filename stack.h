@@ -4,7 +4,8 @@
 struct Stack {
     int len;
     int elements;
-    int *stack;
+    // Stored inline so a machine owns its stack and can be copied as a whole.
+    int stack[STACK_SIZE];
 
 };
 
@@ -0,0 +1,308 @@
+// Compile: gcc -o translate translate.c chip8.c chip8_threaded.c chip8_jit.c stack.c
+// Usage: ./translate rom.ch8 name [vip|schip|xochip] > name.c
+//
+// Translates a rom to C ahead of time. Follows jumps, calls and skips from
+// PROGRAM_START to find the instructions, and emits one label per
+// instruction with direct gotos between them, so nothing is fetched or
+// decoded at run time. The result defines
+//
+//     long <name>_run(struct chip8_machine *machine, long cycles);
+//
+// to be set as machine->aot with machine->engine = CHIP8_ENGINE_AOT.
+// Returns, indirect jumps (BNNN) and addresses the translation did not
+// reach go through a switch on PC, falling back to the interpreter for
+// unknown ones. A write into translated code hands the rest of the run
+// to the interpreter. The quirk profile is fixed at translation time,
+// machines with another one run on the interpreter.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "./chip8.h"
+
+static const char *op_names[CHIP8_OP_COUNT] = {
+    [CHIP8_OP_INVALID] = "invalid", [CHIP8_OP_NOP] = "nop",
+    [CHIP8_OP_00E0] = "00e0", [CHIP8_OP_00EE] = "00ee", [CHIP8_OP_00CN] = "00cn", [CHIP8_OP_00DN] = "00dn",
+    [CHIP8_OP_00FB] = "00fb", [CHIP8_OP_00FC] = "00fc", [CHIP8_OP_00FD] = "00fd", [CHIP8_OP_00FE] = "00fe",
+    [CHIP8_OP_00FF] = "00ff", [CHIP8_OP_1NNN] = "1nnn", [CHIP8_OP_2NNN] = "2nnn", [CHIP8_OP_3XNN] = "3xnn",
+    [CHIP8_OP_4XNN] = "4xnn", [CHIP8_OP_5XY0] = "5xy0", [CHIP8_OP_5XY2] = "5xy2", [CHIP8_OP_5XY3] = "5xy3",
+    [CHIP8_OP_6XNN] = "6xnn", [CHIP8_OP_7XNN] = "7xnn",
+    [CHIP8_OP_8XY0] = "8xy0", [CHIP8_OP_8XY1] = "8xy1", [CHIP8_OP_8XY2] = "8xy2", [CHIP8_OP_8XY3] = "8xy3",
+    [CHIP8_OP_8XY4] = "8xy4", [CHIP8_OP_8XY5] = "8xy5", [CHIP8_OP_8XY6] = "8xy6", [CHIP8_OP_8XY7] = "8xy7",
+    [CHIP8_OP_8XYE] = "8xye", [CHIP8_OP_9XY0] = "9xy0", [CHIP8_OP_ANNN] = "annn", [CHIP8_OP_BNNN] = "bnnn",
+    [CHIP8_OP_CXNN] = "cxnn", [CHIP8_OP_DXYN] = "dxyn", [CHIP8_OP_EX9E] = "ex9e", [CHIP8_OP_EXA1] = "exa1",
+    [CHIP8_OP_FN01] = "fn01", [CHIP8_OP_F002] = "f002", [CHIP8_OP_FX07] = "fx07", [CHIP8_OP_FX0A] = "fx0a", [CHIP8_OP_FX15] = "fx15",
+    [CHIP8_OP_FX18] = "fx18", [CHIP8_OP_FX1E] = "fx1e", [CHIP8_OP_FX29] = "fx29", [CHIP8_OP_FX30] = "fx30",
+    [CHIP8_OP_FX33] = "fx33", [CHIP8_OP_FX3A] = "fx3a", [CHIP8_OP_FX55] = "fx55", [CHIP8_OP_FX65] = "fx65", [CHIP8_OP_FX75] = "fx75",
+    [CHIP8_OP_FX85] = "fx85",
+};
+
+static unsigned char rom[MEMORY_SIZE - PROGRAM_START];
+static long rom_size;
+static enum chip8_quirks quirks = CHIP8_DEFAULT_QUIRKS;
+
+static struct chip8_decoded decoded[MEMORY_SIZE];
+static bool reachable[MEMORY_SIZE];
+
+// True if a whole instruction at the address is inside the rom.
+static bool in_rom(int address) {
+    return address >= PROGRAM_START && address + 1 < PROGRAM_START + rom_size;
+}
+
+static bool is_skip(unsigned char op) {
+    return op == CHIP8_OP_3XNN || op == CHIP8_OP_4XNN || op == CHIP8_OP_5XY0 || op == CHIP8_OP_9XY0 ||
+           op == CHIP8_OP_EX9E || op == CHIP8_OP_EXA1;
+}
+
+// Builds the control flow graph from PROGRAM_START, marking every instruction it reaches.
+static void find_code() {
+    // Every instruction pushes at most two successors.
+    static unsigned short worklist[2 * MEMORY_SIZE + 1];
+    int pending = 0;
+
+    worklist[pending++] = PROGRAM_START;
+    while(pending > 0) {
+        int address = worklist[--pending];
+        if(!in_rom(address) || reachable[address]) {
+            continue;
+        }
+        reachable[address] = true;
+
+        const unsigned char *bytes = rom + address - PROGRAM_START;
+        struct chip8_decoded *d = &decoded[address];
+        chip8_decode((bytes[0] << 8) | bytes[1], quirks, d);
+
+        int next = address + 2;
+        switch(d->op) {
+            case CHIP8_OP_1NNN:
+                worklist[pending++] = d->NNN;
+                break;
+            case CHIP8_OP_2NNN:
+                worklist[pending++] = d->NNN;
+                worklist[pending++] = next;
+                break;
+            case CHIP8_OP_00EE:
+            case CHIP8_OP_BNNN:
+            case CHIP8_OP_INVALID:
+            case CHIP8_OP_00FD:
+                // Return addresses are found from the calls, indirect jumps
+                // are left to the interpreter.
+                break;
+            default:
+                worklist[pending++] = next;
+                if(is_skip(d->op)) {
+                    worklist[pending++] = next + 2;
+                }
+                break;
+        }
+    }
+}
+
+// Emits a jump to the instruction at `address`, through the dispatch switch if it was not translated.
+static void emit_goto(FILE *out, int address) {
+    if(address >= 0 && address < MEMORY_SIZE && reachable[address]) {
+        fprintf(out, "goto L_%04x;\n", address);
+    } else {
+        fprintf(out, "goto dispatch;\n");
+    }
+}
+
+static void emit_instruction(FILE *out, int address) {
+    const struct chip8_decoded *d = &decoded[address];
+    int next = address + 2;
+
+    fprintf(out, "L_%04x:\n", address);
+    fprintf(out, "    if(executed >= cycles) {\n");
+    fprintf(out, "        machine->PC = 0x%03x;\n", address);
+    fprintf(out, "        return executed;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    executed++;\n");
+    fprintf(out, "    machine->PC = 0x%03x;\n", next);
+
+    if(chip8_memory_written(d) > 0) {
+        fprintf(out, "    written = machine->I;\n");
+    }
+    if((CHIP8_QUIRK_OPS >> d->op) & 1) {
+        fprintf(out, "    op_%s_%s(machine, &d_%04x);\n", op_names[d->op], chip8_quirks_name(quirks), address);
+    } else {
+        fprintf(out, "    op_%s(machine, &d_%04x);\n", op_names[d->op], address);
+    }
+
+    switch(d->op) {
+        case CHIP8_OP_2NNN:
+            // A call with the stack full halts the machine.
+            fprintf(out, "    if(machine->status != CHIP8_OK) {\n        return executed;\n    }\n");
+            fprintf(out, "    ");
+            emit_goto(out, d->NNN);
+            break;
+        case CHIP8_OP_1NNN:
+            fprintf(out, "    ");
+            emit_goto(out, d->NNN);
+            break;
+        case CHIP8_OP_00EE:
+        case CHIP8_OP_BNNN:
+            fprintf(out, "    goto dispatch;\n");
+            break;
+        case CHIP8_OP_INVALID:
+        case CHIP8_OP_00FD:
+            fprintf(out, "    return executed;\n");
+            break;
+        case CHIP8_OP_FX0A:
+            // Waiting for a key moves PC back onto the instruction.
+            fprintf(out, "    if(machine->PC != 0x%03x) {\n        ", next);
+            emit_goto(out, address);
+            fprintf(out, "    }\n    ");
+            emit_goto(out, next);
+            break;
+        case CHIP8_OP_5XY2:
+        case CHIP8_OP_FX33:
+        case CHIP8_OP_FX55:
+            fprintf(out, "    if(aot_writes_code(written, %d, code_ranges, CODE_RANGE_COUNT)) {\n",
+                    chip8_memory_written(d));
+            fprintf(out, "        return aot_interpret(machine, executed, cycles);\n");
+            fprintf(out, "    }\n    ");
+            emit_goto(out, next);
+            break;
+        default:
+            if(is_skip(d->op)) {
+                fprintf(out, "    if(machine->PC == 0x%03x) {\n        ", next);
+                emit_goto(out, next);
+                fprintf(out, "    }\n    ");
+                emit_goto(out, next + 2);
+            } else {
+                fprintf(out, "    ");
+                emit_goto(out, next);
+            }
+            break;
+    }
+    fprintf(out, "\n");
+}
+
+static void emit(FILE *out, const char *rom_path, const char *name) {
+    bool writes_memory = false;
+
+    fprintf(out, "// Generated by translate.c from %s with %s quirks. Do not edit.\n\n", rom_path,
+            chip8_quirks_name(quirks));
+    fprintf(out, "#include \"./chip8_aot.h\"\n\n");
+
+    // The rom, to check that memory still holds the translated code.
+    fprintf(out, "static const unsigned char rom[%ld] = {", rom_size);
+    for(long i = 0; i < rom_size; i++) {
+        fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", rom[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    // Runs of memory holding translated instructions.
+    int range_count = 0;
+    fprintf(out, "static const struct aot_range code_ranges[] = {\n");
+    for(int address = PROGRAM_START; address < MEMORY_SIZE; ) {
+        if(!reachable[address] && !(address > 0 && reachable[address - 1])) {
+            address++;
+            continue;
+        }
+        int start = address;
+        while(address < MEMORY_SIZE && (reachable[address] || (address > 0 && reachable[address - 1]))) {
+            address++;
+        }
+        fprintf(out, "    { 0x%03x, %d },\n", start, address - start);
+        range_count++;
+    }
+    if(range_count == 0) {
+        fprintf(out, "    { PROGRAM_START, 0 },\n");
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "#define CODE_RANGE_COUNT %d\n\n", range_count);
+
+    for(int address = PROGRAM_START; address < MEMORY_SIZE; address++) {
+        if(!reachable[address]) {
+            continue;
+        }
+        const struct chip8_decoded *d = &decoded[address];
+        fprintf(out, "static const struct chip8_decoded d_%04x = { .op = CHIP8_OP_", address);
+        for(const char *c = op_names[d->op]; *c; c++) {
+            fputc(toupper((unsigned char) *c), out);
+        }
+        fprintf(out, ", .X = 0x%x, .Y = 0x%x, .N = 0x%x, .NN = 0x%02x, .NNN = 0x%03x };\n",
+                d->X, d->Y, d->N, d->NN, d->NNN);
+        if(chip8_memory_written(d) > 0) {
+            writes_memory = true;
+        }
+    }
+    fprintf(out, "\n");
+
+    fprintf(out, "long %s_run(struct chip8_machine *machine, long cycles) {\n", name);
+    fprintf(out, "    long executed = 0;\n");
+    if(writes_memory) {
+        fprintf(out, "    unsigned short written;\n");
+    }
+    fprintf(out, "\n");
+    fprintf(out, "    if(machine->quirks != %d || !aot_code_intact(machine, rom, code_ranges, CODE_RANGE_COUNT)) {\n",
+            quirks);
+    fprintf(out, "        return aot_interpret(machine, 0, cycles);\n");
+    fprintf(out, "    }\n\n");
+
+    fprintf(out, "dispatch:\n");
+    fprintf(out, "    if(executed >= cycles || machine->status != CHIP8_OK) {\n");
+    fprintf(out, "        return executed;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    switch(machine->PC & (MEMORY_SIZE - 1)) {\n");
+    for(int address = PROGRAM_START; address < MEMORY_SIZE; address++) {
+        if(reachable[address]) {
+            fprintf(out, "        case 0x%03x: goto L_%04x;\n", address, address);
+        }
+    }
+    fprintf(out, "        default:\n");
+    fprintf(out, "            // Not reached by the translation.\n");
+    fprintf(out, "            chip8_step(machine);\n");
+    fprintf(out, "            executed++;\n");
+    fprintf(out, "            if(!aot_code_intact(machine, rom, code_ranges, CODE_RANGE_COUNT)) {\n");
+    fprintf(out, "                return aot_interpret(machine, executed, cycles);\n");
+    fprintf(out, "            }\n");
+    fprintf(out, "            goto dispatch;\n");
+    fprintf(out, "    }\n\n");
+
+    for(int address = PROGRAM_START; address < MEMORY_SIZE; address++) {
+        if(reachable[address]) {
+            emit_instruction(out, address);
+        }
+    }
+    fprintf(out, "}\n");
+}
+
+int main(int argc, char **argv) {
+    if(argc < 3) {
+        printf("Usage: %s rom.ch8 name [vip|schip|xochip] > name.c\n", argv[0]);
+        return -1;
+    }
+
+    const char *name = argv[2];
+    for(const char *c = name; *c; c++) {
+        if(!(isalnum((unsigned char) *c) || *c == '_') || isdigit((unsigned char) name[0])) {
+            fprintf(stderr, "%s is not a valid C identifier\n", name);
+            return -1;
+        }
+    }
+
+    if(argc > 3) {
+        int named = chip8_quirks_from_name(argv[3]);
+        if(named < 0) {
+            fprintf(stderr, "Unknown quirks %s\n", argv[3]);
+            return -1;
+        }
+        quirks = named;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if(file == NULL) {
+        fprintf(stderr, "Error open rom file\n");
+        return -1;
+    }
+    rom_size = fread(rom, 1, sizeof(rom), file);
+    fclose(file);
+
+    find_code();
+    emit(stdout, argv[1], name);
+    return 0;
+}
@@ -0,0 +1,151 @@
+// Compile: gcc -O2 -o tree tree.c chip8_tree.c chip8.c chip8_threaded.c chip8_jit.c stack.c
+// Usage: ./tree rom [depth] [branches] [frames per branch] [check]
+//
+// Runs a random tree search on a rom: at each level every key is tried
+// as a branch from the current node, and the search goes on from one of
+// them. Reports forks and branch captures per second and how many pages
+// the live nodes share. With check, every branch is also run on a full
+// copy of the machine and the two are compared.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "./chip8_tree.h"
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns true if the working machine matches the copy.
+static bool same_state(const struct chip8_machine *machine, const struct chip8_machine *copy) {
+    return memcmp(machine->registers, copy->registers, sizeof(copy->registers)) == 0 &&
+           machine->PC == copy->PC && machine->I == copy->I &&
+           machine->delay_timer == copy->delay_timer && machine->sound_timer == copy->sound_timer &&
+           machine->status == copy->status &&
+           memcmp(machine->memory, copy->memory, sizeof(copy->memory)) == 0 &&
+           memcmp(&machine->display, &copy->display, sizeof(copy->display)) == 0 &&
+           machine->planes == copy->planes && memcmp(machine->flags, copy->flags, sizeof(copy->flags)) == 0 &&
+           machine->pitch == copy->pitch &&
+           memcmp(machine->audio_pattern, copy->audio_pattern, sizeof(copy->audio_pattern)) == 0 &&
+           machine->stack.elements == copy->stack.elements &&
+           memcmp(machine->stack.stack, copy->stack.stack, sizeof(int) * copy->stack.elements) == 0;
+}
+
+int main(int argc, char **argv) {
+    long depth = 200;
+    int branches = 16;
+    long frames = 4;
+    bool check = false;
+
+    if(argc < 2) {
+        printf("Usage: %s rom [depth] [branches] [frames per branch] [check]\n", argv[0]);
+        return -1;
+    }
+    if(argc > 2) {
+        depth = atol(argv[2]);
+    }
+    if(argc > 3) {
+        branches = atoi(argv[3]);
+    }
+    if(argc > 4) {
+        frames = atol(argv[4]);
+    }
+    if(argc > 5) {
+        check = strcmp(argv[5], "check") == 0;
+    }
+    if(branches < 1) {
+        branches = 1;
+    }
+
+    struct chip8_machine *machine = malloc(sizeof(struct chip8_machine));
+    chip8_init(machine);
+    if(chip8_load_rom(machine, argv[1]) < 0) {
+        return -1;
+    }
+
+    struct chip8_machine *copies = NULL;
+    struct chip8_machine *copy = NULL;
+    if(check) {
+        copies = malloc(sizeof(struct chip8_machine) * branches);
+        copy = malloc(sizeof(struct chip8_machine));
+        memcpy(copy, machine, sizeof(*copy));
+    }
+
+    struct chip8_tree tree;
+    chip8_tree_init(&tree, machine);
+    struct chip8_node *root = chip8_tree_capture(&tree);
+    struct chip8_node **children = malloc(sizeof(struct chip8_node *) * branches);
+
+    long forks = 0;
+    long captures = 0;
+    long peak_nodes = 0;
+    long peak_pages = 0;
+    uint32_t random_state = 0x2545F491;
+    double start = now_seconds();
+    for(long level = 0; level < depth; level++) {
+        for(int branch = 0; branch < branches; branch++) {
+            struct chip8_node *fork = chip8_tree_fork(&tree, root);
+            forks++;
+            chip8_tree_enter(&tree, fork);
+            chip8_set_keypad(machine, branch == 0 ? 0 : 1 << ((branch - 1) & 0xF));
+            for(long frame = 0; frame < frames; frame++) {
+                chip8_run_frame(machine, CHIP8_CYCLES_PER_FRAME);
+            }
+            children[branch] = chip8_tree_capture(&tree);
+            captures++;
+            chip8_tree_release(&tree, fork);
+
+            if(check) {
+                memcpy(&copies[branch], copy, sizeof(*copy));
+                chip8_set_keypad(&copies[branch], branch == 0 ? 0 : 1 << ((branch - 1) & 0xF));
+                for(long frame = 0; frame < frames; frame++) {
+                    chip8_run_frame(&copies[branch], CHIP8_CYCLES_PER_FRAME);
+                }
+                if(!same_state(machine, &copies[branch])) {
+                    printf("Branch %d at level %ld differs from the copy\n", branch, level);
+                    return 1;
+                }
+            }
+        }
+        if(tree.nodes > peak_nodes) {
+            peak_nodes = tree.nodes;
+            peak_pages = tree.pages;
+        }
+
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        int chosen = random_state % branches;
+
+        chip8_tree_release(&tree, root);
+        root = children[chosen];
+        for(int branch = 0; branch < branches; branch++) {
+            if(branch != chosen) {
+                chip8_tree_release(&tree, children[branch]);
+            }
+        }
+        if(check) {
+            memcpy(copy, &copies[chosen], sizeof(*copy));
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("%ld levels of %d branches: %.0f forks/s, %.0f branches/s, %ld nodes sharing %ld pages of %d bytes\n",
+           depth, branches, forks / elapsed, captures / elapsed, peak_nodes, peak_pages, CHIP8_PAGE_SIZE);
+    if(check) {
+        printf("All branches match full copies\n");
+        free(copies);
+        free(copy);
+    }
+
+    chip8_tree_release(&tree, root);
+    chip8_tree_destroy(&tree);
+    chip8_destroy(machine);
+    free(machine);
+    free(children);
+    return 0;
+}